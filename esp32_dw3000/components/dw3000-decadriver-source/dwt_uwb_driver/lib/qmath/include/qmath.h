@@ -12,6 +12,7 @@
 #ifndef QMATH_H
 #define QMATH_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define LUT_LOG_SHIFT     15U
@@ -45,4 +46,34 @@ uint16_t log10_10(uint32_t x);
  */
 uint32_t q8_pow_of_base2(int32_t exponent_q18);
 
+/**
+ * log2_lut_batch - Compute log2(x) for an array.
+ * @x: values to convert in log2.
+ * @out: log2(x[i]) shifted by LUT_LOG_SHIFT, must not overlap x.
+ * @n: number of values.
+ *
+ * Results are identical to log2_lut().
+ */
+void log2_lut_batch(const uint32_t *x, uint32_t *out, size_t n);
+
+/**
+ * log10_10_batch - Compute 10*log10(x) for an array.
+ * @x: values to convert in 10*log10(x).
+ * @out: 10*log10(x[i]) in 100th dB, must not overlap x.
+ * @n: number of values.
+ *
+ * Results are identical to log10_10().
+ */
+void log10_10_batch(const uint32_t *x, uint16_t *out, size_t n);
+
+/**
+ * q8_pow_of_base2_batch - Compute 2 ^ exponent_q18 for an array.
+ * @exponent_q18: fixed point values.
+ * @out: 2 ^ exponent_q18[i], must not overlap exponent_q18.
+ * @n: number of values.
+ *
+ * Results are identical to q8_pow_of_base2().
+ */
+void q8_pow_of_base2_batch(const int32_t *exponent_q18, uint32_t *out, size_t n);
+
 #endif /* QMATH_H */
@@ -59,7 +59,7 @@ static const uint16_t lut_log2[LUT_SIZE] =
  * Hence the use of __builtin_clz to find quickly the msb (named z in the algo).
  */
 
-uint32_t log2_lut(uint32_t x)
+static inline uint32_t log2_lut_one(uint32_t x)
 {
     uint32_t log2_x = 0UL;
     uint64_t x_shifted = 0ULL;
@@ -101,7 +101,7 @@ uint32_t log2_lut(uint32_t x)
  * Here log2(10) << LUT_LOG_SHIFT = 1088
  * As we want the result of 10*log10(x) in 100th dB we divide only by 1088/10 = 109
  */
-uint16_t log10_10(uint32_t x)
+static inline uint16_t log10_10_one(uint32_t x)
 {
     /* log10(0) is not valid hence return an error.*/
     if (x == 0UL)
@@ -109,10 +109,10 @@ uint16_t log10_10(uint32_t x)
         return LOG_INVALID_VALUE;
     }
 
-    return (uint16_t)((log2_lut(x) + (LOG2_10_SHIFTED_100TH >> 1UL)) / LOG2_10_SHIFTED_100TH);
+    return (uint16_t)((log2_lut_one(x) + (LOG2_10_SHIFTED_100TH >> 1UL)) / LOG2_10_SHIFTED_100TH);
 }
 
-uint32_t q8_pow_of_base2(int32_t exponent_q18)
+static inline uint32_t q8_pow_of_base2_one(int32_t exponent_q18)
 {
     uint16_t int_part = 0U;
     uint16_t frac_part = 0U;
@@ -153,3 +153,49 @@ uint32_t q8_pow_of_base2(int32_t exponent_q18)
 
     return ((r1_q5 * r2_q5) >> 2UL);
 }
+
+uint32_t log2_lut(uint32_t x)
+{
+    return log2_lut_one(x);
+}
+
+uint16_t log10_10(uint32_t x)
+{
+    return log10_10_one(x);
+}
+
+uint32_t q8_pow_of_base2(int32_t exponent_q18)
+{
+    return q8_pow_of_base2_one(exponent_q18);
+}
+
+/*
+ * The batch variants share the inlined scalar kernels, so their results are
+ * bit-exact with the scalar functions. Inlining into one loop removes the call
+ * overhead per value and keeps the lookup tables and constants in registers.
+ * The kernels are built on clz and table lookups, which have no SIMD
+ * equivalent without gather loads, so there is no target specific variant.
+ */
+void log2_lut_batch(const uint32_t *restrict x, uint32_t *restrict out, size_t n)
+{
+    for (size_t i = 0U; i < n; i++)
+    {
+        out[i] = log2_lut_one(x[i]);
+    }
+}
+
+void log10_10_batch(const uint32_t *restrict x, uint16_t *restrict out, size_t n)
+{
+    for (size_t i = 0U; i < n; i++)
+    {
+        out[i] = log10_10_one(x[i]);
+    }
+}
+
+void q8_pow_of_base2_batch(const int32_t *restrict exponent_q18, uint32_t *restrict out, size_t n)
+{
+    for (size_t i = 0U; i < n; i++)
+    {
+        out[i] = q8_pow_of_base2_one(exponent_q18[i]);
+    }
+}
@@ -7,6 +7,7 @@
 #include <gtest/gtest.h>
 
 #include <cmath>
+#include <vector>
 
 extern "C"
 {
@@ -69,3 +70,65 @@ TEST_F(TestLogMin, logMin)
 
     EXPECT_EQ(result_q8, LOG_INVALID_VALUE);
 }
+
+class TestBatch : public ::testing::Test
+{
+protected:
+    std::vector<uint32_t> values;
+    std::vector<int32_t> exponents;
+
+    void SetUp() override
+    {
+        values = {0, 1, 2, 3, 0xffffffff, 0x80000000, 0x7fffffff};
+        for (uint32_t x = 4; x < 0x10000000; x += x / 7 + 1)
+        {
+            values.push_back(x);
+        }
+        for (int32_t e = -40 * LOG2_10_DIV_10_Q16; e < 40 * LOG2_10_DIV_10_Q16; e += 1237)
+        {
+            exponents.push_back(e);
+        }
+    }
+};
+
+TEST_F(TestBatch, log2)
+{
+    std::vector<uint32_t> out(values.size());
+    log2_lut_batch(values.data() + 1, out.data() + 1, values.size() - 1);
+
+    for (size_t i = 1; i < values.size(); i++)
+    {
+        EXPECT_EQ(out[i], log2_lut(values[i])) << "x = " << values[i];
+    }
+}
+
+TEST_F(TestBatch, log10)
+{
+    std::vector<uint16_t> out(values.size());
+    log10_10_batch(values.data(), out.data(), values.size());
+
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        EXPECT_EQ(out[i], log10_10(values[i])) << "x = " << values[i];
+    }
+    EXPECT_EQ(out[0], LOG_INVALID_VALUE);
+}
+
+TEST_F(TestBatch, powOfBase2)
+{
+    std::vector<uint32_t> out(exponents.size());
+    q8_pow_of_base2_batch(exponents.data(), out.data(), exponents.size());
+
+    for (size_t i = 0; i < exponents.size(); i++)
+    {
+        EXPECT_EQ(out[i], q8_pow_of_base2(exponents[i])) << "exponent = " << exponents[i];
+    }
+}
+
+TEST_F(TestBatch, empty)
+{
+    uint32_t out = 0x12345678;
+    log2_lut_batch(values.data(), &out, 0);
+
+    EXPECT_EQ(out, 0x12345678U);
+}
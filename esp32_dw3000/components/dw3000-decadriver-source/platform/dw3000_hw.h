@@ -2,6 +2,7 @@
 #define DW3000_HW_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 int dw3000_hw_init(void);
 int dw3000_hw_init_interrupt(void);
@@ -12,5 +13,10 @@ void dw3000_hw_wakeup_pin_low(void);
 void dw3000_hw_interrupt_enable(void);
 void dw3000_hw_interrupt_disable(void);
 bool dw3000_hw_interrupt_is_enabled(void);
+/* Wait for the IRQ line (SPIRDY/RCINIT) instead of polling the device after
+ * wake-up. Call prepare before triggering the wake-up. Returns 0 when the
+ * IRQ line was raised, an error on timeout or if not supported */
+void dw3000_hw_ready_wait_prepare(void);
+int dw3000_hw_ready_wait(uint32_t timeout_ms);
 
 #endif
@@ -1,15 +1,67 @@
 
 #include <driver/gpio.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <freertos/task.h>
+#include <rom/ets_sys.h>
 
 #include "deca_device_api.h"
 #include "dw3000_hw.h"
 #include "dw3000_spi.h"
 #include "log.h"
 
+#define DW3000_RESET_TIMEOUT_MS 100
+#define DW3000_RESET_PULSE_US	10	/* API guide says 10ns */
+#define DW3000_WAKEUP_PULSE_US	500
+
 static const char* LOG_TAG = "DW3000";
 static bool dw3000_interrupt_enabled;
+/* given from ISR when the DW3000 signals it is ready */
+static SemaphoreHandle_t dw3000_ready_sem;
+static volatile bool dw3000_ready_wait;
+
+static void dw3000_ready_give_from_isr(void)
+{
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	xSemaphoreGiveFromISR(dw3000_ready_sem, &xHigherPriorityTaskWoken);
+	if (xHigherPriorityTaskWoken) {
+		portYIELD_FROM_ISR();
+	}
+}
+
+#if CONFIG_DW3000_GPIO_RESET != -1
+static void dw3000_reset_isr(void* args)
+{
+	dw3000_ready_give_from_isr();
+}
+
+/* the DW3000 keeps RESET low until it is ready, wait for the rising edge */
+static int dw3000_hw_wait_reset(void)
+{
+	int ret = ESP_OK;
+
+	if (gpio_get_level(CONFIG_DW3000_GPIO_RESET)) {
+		return ESP_OK;
+	}
+
+	xSemaphoreTake(dw3000_ready_sem, 0);
+	gpio_set_intr_type(CONFIG_DW3000_GPIO_RESET, GPIO_INTR_POSEDGE);
+	gpio_isr_handler_add(CONFIG_DW3000_GPIO_RESET, dw3000_reset_isr, NULL);
+
+	/* check again, the edge may have been before the handler was added */
+	if (!gpio_get_level(CONFIG_DW3000_GPIO_RESET)
+		&& xSemaphoreTake(dw3000_ready_sem,
+						  pdMS_TO_TICKS(DW3000_RESET_TIMEOUT_MS) + 1)
+			   != pdTRUE
+		&& !gpio_get_level(CONFIG_DW3000_GPIO_RESET)) {
+		ret = ESP_ERR_TIMEOUT;
+	}
+
+	gpio_isr_handler_remove(CONFIG_DW3000_GPIO_RESET);
+	gpio_set_intr_type(CONFIG_DW3000_GPIO_RESET, GPIO_INTR_DISABLE);
+	return ret;
+}
+#endif
 
 int dw3000_hw_init(void)
 {
@@ -20,6 +72,16 @@ int dw3000_hw_init(void)
 	 * RESET: output low, open drain, no pull-up
 	 * normally used as input to see when DW3000 is ready
 	 */
+	if (dw3000_ready_sem == NULL) {
+		dw3000_ready_sem = xSemaphoreCreateBinary();
+		if (dw3000_ready_sem == NULL) {
+			return ESP_ERR_NO_MEM;
+		}
+	}
+
+	/* may already be installed */
+	gpio_install_isr_service(0);
+
 #if CONFIG_DW3000_GPIO_RESET != -1
 	gpio_config_t io_conf_reset = {
 		.mode = GPIO_MODE_INPUT,
@@ -28,11 +90,7 @@ int dw3000_hw_init(void)
 	gpio_config(&io_conf_reset);
 
 	/* check reset state */
-	int timeout = 1000;
-	while (!gpio_get_level(CONFIG_DW3000_GPIO_RESET) && --timeout > 0) {
-		vTaskDelay(1);
-	}
-	if (timeout <= 0) {
+	if (dw3000_hw_wait_reset() != ESP_OK) {
 		LOG_ERR("did not come out of reset");
 		return ESP_ERR_TIMEOUT;
 	}
@@ -55,6 +113,13 @@ int dw3000_hw_init(void)
 
 static void dw3000_isr(void* args)
 {
+	if (dw3000_ready_wait) {
+		/* status is cleared by the waiting task */
+		dw3000_ready_wait = false;
+		dw3000_ready_give_from_isr();
+		return;
+	}
+
 	while (gpio_get_level(CONFIG_DW3000_GPIO_IRQ)) {
 		dwt_isr();
 	}
@@ -121,10 +186,12 @@ void dw3000_hw_reset(void)
 	LOG_INF("HW reset");
 	gpio_set_direction(CONFIG_DW3000_GPIO_RESET, GPIO_MODE_OUTPUT);
 	gpio_set_level(CONFIG_DW3000_GPIO_RESET, 0);
-	vTaskDelay(1); // 10 us?
-	gpio_set_level(CONFIG_DW3000_GPIO_RESET, 1);
-	vTaskDelay(2); // From sample platform code
+	ets_delay_us(DW3000_RESET_PULSE_US);
+	/* release, the DW3000 drives it low until it is ready */
 	gpio_set_direction(CONFIG_DW3000_GPIO_RESET, GPIO_MODE_INPUT);
+	if (dw3000_hw_wait_reset() != ESP_OK) {
+		LOG_ERR("did not come out of reset");
+	}
 #endif
 }
 
@@ -135,17 +202,39 @@ void dw3000_hw_wakeup(void)
 	/* Use WAKEUP pin if available */
 	LOG_INF("WAKEUP PIN");
 	gpio_set_level(CONFIG_DW3000_GPIO_WAKEUP, 1);
-	vTaskDelay(1); // 500 usec
+	ets_delay_us(DW3000_WAKEUP_PULSE_US);
 	gpio_set_level(CONFIG_DW3000_GPIO_WAKEUP, 0);
 #else
 	/* Use SPI CS pin */
 	LOG_INF("WAKEUP CS");
 	// TODO: set from SPI to GPIO output
 	gpio_set_level(CONFIG_DW3000_SPI_CS, 0);
-	vTaskDelay(1); // 500 usec
+	ets_delay_us(DW3000_WAKEUP_PULSE_US);
 	gpio_set_level(CONFIG_DW3000_SPI_CS, 1);
 #endif
-	vTaskDelay(1);
+	/* readiness: dw3000_hw_ready_wait() or polling IDLE_RC */
+}
+
+void dw3000_hw_ready_wait_prepare(void)
+{
+	xSemaphoreTake(dw3000_ready_sem, 0);
+	dw3000_ready_wait = true;
+}
+
+int dw3000_hw_ready_wait(uint32_t timeout_ms)
+{
+#if CONFIG_DW3000_GPIO_IRQ == -1
+	dw3000_ready_wait = false;
+	return ESP_ERR_NOT_SUPPORTED;
+#else
+	int ret = ESP_OK;
+	if (xSemaphoreTake(dw3000_ready_sem, pdMS_TO_TICKS(timeout_ms) + 1)
+		!= pdTRUE) {
+		ret = ESP_ERR_TIMEOUT;
+	}
+	dw3000_ready_wait = false;
+	return ret;
+#endif
 }
 
 /** set WAKEUP pin low if available */
@@ -109,12 +109,13 @@ int32_t dw3000_spi_write(uint16_t headerLength, const uint8_t* headerBuffer,
 #endif
 
 #if 1
-	if (headerLength + bodyLength > 100) {
+	if (headerLength + bodyLength > CONFIG_DW3000_SPI_TX_BUF_LEN) {
 		LOG_ERR("TX buffer too small");
-		return ESP_ERR_INVALID_SIZE;
+		decamutexoff(stat);
+		return DWT_ERROR;
 	}
 
-	static uint8_t txbuf[100];
+	static uint8_t txbuf[CONFIG_DW3000_SPI_TX_BUF_LEN];
 	memcpy(txbuf, headerBuffer, headerLength);
 	memcpy(txbuf + headerLength, bodyBuffer, bodyLength);
 
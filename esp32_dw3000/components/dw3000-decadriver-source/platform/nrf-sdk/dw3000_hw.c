@@ -25,9 +25,9 @@ int dw3000_hw_init(void)
 	nrf_gpio_cfg_input(CONFIG_DW3000_GPIO_RESET, NRF_GPIO_PIN_NOPULL);
 
 	/* check reset state */
-	int timeout = 1000;
+	int timeout = 100000;
 	while (!nrf_gpio_pin_read(CONFIG_DW3000_GPIO_RESET) && --timeout > 0) {
-		nrf_delay_ms(1);
+		nrf_delay_us(10);
 	}
 	if (timeout <= 0) {
 		LOG_ERR("did not come out of reset");
@@ -153,7 +153,16 @@ void dw3000_hw_wakeup(void)
 	nrf_delay_us(500);
 	nrf_gpio_pin_set(CONFIG_DW3000_SPI_CS);
 #endif
-	nrf_delay_ms(1);
+}
+
+/* not implemented, readiness is polled */
+void dw3000_hw_ready_wait_prepare(void)
+{
+}
+
+int dw3000_hw_ready_wait(uint32_t timeout_ms)
+{
+	return NRF_ERROR_NOT_SUPPORTED;
 }
 
 /** set WAKEUP pin low if available */
@@ -11,8 +11,15 @@ LOG_MODULE_REGISTER(dw3000, CONFIG_DW3000_LOG_LEVEL);
 
 #define DW_INST DT_INST(0, decawave_dw3000)
 
+#define DW3000_RESET_TIMEOUT_US 100000
+#define DW3000_RESET_PULSE_US	10 /* API guide says 10ns */
+#define DW3000_WAKEUP_PULSE_US	500
+#define DW3000_POLL_US			10
+
 static struct gpio_callback gpio_cb;
 static struct k_work dw3000_isr_work;
+static K_SEM_DEFINE(dw3000_ready_sem, 0, 1);
+static volatile bool dw3000_ready_wait;
 
 struct dw3000_config {
 	struct gpio_dt_spec gpio_irq;
@@ -73,6 +80,13 @@ static void dw3000_hw_isr_work_handler(struct k_work* item)
 static void dw3000_hw_isr(const struct device* dev, struct gpio_callback* cb,
 						  uint32_t pins)
 {
+	if (dw3000_ready_wait) {
+		/* status is cleared by the waiting thread */
+		dw3000_ready_wait = false;
+		k_sem_give(&dw3000_ready_sem);
+		return;
+	}
+
 	k_work_submit(&dw3000_isr_work);
 }
 
@@ -139,9 +153,18 @@ void dw3000_hw_reset()
 	}
 
 	gpio_pin_configure_dt(&conf.gpio_reset, GPIO_OUTPUT_ACTIVE);
-	k_msleep(1); // 10 us?
+	k_busy_wait(DW3000_RESET_PULSE_US);
 	gpio_pin_configure_dt(&conf.gpio_reset, GPIO_INPUT);
-	k_msleep(2);
+
+	/* the DW3000 keeps RESET low until it is ready */
+	int timeout = DW3000_RESET_TIMEOUT_US / DW3000_POLL_US;
+	while (gpio_pin_get_raw(conf.gpio_reset.port, conf.gpio_reset.pin) == 0
+		   && --timeout > 0) {
+		k_busy_wait(DW3000_POLL_US);
+	}
+	if (timeout <= 0) {
+		LOG_ERR("did not come out of reset");
+	}
 }
 
 /** wakeup either using the WAKEUP pin or SPI CS */
@@ -151,7 +174,7 @@ void dw3000_hw_wakeup(void)
 		/* Use WAKEUP pin if available */
 		LOG_INF("WAKEUP PIN");
 		gpio_pin_set_dt(&conf.gpio_wakeup, 1);
-		k_msleep(1);
+		k_busy_wait(DW3000_WAKEUP_PULSE_US);
 		gpio_pin_set_dt(&conf.gpio_wakeup, 0);
 
 	} else {
@@ -161,6 +184,24 @@ void dw3000_hw_wakeup(void)
 	}
 }
 
+void dw3000_hw_ready_wait_prepare(void)
+{
+	k_sem_reset(&dw3000_ready_sem);
+	dw3000_ready_wait = true;
+}
+
+int dw3000_hw_ready_wait(uint32_t timeout_ms)
+{
+	if (!conf.gpio_irq.port) {
+		dw3000_ready_wait = false;
+		return -ENOTSUP;
+	}
+
+	int ret = k_sem_take(&dw3000_ready_sem, K_MSEC(timeout_ms));
+	dw3000_ready_wait = false;
+	return ret;
+}
+
 /** set WAKEUP pin low if available */
 void dw3000_hw_wakeup_pin_low(void)
 {
@@ -0,0 +1,315 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <deca_device_api.h>
+
+#include "antcal.h"
+#include "dwmac.h"
+#include "dwphy.h"
+#include "dwtime.h"
+#include "log.h"
+#include "ranging.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+#define ANTCAL_TWR_TIMEOUT_MS 100
+#define ANTCAL_POLL_US		  1000
+#define ANTCAL_UM_PER_CM	  10000
+/* one DTU is about 0.47 cm */
+#define ANTCAL_CM_PER_DTU (DTU_TO_DISTANCE(1.0) * 100.0)
+
+struct antcal_msg_pair {
+	uint8_t peer;
+	uint16_t cnt;
+	int32_t dist_um; // mean distance
+} __attribute__((packed));
+
+struct antcal_msg {
+	uint8_t from;
+	uint8_t num;
+	struct antcal_msg_pair pairs[];
+} __attribute__((packed));
+
+static uint64_t nodes[ANTCAL_MAX_NODES];
+static size_t num_nodes;
+static int my_idx = -1;
+static uint16_t true_cm[ANTCAL_MAX_NODES][ANTCAL_MAX_NODES];
+/* sum and count of the distances measured by node i (initiator) to node j */
+static int64_t sum_um[ANTCAL_MAX_NODES][ANTCAL_MAX_NODES];
+static uint32_t cnt[ANTCAL_MAX_NODES][ANTCAL_MAX_NODES];
+
+static int antcal_find(uint64_t addr)
+{
+	for (size_t i = 0; i < num_nodes; i++) {
+		if (nodes[i] == addr) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool antcal_init(const uint64_t* n, size_t num, const uint16_t* dist_cm)
+{
+	if (num < 3 || num > ANTCAL_MAX_NODES) {
+		LOG_ERR("Antcal needs 3 to %d nodes", ANTCAL_MAX_NODES);
+		return false;
+	}
+
+	memcpy(nodes, n, num * sizeof(nodes[0]));
+	num_nodes = num;
+	memset(sum_um, 0, sizeof(sum_um));
+	memset(cnt, 0, sizeof(cnt));
+
+	for (size_t i = 0; i < num; i++) {
+		for (size_t j = 0; j < num; j++) {
+			true_cm[i][j] = dist_cm[i * num + j];
+		}
+	}
+
+	my_idx = antcal_find(dwmac_get_mac16());
+	if (my_idx < 0) {
+		my_idx = antcal_find(dwmac_get_mac64());
+	}
+	if (my_idx < 0) {
+		LOG_ERR("Antcal: this node is not in the list");
+		return false;
+	}
+	return true;
+}
+
+static void antcal_twr_cb(uint64_t src, uint64_t dst, uint16_t dist,
+						  uint16_t num)
+{
+	if (dist == TWR_FAILED_VALUE || dist == TWR_OK_VALUE) {
+		return;
+	}
+
+	int i = antcal_find(src);
+	int j = antcal_find(dst);
+	if (i != my_idx || j < 0) {
+		return;
+	}
+
+	sum_um[i][j] += (int64_t)dist * ANTCAL_UM_PER_CM;
+	cnt[i][j]++;
+}
+
+static bool antcal_wait_twr(void)
+{
+	for (int i = 0; i < ANTCAL_TWR_TIMEOUT_MS * 1000 / ANTCAL_POLL_US; i++) {
+		if (!twr_in_progress()) {
+			return true;
+		}
+		deca_usleep(ANTCAL_POLL_US);
+	}
+	return false;
+}
+
+static bool antcal_send_result(void)
+{
+	struct txbuf* tx = dwmac_txbuf_get();
+	if (tx == NULL) {
+		return false;
+	}
+
+	size_t len = sizeof(struct antcal_msg)
+				 + (num_nodes - 1) * sizeof(struct antcal_msg_pair);
+	struct antcal_msg* msg = dwprot_short_prepare(tx, len, ANTCAL_MSG, 0xffff);
+	msg->from = my_idx;
+	msg->num = 0;
+
+	for (size_t j = 0; j < num_nodes; j++) {
+		uint32_t c = cnt[my_idx][j];
+		if (c == 0) {
+			continue;
+		}
+		struct antcal_msg_pair* p = &msg->pairs[msg->num++];
+		p->peer = j;
+		p->cnt = c > UINT16_MAX ? UINT16_MAX : c;
+		p->dist_um = sum_um[my_idx][j] / c;
+	}
+
+	/* only send the pairs which were measured */
+	tx->len -= (num_nodes - 1 - msg->num) * sizeof(struct antcal_msg_pair);
+	bool res = dwmac_transmit(tx);
+	LOG_TX_RES(res, "Antcal result %d pairs", msg->num);
+	return res;
+}
+
+bool antcal_run(int rounds)
+{
+	if (my_idx < 0) {
+		return false;
+	}
+
+	twr_cb_t prev_cb = twr_get_observer();
+	twr_set_observer(antcal_twr_cb);
+
+	for (int r = 0; r < rounds; r++) {
+		for (size_t j = 0; j < num_nodes; j++) {
+			if ((int)j == my_idx) {
+				continue;
+			}
+			if (!twr_start(nodes[j]) || !antcal_wait_twr()) {
+				twr_cancel();
+			}
+		}
+	}
+
+	twr_set_observer(prev_cb);
+
+	for (size_t j = 0; j < num_nodes; j++) {
+		if ((int)j != my_idx) {
+			LOG_INF("Antcal " LADDR_FMT ": %" PRIu32 " ranges",
+					LADDR_PAR(nodes[j]), cnt[my_idx][j]);
+		}
+	}
+
+	return antcal_send_result();
+}
+
+void antcal_handle_message(const struct dwprot_frame* f)
+{
+	const struct antcal_msg* msg = (const struct antcal_msg*)f->payload;
+
+	if (f->payload_len < sizeof(struct antcal_msg)
+		|| f->payload_len < sizeof(struct antcal_msg)
+								+ msg->num * sizeof(struct antcal_msg_pair)
+		|| msg->from >= num_nodes || (int)msg->from == my_idx) {
+		return;
+	}
+
+	/* replaces the previous result of this node */
+	for (size_t j = 0; j < num_nodes; j++) {
+		sum_um[msg->from][j] = 0;
+		cnt[msg->from][j] = 0;
+	}
+
+	for (int k = 0; k < msg->num; k++) {
+		const struct antcal_msg_pair* p = &msg->pairs[k];
+		if (p->peer < num_nodes) {
+			sum_um[msg->from][p->peer] = (int64_t)p->dist_um * p->cnt;
+			cnt[msg->from][p->peer] = p->cnt;
+		}
+	}
+
+	LOG_INF("Antcal result from " LADDR_FMT ": %d pairs",
+			LADDR_PAR(nodes[msg->from]), msg->num);
+}
+
+bool antcal_is_complete(void)
+{
+	for (size_t i = 0; i < num_nodes; i++) {
+		for (size_t j = i + 1; j < num_nodes; j++) {
+			if (cnt[i][j] + cnt[j][i] == 0) {
+				return false;
+			}
+		}
+	}
+	return num_nodes > 0;
+}
+
+/* Gaussian elimination with partial pivoting, solution in b */
+static bool antcal_gauss(float a[][ANTCAL_MAX_NODES], float* b, size_t n)
+{
+	for (size_t c = 0; c < n; c++) {
+		size_t p = c;
+		for (size_t r = c + 1; r < n; r++) {
+			if (fabsf(a[r][c]) > fabsf(a[p][c])) {
+				p = r;
+			}
+		}
+		if (fabsf(a[p][c]) < 1e-6f) {
+			return false;
+		}
+		if (p != c) {
+			for (size_t k = 0; k < n; k++) {
+				float t = a[c][k];
+				a[c][k] = a[p][k];
+				a[p][k] = t;
+			}
+			float t = b[c];
+			b[c] = b[p];
+			b[p] = t;
+		}
+		for (size_t r = c + 1; r < n; r++) {
+			float f = a[r][c] / a[c][c];
+			for (size_t k = c; k < n; k++) {
+				a[r][k] -= f * a[c][k];
+			}
+			b[r] -= f * b[c];
+		}
+	}
+
+	for (size_t c = n; c-- > 0;) {
+		for (size_t k = c + 1; k < n; k++) {
+			b[c] -= a[c][k] * b[k];
+		}
+		b[c] /= a[c][c];
+	}
+	return true;
+}
+
+bool antcal_solve(float* x_dtu)
+{
+	float a[ANTCAL_MAX_NODES][ANTCAL_MAX_NODES] = {0};
+	float b[ANTCAL_MAX_NODES] = {0};
+
+	/* normal equations of e_ij = x_i + x_j, one row for each pair */
+	for (size_t i = 0; i < num_nodes; i++) {
+		for (size_t j = i + 1; j < num_nodes; j++) {
+			uint32_t c = cnt[i][j] + cnt[j][i];
+			if (c == 0) {
+				continue;
+			}
+			float meas_cm = (float)(sum_um[i][j] + sum_um[j][i]) / c
+							/ ANTCAL_UM_PER_CM;
+			float e = (meas_cm - true_cm[i][j]) / ANTCAL_CM_PER_DTU;
+			a[i][i] += 1;
+			a[j][j] += 1;
+			a[i][j] += 1;
+			a[j][i] += 1;
+			b[i] += e;
+			b[j] += e;
+		}
+	}
+
+	if (!antcal_gauss(a, b, num_nodes)) {
+		LOG_ERR("Antcal: not enough pairs");
+		return false;
+	}
+
+	memcpy(x_dtu, b, num_nodes * sizeof(float));
+	return true;
+}
+
+uint16_t antcal_apply(void)
+{
+	float x[ANTCAL_MAX_NODES];
+
+	if (my_idx < 0 || !antcal_solve(x)) {
+		return 0;
+	}
+
+	int antd = dwphy_get_antenna_delay() + lroundf(x[my_idx]);
+	if (antd <= 0 || antd > UINT16_MAX) {
+		LOG_ERR("Antcal: antenna delay %d out of range", antd);
+		return 0;
+	}
+
+	LOG_INF("Antcal: antenna delay %d (%+.1f)", antd, (double)x[my_idx]);
+	dwphy_set_antenna_delay(antd);
+	dwphy_store_antenna_delay(antd);
+	return antd;
+}
@@ -0,0 +1,54 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_ANTCAL_H
+#define DECA_ANTCAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dwproto.h"
+
+/*
+ * Antenna delay calibration
+ *
+ * Three or more nodes are placed at known distances and range with each other
+ * by DS-TWR. With the antenna delay split equally between RX and TX, the mean
+ * distance error between node i and j is the sum of the antenna delay errors
+ * of both nodes: e_ij = x_i + x_j. This is solved for all x by least squares
+ * (normal equations) and each node adds its x to its current antenna delay.
+ *
+ * Every node ranges to all others with antcal_run() one after another, and
+ * broadcasts its mean distances afterwards, so that all nodes know all pairs.
+ * The other nodes have to be in RX mode and TWR has to be initialized with
+ * reports (twr_init(delay, true)).
+ */
+
+#define ANTCAL_MSG		 0x18
+#define ANTCAL_MAX_NODES 8
+
+/** nodes: addresses of all nodes including this one, dist_cm: num * num
+ * matrix of the true distances */
+bool antcal_init(const uint64_t* nodes, size_t num, const uint16_t* dist_cm);
+/** Range rounds times to all other nodes and broadcast the result. Blocking,
+ * call it from the application task, not the dwmac task */
+bool antcal_run(int rounds);
+/** True when measurements of all pairs are known */
+bool antcal_is_complete(void);
+/** Least squares solution: antenna delay error of each node in DTU */
+bool antcal_solve(float* x_dtu);
+/** Solve, set the antenna delay of this node and store it
+ * (dwphy_load_antenna_delay() uses it on the next boot). Returns the new
+ * antenna delay or 0 on error */
+uint16_t antcal_apply(void);
+
+void antcal_handle_message(const struct dwprot_frame* f);
+
+#endif
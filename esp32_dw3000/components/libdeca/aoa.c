@@ -0,0 +1,145 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <deca_device_api.h>
+
+#include "aoa.h"
+#include "dwphy.h"
+#include "dwtime.h"
+#include "dwutil.h"
+#include "log.h"
+#include "platform/dwmac_task.h"
+#include "platform/dwstore.h"
+#include "ranging.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+#define AOA_SPEED_OF_LIGHT 299702547.0f // in air
+#define AOA_PDOA_SCALE	   2048.0f		// radian << 11
+#define AOA_PI			   3.14159265f
+
+/* PDoA of the last TWR frame */
+static struct {
+	uint64_t src;
+	int16_t pdoa;
+	bool valid;
+	uint32_t time_us;
+} last;
+
+static float ant_dist_m = AOA_ANT_DIST_MM / 1000.0f;
+static int16_t pdoa_offset;
+static aoa_cb_t aoa_cb;
+
+bool aoa_init(float ant_dist_mm)
+{
+	if (!CONFIG_DECA_PDOA) {
+		LOG_ERR("AoA needs CONFIG_DECA_PDOA");
+		return false;
+	}
+
+	ant_dist_m = (ant_dist_mm > 0 ? ant_dist_mm : AOA_ANT_DIST_MM) / 1000.0f;
+	last.src = 0;
+	dwphy_set_pdoa(DWT_PDOA_M3);
+	return dwphy_config();
+}
+
+void aoa_set_observer(aoa_cb_t cb)
+{
+	aoa_cb = cb;
+}
+
+void aoa_set_offset(int16_t offset)
+{
+	pdoa_offset = offset;
+}
+
+int16_t aoa_load_offset(int16_t def)
+{
+	int16_t off;
+
+	if (dwstore_read(AOA_PDOA_KEY, &off, sizeof(off))) {
+		LOG_INF("Calibrated PDoA offset %d", off);
+	} else {
+		off = def;
+	}
+	aoa_set_offset(off);
+	return off;
+}
+
+bool aoa_store_offset(int16_t offset)
+{
+	return dwstore_write(AOA_PDOA_KEY, &offset, sizeof(offset));
+}
+
+float aoa_angle(int16_t pdoa, float* pdoa_rad)
+{
+	float freq = dwphy_get_channel() == 5 ? 6489.6e6f : 7987.2e6f;
+	float lambda = AOA_SPEED_OF_LIGHT / freq;
+	float pd = (pdoa - pdoa_offset) / AOA_PDOA_SCALE;
+
+	/* wrap into -pi..pi after the offset */
+	if (pd > AOA_PI) {
+		pd -= 2 * AOA_PI;
+	} else if (pd < -AOA_PI) {
+		pd += 2 * AOA_PI;
+	}
+	if (pdoa_rad != NULL) {
+		*pdoa_rad = pd;
+	}
+
+	float s = pd * lambda / (2 * AOA_PI * ant_dist_m);
+	s = fmaxf(-1.0f, fminf(1.0f, s));
+	return asinf(s) * 180.0f / AOA_PI;
+}
+
+void aoa_handle_rx(uint64_t src, const struct rxbuf* rx)
+{
+#if CONFIG_DECA_PDOA
+	int64_t diff = (int64_t)((rx->ts - rx->sts_ts) & DTU_MASK);
+	if (diff > (int64_t)(DTU_MASK / 2)) {
+		diff -= DTU_MASK + 1;
+	}
+
+	last.src = src;
+	last.pdoa = rx->pdoa;
+	last.valid = rx->sts_ok && llabs(diff) <= AOA_MAX_STS_DIFF_DTU;
+	last.time_us = dwtask_get_time_us();
+#endif
+}
+
+void aoa_handle_twr(uint64_t src, uint64_t dst, uint16_t dist, uint16_t num)
+{
+	struct aoa_result res;
+
+	/* the frame came from the peer, which is either end of the result */
+	if (dist == TWR_FAILED_VALUE || dist == TWR_OK_VALUE || last.src == 0
+		|| (last.src != src && last.src != dst)
+		|| dwtask_get_time_us() - last.time_us > AOA_MAX_AGE_US) {
+		return;
+	}
+
+	res.angle = aoa_angle(last.pdoa, &res.pdoa);
+	res.valid = last.valid;
+	float a = res.angle * AOA_PI / 180.0f;
+	res.x_cm = dist * cosf(a);
+	res.y_cm = dist * sinf(a);
+
+	LOG_DBG("AoA " LADDR_FMT ": %d cm %d deg%s", LADDR_PAR(last.src), dist,
+			(int)res.angle, res.valid ? "" : " (invalid)");
+	last.src = 0;
+
+	if (aoa_cb) {
+		aoa_cb(src, dst, dist, &res);
+	}
+}
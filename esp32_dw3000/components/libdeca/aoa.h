@@ -0,0 +1,69 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_AOA_H
+#define DECA_AOA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dwmac.h"
+
+/*
+ * Angle of arrival from the phase difference of arrival (PDoA)
+ *
+ * Needs a DW3220 with two antennas and CONFIG_DECA_PDOA. The PDoA of the TWR
+ * frame received last from a peer (final on the responder, response on the
+ * SS-TWR initiator) is converted to an angle and handed to the observer
+ * together with the distance, which gives a position relative to the antenna
+ * axis from a single device.
+ *
+ * sin(angle) = (pdoa - offset) * wavelength / (2 * pi * antenna distance)
+ *
+ * The PDoA offset of the antenna pair is measured with a peer at 0 degrees
+ * and can be stored persistently like the antenna delay.
+ *
+ * PDoA adds an STS to each frame, which twr_init() includes in the reply
+ * delay, so aoa_init() has to be called before twr_init().
+ */
+
+#define AOA_ANT_DIST_MM		 20.8f
+#define AOA_MAX_STS_DIFF_DTU 128 // max. difference of Ipatov and STS timestamp
+#define AOA_MAX_AGE_US		 100000
+#define AOA_PDOA_KEY		 "pdoa"
+
+struct aoa_result {
+	float pdoa;	 // radians, calibrated
+	float angle; // degrees, -90 to 90
+	float x_cm;	 // along the boresight
+	float y_cm;	 // towards the positive angle
+	bool valid;	 // STS quality good and timestamps agree
+};
+
+typedef void (*aoa_cb_t)(uint64_t src, uint64_t dst, uint16_t dist,
+						 const struct aoa_result* res);
+
+/** Configure PDoA mode 3 and the antenna distance (0 for the default).
+ * Call it before twr_init() */
+bool aoa_init(float ant_dist_mm);
+void aoa_set_observer(aoa_cb_t cb);
+
+void aoa_set_offset(int16_t offset);
+int16_t aoa_load_offset(int16_t def);
+bool aoa_store_offset(int16_t offset);
+
+/** Angle in degrees for a raw PDoA value (radian << 11) */
+float aoa_angle(int16_t pdoa, float* pdoa_rad);
+/** TWR observer */
+void aoa_handle_twr(uint64_t src, uint64_t dst, uint16_t dist, uint16_t num);
+
+/* INTERNAL: from the TWR RX handler */
+void aoa_handle_rx(uint64_t src, const struct rxbuf* rx);
+
+#endif
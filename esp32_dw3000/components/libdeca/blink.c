@@ -125,7 +125,8 @@ bool blink_send_long(uint64_t src, bool sleep_after_tx)
 	msg->battery = 0; // TODO plat_get_battery();
 
 	bool res = dwmac_transmit(tx);
-	LOG_TX_RES(res, "BLINK #%" PRIu32 " " LADDR_FMT, msg->seq_no, LADDR_PAR(src));
+	LOG_TX_RES(res, "BLINK #%" PRIu32 " " DWLOG_LADDR_FMT, msg->seq_no,
+			   DWLOG_LADDR_PAR(src));
 	return res;
 }
 
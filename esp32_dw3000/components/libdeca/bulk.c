@@ -0,0 +1,582 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <string.h>
+
+#include <deca_device_api.h>
+
+#include "bulk.h"
+#include "dwhw.h"
+#include "dwmac.h"
+#include "dwphy.h"
+#include "dwproto.h"
+#include "dwsec.h"
+#include "dwtime.h"
+#include "dwutil.h"
+#include "log.h"
+
+#define BULK_MSG_START (BULK_MSG_GROUP | 0x0)
+#define BULK_MSG_DATA  (BULK_MSG_GROUP | 0x1)
+#define BULK_MSG_POLL  (BULK_MSG_GROUP | 0x2)
+#define BULK_MSG_SACK  (BULK_MSG_GROUP | 0x3)
+
+#define BULK_FLAG_ACKREQ 0x01
+
+/* minimum time needed between deciding on the TX time and the start of TX */
+#define BULK_TX_SETUP_US 100
+
+struct bulk_msg_start {
+	uint8_t xfer_id;
+	uint32_t len;
+	uint16_t frag_size;
+} __attribute__((packed));
+
+struct bulk_msg_data {
+	uint8_t xfer_id;
+	uint8_t flags;
+	uint16_t seq;
+	uint8_t data[0];
+} __attribute__((packed));
+
+struct bulk_msg_poll {
+	uint8_t xfer_id;
+} __attribute__((packed));
+
+struct bulk_msg_sack {
+	uint8_t xfer_id;
+	uint16_t base;	 // all fragments before have been received
+	uint32_t bitmap; // bit n: fragment base + n received
+} __attribute__((packed));
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "BULK";
+#endif
+
+static uint64_t bulk_gap_dtu;
+static uint8_t bulk_xfer_id;
+static bulk_rx_cb_t bulk_rx_cb;
+static struct bulk_stats bulk_stats;
+
+/* sender state */
+static struct {
+	bool active;
+	bool started; // START has been acknowledged
+	uint8_t xfer_id;
+	uint8_t retry;
+	uint64_t dst;
+	const uint8_t* data;
+	uint32_t len;
+	uint16_t frag_size;
+	uint16_t nfrags;
+	uint16_t base;	 // first unacknowledged fragment
+	uint32_t acked;	 // bitmap relative to base
+	uint16_t next;	 // next fragment to consider in this window
+	uint16_t high;	 // highest fragment sent + 1
+	bool paced;		 // last_txtime is valid
+	bool last_delayed;
+	uint64_t last_txtime; // DX_TIME of the last frame (RMARKER - TX antd)
+	size_t last_len;
+	uint16_t antd;	 // TX antenna delay
+	uint8_t txi;	 // bulk_txbuf of the last data frame
+	bool pre_valid;	 // next fragment prepared in the other bulk_txbuf
+	bool pre_ackreq;
+	uint16_t pre_seq;
+	bulk_tx_cb_t cb;
+} bs;
+
+/* the fragment on air and the next one */
+static struct txbuf bulk_txbuf[2];
+
+/* receiver state */
+static struct {
+	bool valid;
+	bool complete;
+	uint8_t xfer_id;
+	uint64_t src;
+	uint32_t len;
+	uint16_t frag_size;
+	uint16_t nfrags;
+	uint16_t base;	 // all fragments before have been received
+	uint32_t recvd; // bitmap relative to base
+} br;
+
+static void bulk_send_next(void);
+static void bulk_handle_timeout(uint32_t status);
+
+static size_t bulk_frag_len(uint16_t seq)
+{
+	uint32_t off = (uint32_t)seq * bs.frag_size;
+	return bs.len - off < bs.frag_size ? bs.len - off : bs.frag_size;
+}
+
+static void bulk_finish(bool ok)
+{
+	bs.active = false;
+	LOG_INF("Transfer of %" PRIu32 " bytes to " LADDR_FMT " %s", bs.len,
+			LADDR_PAR(bs.dst), ok ? "complete" : "failed");
+	if (bs.cb) {
+		bs.cb(bs.dst, bs.len, ok);
+	}
+}
+
+/* first fragment at or after seq which is in the window and not acked */
+static int bulk_find_unacked(uint16_t seq)
+{
+	uint32_t end = bs.base + BULK_WINDOW;
+	if (end > bs.nfrags) {
+		end = bs.nfrags;
+	}
+
+	for (uint32_t i = seq; i < end; i++) {
+		if (!(bs.acked & (1UL << (i - bs.base)))) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Transmit at the end of the previous frame plus gap if possible. Both frames
+ * have the same preamble, so their RMARKERs are apart by the air time of the
+ * previous frame plus the gap */
+static bool bulk_transmit_paced(struct txbuf* tx)
+{
+	bs.last_delayed = false;
+
+	if (bs.paced) {
+		uint64_t air_dtu = US_TO_DTU(PKTTIME_TO_USEC(dwphy_calc_packet_time(
+			dwphy_get_rate(), dwphy_get_plen(), dwphy_get_prf(), bs.last_len)));
+		uint64_t txtime
+			= (bs.last_txtime + air_dtu + bulk_gap_dtu) & DTU_DELAYEDTRX_MASK;
+		uint64_t margin = (txtime - dw_get_systime()) & DTU_MASK;
+
+		if (margin < DTU_MASK / 2 && margin > US_TO_DTU(BULK_TX_SETUP_US)) {
+			dwmac_tx_set_txtime(tx, txtime);
+			bs.last_delayed = true;
+			bs.last_txtime = txtime;
+		} else {
+			bulk_stats.late++;
+		}
+	}
+
+	bool res = dwmac_transmit(tx);
+	if (!res && bs.last_delayed) {
+		/* too late after all, send immediately */
+		bulk_stats.late++;
+		bs.last_delayed = false;
+		dwmac_tx_set_txtime(tx, 0);
+		res = dwmac_transmit(tx);
+	}
+	/* with the auxiliary header and MIC added when it was secured */
+	bs.last_len = tx->len;
+	return res;
+}
+
+static bool bulk_send_start(void)
+{
+	struct txbuf* tx = dwmac_txbuf_get();
+	if (tx == NULL) {
+		return false;
+	}
+
+	struct bulk_msg_start* msg = dwprot_prepare(
+		tx, sizeof(struct bulk_msg_start), BULK_MSG_START, bs.dst);
+	msg->xfer_id = bs.xfer_id;
+	msg->len = bs.len;
+	msg->frag_size = bs.frag_size;
+
+	dwmac_tx_set_rx_timeout(tx, BULK_ACK_TIMEOUT_UUS);
+	dwmac_tx_set_timeout_handler(tx, bulk_handle_timeout);
+	bs.paced = false;
+	return dwmac_transmit(tx);
+}
+
+static bool bulk_send_poll(void)
+{
+	struct txbuf* tx = dwmac_txbuf_get();
+	if (tx == NULL) {
+		return false;
+	}
+
+	struct bulk_msg_poll* msg = dwprot_prepare(
+		tx, sizeof(struct bulk_msg_poll), BULK_MSG_POLL, bs.dst);
+	msg->xfer_id = bs.xfer_id;
+
+	dwmac_tx_set_rx_timeout(tx, BULK_ACK_TIMEOUT_UUS);
+	dwmac_tx_set_timeout_handler(tx, bulk_handle_timeout);
+	bs.paced = false;
+	return dwmac_transmit(tx);
+}
+
+/* called from dwmac_handle_tx_done() after a data frame without ACK request */
+static void bulk_handle_tx_done(void)
+{
+	if (!bs.active) {
+		return;
+	}
+
+	if (!bs.last_delayed) {
+		/* same reference as the delayed TX time */
+		bs.last_txtime = (dw_get_tx_timestamp() - bs.antd) & DTU_MASK;
+	}
+	bs.paced = true;
+
+	bulk_send_next();
+}
+
+static void bulk_prepare_data(struct txbuf* tx, uint16_t seq, bool ackreq)
+{
+	size_t len = bulk_frag_len(seq);
+	struct bulk_msg_data* msg = dwprot_prepare(
+		tx, sizeof(struct bulk_msg_data) + len, BULK_MSG_DATA, bs.dst);
+	msg->xfer_id = bs.xfer_id;
+	msg->flags = ackreq ? BULK_FLAG_ACKREQ : 0;
+	msg->seq = seq;
+	memcpy(msg->data, bs.data + (uint32_t)seq * bs.frag_size, len);
+
+	if (ackreq) {
+		dwmac_tx_set_rx_timeout(tx, BULK_ACK_TIMEOUT_UUS);
+		dwmac_tx_set_timeout_handler(tx, bulk_handle_timeout);
+	} else {
+		dwmac_tx_set_complete_handler(tx, bulk_handle_tx_done);
+	}
+}
+
+/* Prepare the fragment after seq in the other buffer while seq is on air */
+static void bulk_prepare_next(uint16_t seq)
+{
+	int next = bulk_find_unacked(seq + 1);
+	if (next < 0) {
+		return;
+	}
+
+	struct txbuf* tx = &bulk_txbuf[bs.txi ^ 1];
+	bs.pre_seq = next;
+	bs.pre_ackreq = bulk_find_unacked(next + 1) < 0;
+	bulk_prepare_data(tx, bs.pre_seq, bs.pre_ackreq);
+	/* otherwise it is written when it is sent */
+	dwmac_tx_preload(tx);
+	bs.pre_valid = true;
+}
+
+static bool bulk_send_data(uint16_t seq, bool ackreq)
+{
+	struct txbuf* tx;
+
+	if (bs.pre_valid && bs.pre_seq == seq && bs.pre_ackreq == ackreq) {
+		bs.txi ^= 1;
+		tx = &bulk_txbuf[bs.txi];
+	} else {
+		tx = &bulk_txbuf[bs.txi];
+		bulk_prepare_data(tx, seq, ackreq);
+	}
+	bs.pre_valid = false;
+
+	bulk_stats.frames++;
+	if (seq < bs.high) {
+		bulk_stats.retrans++;
+	} else {
+		bs.high = seq + 1;
+	}
+	bs.next = seq + 1;
+
+	bool res = bulk_transmit_paced(tx);
+	if (ackreq) {
+		/* the next window starts after the SACK */
+		bs.paced = false;
+	} else if (res) {
+		bulk_prepare_next(seq);
+	}
+	return res;
+}
+
+static void bulk_send_next(void)
+{
+	int seq = bulk_find_unacked(bs.next);
+	bool res;
+
+	if (seq < 0) {
+		res = bulk_send_poll();
+	} else {
+		res = bulk_send_data(seq, bulk_find_unacked(seq + 1) < 0);
+	}
+
+	if (!res) {
+		LOG_ERR("TX failed");
+		bulk_finish(false);
+	}
+}
+
+static void bulk_handle_timeout(uint32_t status)
+{
+	if (!bs.active) {
+		return;
+	}
+
+	bulk_stats.polls++;
+	if (++bs.retry > BULK_MAX_RETRY) {
+		LOG_ERR("No ACK from " LADDR_FMT, LADDR_PAR(bs.dst));
+		bulk_finish(false);
+		return;
+	}
+
+	bool res = bs.started ? bulk_send_poll() : bulk_send_start();
+	if (!res) {
+		bulk_finish(false);
+	}
+}
+
+static void bulk_handle_sack(const struct dwprot_frame* f)
+{
+	const struct bulk_msg_sack* msg = (const void*)f->payload;
+
+	if (!bs.active || f->src != bs.dst || msg->xfer_id != bs.xfer_id
+		|| msg->base < bs.base || msg->base > bs.nfrags) {
+		return;
+	}
+
+	bs.started = true;
+	bs.retry = 0;
+	bs.base = msg->base;
+	bs.acked = msg->bitmap;
+	bs.next = bs.base;
+
+	if (bs.base == bs.nfrags) {
+		bulk_finish(true);
+		return;
+	}
+
+	bulk_send_next();
+}
+
+/*
+ * Receiver
+ */
+
+static void bulk_send_sack(void)
+{
+	struct txbuf* tx = dwmac_txbuf_get();
+	if (tx == NULL) {
+		return;
+	}
+
+	struct bulk_msg_sack* msg = dwprot_prepare(
+		tx, sizeof(struct bulk_msg_sack), BULK_MSG_SACK, br.src);
+	msg->xfer_id = br.xfer_id;
+	msg->base = br.base;
+	msg->bitmap = br.recvd;
+
+	if (!dwmac_transmit(tx)) {
+		LOG_ERR("Failed to send SACK");
+	}
+}
+
+static void bulk_rx_complete(void)
+{
+	br.complete = true;
+	LOG_INF("Received %" PRIu32 " bytes from " LADDR_FMT, br.len,
+			LADDR_PAR(br.src));
+}
+
+static void bulk_handle_start(const struct dwprot_frame* f)
+{
+	const struct bulk_msg_start* msg = (const void*)f->payload;
+
+	if (br.valid && br.src == f->src && br.xfer_id == msg->xfer_id) {
+		bulk_send_sack(); // START again, our SACK got lost
+		return;
+	}
+
+	size_t hdr_len = IS_SHORT_ADDR(f->src) ? DWMAC_PROTO_SHORT_LEN
+										   : DWMAC_PROTO_LONG_LEN;
+	if (msg->frag_size == 0
+		|| hdr_len + sizeof(struct bulk_msg_data) + msg->frag_size
+				   + DWSEC_FRAME_RESERVE
+			   > DWMAC_RXBUF_LEN
+		|| CEIL_DIV(msg->len, msg->frag_size) > UINT16_MAX) {
+		LOG_ERR("Invalid transfer size %" PRIu32 " / %d", msg->len,
+				msg->frag_size);
+		return;
+	}
+
+	br.valid = true;
+	br.complete = false;
+	br.src = f->src;
+	br.xfer_id = msg->xfer_id;
+	br.len = msg->len;
+	br.frag_size = msg->frag_size;
+	br.nfrags = CEIL_DIV(msg->len, msg->frag_size);
+	br.base = 0;
+	br.recvd = 0;
+
+	LOG_INF("Receiving %" PRIu32 " bytes from " LADDR_FMT, br.len,
+			LADDR_PAR(br.src));
+
+	if (br.nfrags == 0) {
+		bulk_rx_complete();
+		if (bulk_rx_cb) {
+			bulk_rx_cb(br.src, 0, NULL, 0, 0, true);
+		}
+	}
+
+	bulk_send_sack();
+}
+
+static void bulk_handle_data(const struct dwprot_frame* f)
+{
+	const struct bulk_msg_data* msg = (const void*)f->payload;
+	size_t len = f->payload_len - sizeof(struct bulk_msg_data);
+	uint16_t seq = msg->seq;
+
+	if (!br.valid || br.src != f->src || br.xfer_id != msg->xfer_id) {
+		return;
+	}
+
+	/* only new fragments inside the window, others are duplicates */
+	if (seq >= br.base && seq < br.nfrags && seq - br.base < BULK_WINDOW
+		&& !(br.recvd & (1UL << (seq - br.base)))) {
+		uint32_t off = (uint32_t)seq * br.frag_size;
+		if (len != (br.len - off < br.frag_size ? br.len - off : br.frag_size)) {
+			/* not received, the sender still needs the SACK */
+			LOG_ERR("Invalid fragment length %d", (int)len);
+		} else {
+			br.recvd |= 1UL << (seq - br.base);
+			while (br.recvd & 1) {
+				br.recvd >>= 1;
+				br.base++;
+			}
+
+			bool complete = br.base == br.nfrags;
+			if (complete) {
+				bulk_rx_complete();
+			}
+			if (bulk_rx_cb) {
+				bulk_rx_cb(br.src, off, msg->data, len, br.len, complete);
+			}
+		}
+	}
+
+	if (msg->flags & BULK_FLAG_ACKREQ) {
+		bulk_send_sack();
+	}
+}
+
+static void bulk_handle_poll(const struct dwprot_frame* f)
+{
+	const struct bulk_msg_poll* msg = (const void*)f->payload;
+
+	if (br.valid && br.src == f->src && br.xfer_id == msg->xfer_id) {
+		bulk_send_sack();
+	}
+}
+
+void bulk_handle_message(const struct dwprot_frame* f)
+{
+	switch (f->func) {
+	case BULK_MSG_START:
+		if (f->payload_len == sizeof(struct bulk_msg_start)) {
+			bulk_handle_start(f);
+		}
+		break;
+	case BULK_MSG_DATA:
+		if (f->payload_len > sizeof(struct bulk_msg_data)) {
+			bulk_handle_data(f);
+		}
+		break;
+	case BULK_MSG_POLL:
+		if (f->payload_len == sizeof(struct bulk_msg_poll)) {
+			bulk_handle_poll(f);
+		}
+		break;
+	case BULK_MSG_SACK:
+		if (f->payload_len == sizeof(struct bulk_msg_sack)) {
+			bulk_handle_sack(f);
+		}
+		break;
+	default:
+		LOG_ERR("Unknown MSG %X from " LADDR_FMT, f->func, LADDR_PAR(f->src));
+	}
+}
+
+/*
+ * API
+ */
+
+void bulk_init(uint32_t gap_us)
+{
+	bulk_gap_dtu = US_TO_DTU(gap_us ? gap_us : BULK_FRAME_GAP_US);
+}
+
+size_t bulk_get_frag_size(uint64_t dst)
+{
+	size_t hdr_len
+		= IS_SHORT_ADDR(dst) ? DWMAC_PROTO_SHORT_LEN : DWMAC_PROTO_LONG_LEN;
+	return DWMAC_TXBUF_LEN - DWSEC_FRAME_RESERVE - hdr_len
+		   - sizeof(struct bulk_msg_data);
+}
+
+bool bulk_send(uint64_t dst, const uint8_t* data, uint32_t len,
+			   bulk_tx_cb_t cb)
+{
+	if (!dwhw_is_ready()) {
+		LOG_ERR("Not ready");
+		return false;
+	}
+
+	if (bs.active) {
+		LOG_ERR("Transfer in progress");
+		return false;
+	}
+
+	size_t frag_size = bulk_get_frag_size(dst);
+	if (CEIL_DIV(len, frag_size) > UINT16_MAX) {
+		LOG_ERR("Too large");
+		return false;
+	}
+
+	if (bulk_gap_dtu == 0) {
+		bulk_init(0);
+	}
+
+	memset(&bs, 0, sizeof(bs));
+	bs.active = true;
+	bs.xfer_id = ++bulk_xfer_id;
+	bs.dst = dst;
+	bs.data = data;
+	bs.len = len;
+	bs.frag_size = frag_size;
+	bs.nfrags = CEIL_DIV(len, frag_size);
+	bs.antd = dwt_gettxantennadelay();
+	bs.cb = cb;
+
+	if (!bulk_send_start()) {
+		bs.active = false;
+		return false;
+	}
+	return true;
+}
+
+bool bulk_in_progress(void)
+{
+	return bs.active;
+}
+
+void bulk_cancel(void)
+{
+	bs.active = false;
+}
+
+void bulk_set_rx_observer(bulk_rx_cb_t cb)
+{
+	bulk_rx_cb = cb;
+}
+
+const struct bulk_stats* bulk_get_stats(void)
+{
+	return &bulk_stats;
+}
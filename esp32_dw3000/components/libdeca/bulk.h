@@ -0,0 +1,74 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_BULK_H
+#define DECA_BULK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dwmac.h"
+#include "dwproto.h"
+
+/*
+ * Reliable bulk data transfer
+ *
+ * Data is split into fragments which fit into one frame. The sender
+ * transmits a window of up to BULK_WINDOW fragments back-to-back using delayed
+ * TX, where the TX time of each frame is the TX time of the previous one plus
+ * its air time (dwphy_calc_packet_time) and a gap, both taken at the RMARKER.
+ * While a fragment is on air, the next one is prepared in a second buffer and
+ * written to the other half of the DW3000 TX buffer (dwmac_tx_preload), so
+ * only starting TX is left for the gap. The last frame of the window requests
+ * a selective ACK (bitmap of received fragments), and only missing fragments
+ * are sent again.
+ *
+ * The receiver needs to be in RX mode (dwmac_set_rx_reenable(true)).
+ * Only one transfer can be in progress in each direction.
+ */
+
+#define BULK_MSG_GROUP 0x30
+#define BULK_WINDOW	   32 /* fragments, bits of SACK bitmap */
+#define BULK_MAX_RETRY 5
+/* gap between frames: the next frame has to be started and the receiver has
+ * to re-enable RX in this time */
+#define BULK_FRAME_GAP_US	 300
+#define BULK_ACK_TIMEOUT_UUS 10000
+
+/** Sender: called when transfer is complete or failed */
+typedef void (*bulk_tx_cb_t)(uint64_t dst, uint32_t len, bool ok);
+/** Receiver: called for each new fragment, fragments may arrive out of order.
+ * complete is true when all data of the transfer has been received */
+typedef void (*bulk_rx_cb_t)(uint64_t src, uint32_t offset,
+							 const uint8_t* data, size_t len, uint32_t total,
+							 bool complete);
+
+struct bulk_stats {
+	uint32_t frames;  // data frames sent
+	uint32_t retrans; // data frames sent again
+	uint32_t late;	  // paced TX time missed, sent immediately
+	uint32_t polls;	  // ACK timeouts
+};
+
+/** Initialize with gap between frames (0 for default) */
+void bulk_init(uint32_t gap_us);
+/** Start sending len bytes to dst. data has to stay valid until cb */
+bool bulk_send(uint64_t dst, const uint8_t* data, uint32_t len,
+			   bulk_tx_cb_t cb);
+bool bulk_in_progress(void);
+void bulk_cancel(void);
+void bulk_set_rx_observer(bulk_rx_cb_t cb);
+/** Payload bytes per frame to dst, with room for frame security */
+size_t bulk_get_frag_size(uint64_t dst);
+const struct bulk_stats* bulk_get_stats(void);
+
+void bulk_handle_message(const struct dwprot_frame* f);
+
+#endif
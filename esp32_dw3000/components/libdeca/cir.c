@@ -0,0 +1,291 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <deca_device_api.h>
+
+#include "cir.h"
+#include "dwphy.h"
+#include "log.h"
+#include "platform/dwmac_task.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+/* leading edge threshold in standard deviations above the noise */
+#define CIR_LDE_SIGMA 6.0f
+/* NLOS likelihood ramps: 0% at the first, 100% at the second value */
+#define CIR_NLOS_DB_LOS	  3.0f
+#define CIR_NLOS_DB_NLOS  10.0f
+#define CIR_NLOS_NS_LOS	  3.0f
+#define CIR_NLOS_NS_NLOS  15.0f
+#define CIR_NLOS_RISE_LOS 2.0f
+#define CIR_NLOS_RISE_NLOS 5.0f
+
+static const uint16_t cir_acc_len[]
+	= {DWT_CIR_LEN_IP_PRF64, DWT_CIR_LEN_STS, DWT_CIR_LEN_STS};
+
+static struct cir_capture* volatile cir_pending;
+static struct cir_capture* volatile cir_finishing;
+static bool cir_rx_on;
+
+/* FULL mode: 6 bytes per sample, without the leading dummy byte */
+static void cir_read_samples(struct cir_capture* c, int from, int n)
+{
+	dwt_readcir((uint32_t*)(c->buf + 6 * from), c->acc, c->start + from, n,
+				DWT_CIR_READ_FULL);
+}
+
+static bool cir_capture(struct cir_capture* c, uint64_t rx_ts, bool irq)
+{
+	if (c->acc > DWT_ACC_IDX_STS1_M || c->num == 0) {
+		return false;
+	}
+
+	dwphy_read_rxdiag(&c->diag, DWPHY_RXDIAG_PEAK | DWPHY_RXDIAG_FP_INDEX);
+
+	int start = c->first;
+	if (c->first == CIR_FIRST_PATH) {
+		start = (c->diag.fp_index >> 6) - CIR_PRE_FP_SAMPLES;
+	}
+	if (start + c->num > cir_acc_len[c->acc]) {
+		start = cir_acc_len[c->acc] - c->num;
+	}
+	if (start < 0) {
+		start = 0;
+	}
+	c->start = start;
+	c->rx_ts = rx_ts;
+
+	int n = c->num;
+	if (irq && n > CIR_IRQ_SAMPLES) {
+		n = CIR_IRQ_SAMPLES;
+	}
+	cir_read_samples(c, 0, n);
+	c->done = n == c->num;
+	return true;
+}
+
+/* The rest of a capture in the MAC task, RX is kept off until then */
+static void cir_finish(void)
+{
+	struct cir_capture* c = cir_finishing;
+	if (c == NULL) {
+		return;
+	}
+	cir_finishing = NULL;
+
+	decaIrqStatus_t stat = decamutexon();
+	cir_read_samples(c, CIR_IRQ_SAMPLES, c->num - CIR_IRQ_SAMPLES);
+	if (cir_rx_on) {
+		dwt_rxenable(DWT_START_RX_IMMEDIATE);
+	}
+	decamutexoff(stat);
+	c->done = true;
+}
+
+bool cir_request(struct cir_capture* c)
+{
+	if (cir_pending != NULL) {
+		return false;
+	}
+	dwphy_enable_full_diag();
+	c->done = false;
+	cir_pending = c;
+	return true;
+}
+
+void cir_cancel(void)
+{
+	cir_pending = NULL;
+}
+
+bool cir_read(struct cir_capture* c)
+{
+	dwphy_enable_full_diag();
+	c->done = false;
+	return cir_capture(c, 0, false);
+}
+
+bool cir_handle_rx(uint64_t rx_ts)
+{
+	struct cir_capture* c = cir_pending;
+	if (c == NULL) {
+		return false;
+	}
+	cir_pending = NULL;
+	if (!cir_capture(c, rx_ts, true)) {
+		LOG_ERR_IRQ("CIR capture failed");
+		return false;
+	}
+	if (!c->done) {
+		cir_finishing = c;
+	}
+	return !c->done;
+}
+
+void cir_finish_rx(bool rx_on)
+{
+	cir_rx_on = rx_on;
+	if (dwtask_queue_event(DWEVT_CALL, cir_finish) != 0) {
+		LOG_ERR_IRQ("CIR finish not queued");
+		cir_finishing = NULL;
+		if (rx_on) {
+			dwt_rxenable(DWT_START_RX_IMMEDIATE);
+		}
+	}
+}
+
+static int32_t cir_s24(const uint8_t* b)
+{
+	/* 6 sign bits and 18 bits value, sign extend from 24 bit */
+	uint32_t v = b[0] | (b[1] << 8) | ((uint32_t)b[2] << 16);
+	return (int32_t)(v << 8) >> 8;
+}
+
+void cir_sample(const struct cir_capture* c, int i, int32_t* re, int32_t* im)
+{
+	const uint8_t* p = c->buf + 6 * i;
+	*re = cir_s24(p);
+	*im = cir_s24(p + 3);
+}
+
+float cir_magnitude(const struct cir_capture* c, int i)
+{
+	int32_t re, im;
+	cir_sample(c, i, &re, &im);
+	return sqrtf((float)re * re + (float)im * im);
+}
+
+static float cir_ramp(float x, float lo, float hi)
+{
+	if (x <= lo) {
+		return 0;
+	} else if (x >= hi) {
+		return 1;
+	}
+	return (x - lo) / (hi - lo);
+}
+
+/* interpolated position where the magnitude crosses thr between i-1 and i */
+static float cir_crossing(const struct cir_capture* c, int i, float thr)
+{
+	float m0 = cir_magnitude(c, i - 1);
+	float m1 = cir_magnitude(c, i);
+	if (m1 <= m0) {
+		return i;
+	}
+	return i - 1 + (thr - m0) / (m1 - m0);
+}
+
+bool cir_analyse(const struct cir_capture* c, struct cir_result* r)
+{
+	int num = c->num;
+	float sum = 0;
+	float sq = 0;
+	int i;
+
+	if (!c->done || num < CIR_NOISE_SAMPLES + 8) {
+		return false;
+	}
+
+	memset(r, 0, sizeof(*r));
+
+	/* noise at the start of the window, before the first path */
+	for (i = 0; i < CIR_NOISE_SAMPLES; i++) {
+		float m = cir_magnitude(c, i);
+		sum += m;
+		sq += m * m;
+	}
+	r->noise = sum / CIR_NOISE_SAMPLES;
+	r->noise_std = sqrtf(fmaxf(sq / CIR_NOISE_SAMPLES - r->noise * r->noise, 0));
+
+	int peak = 0;
+	for (i = 0; i < num; i++) {
+		float m = cir_magnitude(c, i);
+		if (m > r->peak_ampl) {
+			r->peak_ampl = m;
+			peak = i;
+		}
+	}
+
+	/* leading edge */
+	float thr = r->noise + CIR_LDE_SIGMA * r->noise_std;
+	for (i = CIR_NOISE_SAMPLES; i < num; i++) {
+		if (cir_magnitude(c, i) > thr) {
+			break;
+		}
+	}
+	if (i >= num) {
+		LOG_DBG("CIR: no leading edge");
+		return false;
+	}
+	r->leading_edge = c->start + cir_crossing(c, i, thr);
+
+	/* first path is the first local maximum */
+	int fp = i;
+	while (fp + 1 < num && cir_magnitude(c, fp + 1) >= cir_magnitude(c, fp)) {
+		fp++;
+	}
+	r->fp_ampl = cir_magnitude(c, fp);
+
+	/* rise time of the first path from 10% to 90% */
+	float t10 = r->fp_ampl * 0.1f;
+	float t90 = r->fp_ampl * 0.9f;
+	int i10 = fp;
+	while (i10 > 1 && cir_magnitude(c, i10 - 1) > t10) {
+		i10--;
+	}
+	int i90 = i10;
+	while (i90 < fp && cir_magnitude(c, i90) < t90) {
+		i90++;
+	}
+	r->rise_ns = (cir_crossing(c, i90, t90) - cir_crossing(c, i10, t10))
+				 * CIR_SAMPLE_NS;
+	if (r->rise_ns < 0) {
+		r->rise_ns = 0;
+	}
+
+	r->fp_index = c->start + fp;
+	r->peak_index = c->start + peak;
+	r->peak_fp_db = 20 * log10f(r->peak_ampl / r->fp_ampl);
+	r->fp_peak_ns = (peak - fp) * CIR_SAMPLE_NS;
+
+	float nlos = cir_ramp(r->peak_fp_db, CIR_NLOS_DB_LOS, CIR_NLOS_DB_NLOS);
+	nlos = fmaxf(nlos,
+				 cir_ramp(r->fp_peak_ns, CIR_NLOS_NS_LOS, CIR_NLOS_NS_NLOS));
+	nlos = fmaxf(nlos, cir_ramp(r->rise_ns, CIR_NLOS_RISE_LOS,
+								CIR_NLOS_RISE_NLOS));
+	r->nlos = lroundf(nlos * 100);
+	return true;
+}
+
+size_t cir_export(const struct cir_capture* c, uint8_t* out, size_t len)
+{
+	struct cir_export_hdr hdr = {
+		.acc = c->acc,
+		.start = c->start,
+		.num = c->num,
+		.fp_index = c->diag.fp_index,
+		.rx_ts = c->rx_ts,
+	};
+	size_t data_len = 6 * c->num;
+
+	if (!c->done || len < sizeof(hdr) + data_len) {
+		return 0;
+	}
+
+	memcpy(hdr.magic, CIR_EXPORT_MAGIC, sizeof(hdr.magic));
+	memcpy(out, &hdr, sizeof(hdr));
+	memcpy(out + sizeof(hdr), c->buf, data_len);
+	return sizeof(hdr) + data_len;
+}
@@ -0,0 +1,106 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_CIR_H
+#define DECA_CIR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dwphy.h"
+
+/*
+ * Channel impulse response (CIR) capture and first path analysis
+ *
+ * The CIR is read from the accumulator memory with dwt_readcir() in full
+ * resolution into the buffer of the caller: 6 bytes per complex sample (24 bit
+ * real and imaginary, little endian). Use cir_sample() to decode them. The
+ * window before the first path uses the first path index of the CIA, so the
+ * full diagnostics are enabled (dwphy_enable_full_diag()).
+ *
+ * The accumulator is overwritten by the next reception, so cir_request() arms
+ * a capture of the next received frame, which happens in the RX IRQ before RX
+ * is enabled again. Only the first CIR_IRQ_SAMPLES are read in the IRQ. For a
+ * larger capture RX stays off until the rest is read in the MAC task, so
+ * frames which arrive meanwhile are lost. cir_read() reads immediately, e.g.
+ * when RX is off.
+ *
+ * cir_analyse() finds the leading edge (first sample above the noise
+ * threshold), the first path, the peak to first path ratio and the rise time
+ * of the first path, and derives an NLOS likelihood from them.
+ *
+ * cir_export() writes a capture for offline analysis on a host: a packed
+ * struct cir_export_hdr (little endian) followed by the raw samples.
+ */
+
+#define CIR_BUF_LEN(num)   (6 * (num))
+#define CIR_IRQ_SAMPLES	   (2 * CIR_PRE_FP_SAMPLES) // read in the RX IRQ
+#define CIR_FIRST_PATH	   0xFFFF // start the window before the first path
+#define CIR_PRE_FP_SAMPLES 32	  // samples before the first path
+#define CIR_NOISE_SAMPLES  16	  // at the start of the window
+#define CIR_SAMPLE_NS	   1.0016f
+#define CIR_EXPORT_MAGIC   "CIR1"
+
+struct cir_capture {
+	uint8_t* buf;	// CIR_BUF_LEN(num) bytes, word aligned
+	uint16_t num;	// samples
+	uint16_t first; // first sample or CIR_FIRST_PATH
+	uint8_t acc;	// dwt_acc_idx_e
+	/* result of the capture */
+	volatile bool done;
+	uint16_t start; // first sample which was read
+	uint64_t rx_ts;
+	struct dwphy_rxdiag diag; // peak and first path index from the CIA
+};
+
+struct cir_result {
+	float noise;		// mean magnitude of the noise
+	float noise_std;	// standard deviation of the noise
+	float leading_edge; // sample index, interpolated
+	uint16_t fp_index;	// first local maximum after the leading edge
+	float fp_ampl;
+	uint16_t peak_index;
+	float peak_ampl;
+	float peak_fp_db;  // peak to first path ratio
+	float fp_peak_ns;  // delay from first path to peak
+	float rise_ns;	   // first path rise time 10% to 90%
+	uint8_t nlos;	   // NLOS likelihood in percent
+};
+
+struct cir_export_hdr {
+	char magic[4]; // CIR_EXPORT_MAGIC
+	uint8_t acc;
+	uint8_t reserved;
+	uint16_t start;
+	uint16_t num;
+	uint16_t fp_index; // Q10.6, from the CIA
+	uint64_t rx_ts;
+} __attribute__((packed));
+
+/** Capture the CIR of the next received frame into c. c->done is set when
+ * it is complete. False if a capture is already pending */
+bool cir_request(struct cir_capture* c);
+void cir_cancel(void);
+/** Capture the CIR of the last received frame now */
+bool cir_read(struct cir_capture* c);
+/** Decode sample i (index into the capture, not the accumulator) */
+void cir_sample(const struct cir_capture* c, int i, int32_t* re, int32_t* im);
+float cir_magnitude(const struct cir_capture* c, int i);
+bool cir_analyse(const struct cir_capture* c, struct cir_result* r);
+/** Header and samples, returns the length or 0 if out is too small */
+size_t cir_export(const struct cir_capture* c, uint8_t* out, size_t len);
+
+/* INTERNAL: called from the RX IRQ, true if the rest of the capture has to be
+ * read before RX is enabled again. Then cir_finish_rx() must be called
+ * instead of enabling RX */
+bool cir_handle_rx(uint64_t rx_ts);
+void cir_finish_rx(bool rx_on);
+
+#endif
@@ -0,0 +1,278 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <deca_device_api.h>
+
+#include "clkmodel.h"
+#include "dwmac.h"
+#include "dwtime.h"
+#include "dwutil.h"
+#include "log.h"
+#include "platform/dwmac_task.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+/* crystals are +/- 20 ppm, anything more is a wrong measurement */
+#define CLKMODEL_MAX_DRIFT 100e-6
+#define CLKMODEL_DTU_PER_S (1.0 / DWT_TIME_UNITS)
+
+/*
+ * The reference time of the local time local_base is ref_base + offset, and
+ * the reference clock advances by (1 + drift) DTU per local DTU. The integer
+ * part of the offset is kept in ref_base, so the doubles stay small.
+ */
+struct clkmodel_anchor {
+	uint64_t addr;
+	double tof; // DTU
+	uint64_t local_base;
+	uint64_t ref_base;
+	double offset;
+	double drift;
+	double p[2][2]; // covariance of (offset, drift)
+	uint32_t last_us;
+	uint32_t num;
+	uint32_t outliers;
+	uint32_t bad; // consecutive outliers
+};
+
+static uint64_t ref_addr;
+static struct clkmodel_anchor anchors[CLKMODEL_MAX_ANCHORS];
+static size_t num_anchors;
+
+/* signed difference of 40 bit timestamps */
+static int64_t clkmodel_diff(uint64_t a, uint64_t b)
+{
+	return (int64_t)((a - b) << 24) >> 24;
+}
+
+static struct clkmodel_anchor* clkmodel_find(uint64_t addr, bool add)
+{
+	for (size_t i = 0; i < num_anchors; i++) {
+		if (anchors[i].addr == addr) {
+			return &anchors[i];
+		}
+	}
+
+	if (!add) {
+		return NULL;
+	}
+
+	if (num_anchors >= CLKMODEL_MAX_ANCHORS) {
+		LOG_ERR("Clock model: too many anchors");
+		return NULL;
+	}
+
+	struct clkmodel_anchor* a = &anchors[num_anchors++];
+	memset(a, 0, sizeof(*a));
+	a->addr = addr;
+	return a;
+}
+
+/* variance of the drift random walk per local DTU */
+static double clkmodel_q(void)
+{
+	double d = CLKMODEL_DRIFT_NOISE_PPB * 1e-9;
+	return d * d / CLKMODEL_DTU_PER_S;
+}
+
+void clkmodel_init(uint64_t ref)
+{
+	ref_addr = ref;
+	memset(anchors, 0, sizeof(anchors));
+	num_anchors = 0;
+}
+
+bool clkmodel_set_distance(uint64_t anchor, float dist_m)
+{
+	struct clkmodel_anchor* a = clkmodel_find(anchor, true);
+	if (a == NULL) {
+		return false;
+	}
+	a->tof = dist_m / SPEED_OF_LIGHT / DWT_TIME_UNITS;
+	return true;
+}
+
+void clkmodel_reset(uint64_t anchor)
+{
+	struct clkmodel_anchor* a = clkmodel_find(anchor, false);
+	if (a != NULL) {
+		a->num = 0;
+	}
+}
+
+static void clkmodel_start(struct clkmodel_anchor* a, uint64_t meas,
+						   uint64_t rx)
+{
+	a->local_base = rx;
+	a->ref_base = meas;
+	a->offset = 0;
+	a->drift = 0;
+	a->bad = 0;
+	a->num = 1;
+}
+
+bool clkmodel_add_sync(uint64_t anchor, uint64_t tx_ts, uint64_t rx_ts)
+{
+	const double r = CLKMODEL_MEAS_NOISE_DTU * CLKMODEL_MEAS_NOISE_DTU;
+
+	if (anchor == ref_addr) {
+		return false;
+	}
+
+	struct clkmodel_anchor* a = clkmodel_find(anchor, true);
+	if (a == NULL) {
+		return false;
+	}
+
+	uint32_t now = dwtask_get_time_us();
+	uint64_t meas = (tx_ts + llround(a->tof)) & DTU_MASK;
+	rx_ts &= DTU_MASK;
+
+	if (a->num > 0 && now - a->last_us > CLKMODEL_MAX_GAP_MS * 1000U) {
+		LOG_INF("Clock model " LADDR_FMT ": restart after gap",
+				LADDR_PAR(anchor));
+		a->num = 0;
+	}
+	a->last_us = now;
+
+	if (a->num == 0) {
+		clkmodel_start(a, meas, rx_ts);
+		return true;
+	}
+
+	int64_t idt = clkmodel_diff(rx_ts, a->local_base);
+	if (idt <= 0) {
+		/* duplicate or out of order */
+		return false;
+	}
+	double dt = idt;
+
+	if (a->num == 1) {
+		/* drift and covariance from two points */
+		double drift = (clkmodel_diff(meas, a->ref_base) - dt) / dt;
+		if (fabs(drift) > CLKMODEL_MAX_DRIFT) {
+			clkmodel_start(a, meas, rx_ts);
+			return false;
+		}
+		a->local_base = rx_ts;
+		a->ref_base = meas;
+		a->offset = 0;
+		a->drift = drift;
+		a->p[0][0] = r;
+		a->p[0][1] = a->p[1][0] = r / dt;
+		a->p[1][1] = 2 * r / (dt * dt);
+		a->num = 2;
+		return true;
+	}
+
+	/* predict to rx_ts */
+	double q = clkmodel_q();
+	double (*p)[2] = a->p;
+	a->offset += a->drift * dt;
+	p[0][0] += 2 * dt * p[0][1] + dt * dt * p[1][1] + q * dt * dt * dt / 3;
+	p[0][1] += dt * p[1][1] + q * dt * dt / 2;
+	p[1][0] = p[0][1];
+	p[1][1] += q * dt;
+	a->local_base = rx_ts;
+	a->ref_base = (a->ref_base + idt) & DTU_MASK;
+
+	/* update */
+	double y = clkmodel_diff(meas, a->ref_base) - a->offset;
+	double s = p[0][0] + r;
+
+	if (y * y > CLKMODEL_OUTLIER_SIGMA * CLKMODEL_OUTLIER_SIGMA * s) {
+		a->outliers++;
+		if (++a->bad >= CLKMODEL_MAX_OUTLIERS) {
+			LOG_INF("Clock model " LADDR_FMT ": restart after outliers",
+					LADDR_PAR(anchor));
+			clkmodel_start(a, meas, rx_ts);
+		}
+		return false;
+	}
+
+	double k0 = p[0][0] / s;
+	double k1 = p[0][1] / s;
+	a->offset += k0 * y;
+	a->drift += k1 * y;
+	p[1][1] -= k1 * p[0][1];
+	p[0][1] *= 1 - k0;
+	p[1][0] = p[0][1];
+	p[0][0] *= 1 - k0;
+
+	int64_t o = llround(a->offset);
+	a->ref_base = (a->ref_base + o) & DTU_MASK;
+	a->offset -= o;
+	a->bad = 0;
+	a->num++;
+	return true;
+}
+
+void clkmodel_handle_sync(uint64_t src, uint32_t seq, uint64_t tx_ts,
+						  uint64_t rx_ts, float skew)
+{
+	/* skew is not used, the drift is estimated from the timestamps */
+	if (src != ref_addr) {
+		return;
+	}
+
+	if (!clkmodel_add_sync(dwmac_get_mac16(), tx_ts, rx_ts)) {
+		LOG_DBG("Clock model: SYNC #%" PRIu32 " not used", seq);
+	}
+}
+
+bool clkmodel_to_ref(uint64_t anchor, uint64_t ts, uint64_t* ref_ts,
+					 float* uncert_dtu)
+{
+	if (anchor == ref_addr) {
+		*ref_ts = ts & DTU_MASK;
+		if (uncert_dtu) {
+			*uncert_dtu = 0;
+		}
+		return true;
+	}
+
+	struct clkmodel_anchor* a = clkmodel_find(anchor, false);
+	if (a == NULL || a->num < 2
+		|| dwtask_get_time_us() - a->last_us > CLKMODEL_MAX_GAP_MS * 1000U) {
+		return false;
+	}
+
+	int64_t idt = clkmodel_diff(ts, a->local_base);
+	double dt = idt;
+	int64_t c = llround(a->offset + a->drift * dt);
+	*ref_ts = (a->ref_base + idt + c) & DTU_MASK;
+
+	if (uncert_dtu) {
+		const double(*p)[2] = a->p;
+		double adt = fabs(dt);
+		double var = p[0][0] + 2 * dt * p[0][1] + dt * dt * p[1][1]
+					 + clkmodel_q() * adt * adt * adt / 3;
+		*uncert_dtu = sqrt(var);
+	}
+	return true;
+}
+
+bool clkmodel_get_info(uint64_t anchor, struct clkmodel_info* info)
+{
+	struct clkmodel_anchor* a = clkmodel_find(anchor, false);
+	if (a == NULL) {
+		return false;
+	}
+
+	info->drift_ppm = a->drift * 1e6;
+	info->uncert_dtu = a->num >= 2 ? sqrt(a->p[0][0]) : INFINITY;
+	info->num = a->num;
+	info->outliers = a->outliers;
+	return true;
+}
@@ -0,0 +1,75 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_CLKMODEL_H
+#define DECA_CLKMODEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Anchor clock model for wireless TDoA synchronisation
+ *
+ * The reference anchor sends SYNC messages with its TX timestamp. For each
+ * other anchor a Kalman filter with the state (offset, drift) tracks the
+ * relation of its clock to the clock of the reference anchor from the pairs
+ * (TX timestamp + time of flight, RX timestamp). With this model any
+ * timestamp of the anchor can be mapped into the time base of the reference
+ * anchor, together with its standard deviation.
+ *
+ * The time of flight between the reference and an anchor is known from their
+ * positions (clkmodel_set_distance()). Timestamps are 40 bit DTU and wrap
+ * around, so SYNC messages have to be sent at least every 17 seconds.
+ *
+ * The model can run on each anchor (clkmodel_handle_sync() as SYNC observer)
+ * to convert its own blink timestamps before they are reported, or on a
+ * gateway which receives the SYNC timestamps of all anchors
+ * (clkmodel_add_sync()).
+ */
+
+#define CLKMODEL_MAX_ANCHORS 16
+/* standard deviation of a timestamp, about 100ps */
+#define CLKMODEL_MEAS_NOISE_DTU 7.0
+/* random walk of the drift in ppb per sqrt(s) */
+#define CLKMODEL_DRIFT_NOISE_PPB 5.0
+/* measurements further away from the prediction are ignored */
+#define CLKMODEL_OUTLIER_SIGMA 6.0
+/* model is reset after this many consecutive outliers */
+#define CLKMODEL_MAX_OUTLIERS 3
+/* model is reset when no SYNC was received for this long */
+#define CLKMODEL_MAX_GAP_MS 15000
+
+struct clkmodel_info {
+	float drift_ppm;   // rate of the reference clock relative to this clock
+	float uncert_dtu;  // standard deviation at the last SYNC
+	uint32_t num;	   // SYNC messages used
+	uint32_t outliers; // SYNC messages rejected
+};
+
+/** Address of the reference anchor, resets all models */
+void clkmodel_init(uint64_t ref);
+/** Distance in meters between the reference anchor and anchor */
+bool clkmodel_set_distance(uint64_t anchor, float dist_m);
+/** Add the SYNC message of the reference anchor (tx_ts) received by anchor at
+ * rx_ts in its own time base */
+bool clkmodel_add_sync(uint64_t anchor, uint64_t tx_ts, uint64_t rx_ts);
+/** Can be used as SYNC observer (sync_set_observer()) on an anchor, which
+ * models its own clock (dwmac_get_mac16()) */
+void clkmodel_handle_sync(uint64_t src, uint32_t seq, uint64_t tx_ts,
+						  uint64_t rx_ts, float skew);
+/** Map ts of anchor into the time base of the reference anchor (40 bit).
+ * uncert_dtu is the standard deviation and can be NULL. False when there is
+ * no valid model for the anchor yet */
+bool clkmodel_to_ref(uint64_t anchor, uint64_t ts, uint64_t* ref_ts,
+					 float* uncert_dtu);
+bool clkmodel_get_info(uint64_t anchor, struct clkmodel_info* info);
+void clkmodel_reset(uint64_t anchor);
+
+#endif
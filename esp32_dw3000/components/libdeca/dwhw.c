@@ -8,6 +8,8 @@
  */
 
 #include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
 #include <deca_device_api.h>
 #include <deca_version.h>
 #ifdef DW3000_DRIVER_VERSION // == 0x040000
@@ -18,10 +20,34 @@
 
 #include "dwhw.h"
 #include "dwmac.h"
+#include "dwphy.h"
 #include "log.h"
 
+#if ESP_PLATFORM
+#include <esp_attr.h>
+#define DWHW_NOINIT RTC_NOINIT_ATTR
+#elif defined(__ZEPHYR__)
+#include <zephyr/linker/section_tags.h>
+#define DWHW_NOINIT __noinit
+#else
+#define DWHW_NOINIT __attribute__((section(".noinit")))
+#endif
+
 #define DWHW_DEBUG_WAKEUP 0
 
+/* IDLE_RC is reached within about a millisecond after reset or wake-up, so
+ * it is polled in small steps instead of OS ticks */
+#define DWHW_IDLE_POLL_US		  10
+#define DWHW_IDLE_TIMEOUT_US	  100000
+#define DWHW_WAKEUP_IRQ_TIMEOUT_MS 5
+
+/* The sleep counter counts low-power oscillator cycles, only the upper 16 of
+ * its 28 bits are programmed */
+#define DWHW_XTAL_FREQ_HZ	 38400000UL
+#define DWHW_SLEEP_CNT_SHIFT 12
+
+#define DWHW_WARM_MAGIC 0xDECA5EED
+
 #ifdef DRIVER_VERSION_HEX // >= 0x060007
 extern const struct dwt_probe_s dw3000_probe_interf;
 #endif
@@ -30,12 +56,96 @@ extern const struct dwt_probe_s dw3000_probe_interf;
 static const char* LOG_TAG = "DECA";
 #endif
 static bool dwchip_ready = false;
-static float last_calib_temp;
+static bool sleep_timer_on = false;
+static void (*wakeup_cb)(void);
+
+/* State of the DW3000 in memory which survives a reset of the host (RTC
+ * memory on ESP32). It is saved when the configuration changes and only used
+ * while the DW3000 sleeps */
+struct dwhw_warm {
+	uint32_t magic;
+	uint32_t dev_id;
+	uint32_t part_id;
+	uint64_t lot_id;
+	dwt_config_t config;
+	uint16_t tx_antd;
+	uint16_t rx_antd;
+	uint8_t xtal_trim;
+	uint32_t csum;
+	uint32_t sleeping; // DWHW_WARM_MAGIC, not in the checksum
+};
+
+static DWHW_NOINIT struct dwhw_warm warm;
+
+static bool dwhw_wait_idle_rc(void)
+{
+	int cnt = DWHW_IDLE_TIMEOUT_US / DWHW_IDLE_POLL_US;
+	while (!dwt_checkidlerc()) {
+		if (--cnt <= 0) {
+			return false;
+		}
+		deca_usleep(DWHW_IDLE_POLL_US);
+	}
+	return true;
+}
+
+#ifdef DRIVER_VERSION_HEX // >= 0x060007
+#define DWHW_INT_SPIRDY DWT_INT_SPIRDY_BIT_MASK
+#define DWHW_INT_RCINIT DWT_INT_RCINIT_BIT_MASK
+#else
+#define DWHW_INT_SPIRDY DWT_INT_SPIRDY
+#define DWHW_INT_RCINIT DWT_INT_RCINIT
+#endif
+
+/* The SPIRDY interrupt signals the end of the wake-up. The interrupt mask is
+ * restored from AON memory on wake-up (DWT_CONFIG) */
+static void dwhw_enable_spirdy_interrupt(void)
+{
+	dwt_setinterrupt(DWHW_INT_SPIRDY, 0, DWT_ENABLE_INT);
+}
+
+static bool dwhw_wakeup_restore(void);
+
+/* FNV-1a */
+static uint32_t dwhw_warm_csum(const struct dwhw_warm* w)
+{
+	const uint8_t* p = (const uint8_t*)w;
+	uint32_t h = 2166136261UL;
+	for (size_t i = 0; i < offsetof(struct dwhw_warm, csum); i++) {
+		h = (h ^ p[i]) * 16777619UL;
+	}
+	return h;
+}
+
+void dwhw_warm_save(void)
+{
+	memset(&warm, 0, sizeof(warm));
+	warm.dev_id = dwt_readdevid();
+	warm.part_id = dwt_getpartid();
+	warm.lot_id = dwt_getlotid();
+	warm.config = *dwphy_get_config();
+	warm.tx_antd = dwt_gettxantennadelay();
+	warm.rx_antd = dwt_getrxantennadelay();
+	warm.xtal_trim = dwphy_get_xtal_trim();
+	warm.magic = DWHW_WARM_MAGIC;
+	warm.csum = dwhw_warm_csum(&warm);
+}
+
+void dwhw_warm_sleep(void)
+{
+	warm.sleeping = DWHW_WARM_MAGIC;
+}
+
+static void dwhw_warm_invalidate(void)
+{
+	warm.magic = 0;
+	warm.sleeping = 0;
+}
 
-static void dwhw_update_calib_temp(void)
+static bool dwhw_warm_is_valid(void)
 {
-	uint16_t tv = dwt_readtempvbat();
-	last_calib_temp = dwt_convertrawtemperature(tv >> 8);
+	return warm.magic == DWHW_WARM_MAGIC && warm.sleeping == DWHW_WARM_MAGIC
+		   && warm.csum == dwhw_warm_csum(&warm);
 }
 
 bool dwhw_init(void)
@@ -69,11 +179,7 @@ bool dwhw_init(void)
 		return false;
 	}
 
-	int cnt = 1000;
-	while (!dwt_checkidlerc() && cnt-- > 0) {
-		deca_sleep(1);
-	}
-	if (cnt <= 0) {
+	if (!dwhw_wait_idle_rc()) {
 		LOG_ERR("Init did not leave IDLE state");
 		return false;
 	}
@@ -89,15 +195,80 @@ bool dwhw_init(void)
 
 	// dwt_setleds(DWT_LEDS_ENABLE | DWT_LEDS_INIT_BLINK);
 
+	dwhw_warm_invalidate();
 	dw3000_spi_speed_fast();
 
-	// assume dwphy_init() is run soon!
-	dwhw_update_calib_temp();
-
 	dwchip_ready = true;
 	return true;
 }
 
+/* Warm start after a reset of the host while the DW3000 was sleeping with its
+ * configuration (e.g. ESP32 deep sleep). Instead of reset, PLL calibration and
+ * full configuration, the DW3000 is woken up and only the driver data is built
+ * again from OTP and the saved state. If this returns false the normal
+ * initialization (dw3000_hw_reset(), dwhw_init(), dwphy_config()) is needed */
+bool dwhw_init_warm(void)
+{
+	int ret;
+
+	if (!dwhw_warm_is_valid()) {
+		return false;
+	}
+	/* the restore below saves the state again */
+	const struct dwhw_warm w = warm;
+	dwhw_warm_invalidate();
+
+#ifdef DRIVER_VERSION_HEX // >= 0x060007
+	ret = dwt_probe((struct dwt_probe_s*)&dw3000_probe_interf);
+	if (ret < 0) {
+		LOG_ERR("DWT Probe failed");
+		return false;
+	}
+#endif
+
+	dw3000_hw_ready_wait_prepare();
+	dw3000_hw_wakeup();
+	dw3000_hw_ready_wait(DWHW_WAKEUP_IRQ_TIMEOUT_MS);
+
+	if (!dwhw_wait_idle_rc()) {
+		LOG_ERR("Warm start: wakeup did not leave IDLE state");
+		return false;
+	}
+
+	/* this does not reset the DW3000, OTP values are read to the driver */
+#if DRIVER_VERSION_HEX >= 0x080202
+	ret = dwt_initialise(DWT_READ_OTP_PID | DWT_READ_OTP_LID | DWT_READ_OTP_BAT
+						 | DWT_READ_OTP_TMP);
+#else
+	ret = dwt_initialise(DWT_DW_INIT);
+#endif
+	if (ret == DWT_ERROR || dwt_readdevid() != w.dev_id
+		|| dwt_getpartid() != w.part_id || dwt_getlotid() != w.lot_id) {
+		LOG_ERR("Warm start: different device");
+		return false;
+	}
+
+	/* antenna delays are back to their defaults if the DW3000 was reset */
+	if (dwt_gettxantennadelay() != w.tx_antd
+		|| dwt_getrxantennadelay() != w.rx_antd) {
+		LOG_ERR("Warm start: configuration lost");
+		return false;
+	}
+
+	if (!dwphy_restore_config(&w.config)) {
+		return false;
+	}
+	/* in case dwphy_config() was run */
+	dwt_settxantennadelay(w.tx_antd);
+	dwt_setrxantennadelay(w.rx_antd);
+	/* dwt_initialise() has set the XTAL trim from OTP */
+	dwphy_set_xtal_trim(w.xtal_trim);
+	dwhw_warm_save();
+
+	LOG_INF("Warm start DEV ID: %" PRIX32, w.dev_id);
+	return dwhw_wakeup_restore();
+}
+
 void dwhw_configure_sleep(void)
 {
 	/* Sleep configuration:
@@ -108,6 +279,56 @@ void dwhw_configure_sleep(void)
 	 * - enable deep sleep */
 	dwt_configuresleep(DWT_PGFCAL | DWT_CONFIG,
 					   DWT_SLP_EN | DWT_WAKE_CSN | DWT_WAKE_WUP);
+	dwhw_enable_spirdy_interrupt();
+}
+
+/* Calibrate the low-power oscillator and configure SLEEP mode (not DEEPSLEEP,
+ * where the oscillator is off) to wake up after interval_ms. The wake-up is
+ * signalled by the SPIRDY interrupt, so the SPI stays initialized during sleep.
+ * Returns the real interval in us, which is a multiple of 4096 oscillator
+ * cycles (~100-270ms), or 0 on error */
+uint32_t dwhw_configure_sleep_timer(uint32_t interval_ms)
+{
+	/* the sleep counter has to be written with SPI < 3MHz */
+	dw3000_spi_speed_slow();
+	uint16_t cal = dwt_calibratesleepcnt();
+	if (cal == 0) {
+		dw3000_spi_speed_fast();
+		LOG_ERR("Sleep counter calibration failed");
+		return 0;
+	}
+
+	uint32_t lp_hz = DWHW_XTAL_FREQ_HZ / cal;
+	uint64_t cnt = ((uint64_t)interval_ms * lp_hz / 1000) >> DWHW_SLEEP_CNT_SHIFT;
+	if (cnt == 0) {
+		cnt = 1;
+	} else if (cnt > UINT16_MAX) {
+		cnt = UINT16_MAX;
+	}
+
+	dwt_configuresleepcnt(cnt);
+	dw3000_spi_speed_fast();
+
+	dwt_configuresleep(DWT_PGFCAL | DWT_CONFIG,
+					   DWT_PRES_SLEEP | DWT_WAKE_CSN | DWT_WAKE_WUP | DWT_SLEEP
+						   | DWT_SLP_EN);
+	dwhw_enable_spirdy_interrupt();
+	sleep_timer_on = true;
+
+	uint32_t us = (cnt << DWHW_SLEEP_CNT_SHIFT) * 1000000ULL / lp_hz;
+	LOG_INF("Sleep timer %" PRIu32 " us (LP osc %" PRIu32 " Hz)", us, lp_hz);
+	return us;
+}
+
+void dwhw_disable_sleep_timer(void)
+{
+	dwhw_configure_sleep();
+	sleep_timer_on = false;
+}
+
+void dwhw_set_wakeup_observer(void (*cb)(void))
+{
+	wakeup_cb = cb;
 }
 
 void dwhw_enable_tx_interrupt(bool on)
@@ -134,8 +355,14 @@ void dwhw_sleep(void)
 	/* pull WAKEUP line low, later we will use it for waking up */
 	dw3000_hw_wakeup_pin_low();
 
+	dwhw_warm_sleep();
 	dwt_entersleep(DWT_DW_IDLE);
 
+	if (sleep_timer_on) {
+		dw3000_spi_speed_slow();
+		return;
+	}
+
 	/* While in DEEPSLEEP power should not be applied to GPIO, SPICLK or
 	SPIMISO pins as this will cause an increase in leakage current */
 	dw3000_spi_fini();
@@ -147,19 +374,29 @@ bool dwhw_wakeup(void)
 		return true;
 	}
 
-	dw3000_spi_init();
+	if (!sleep_timer_on) {
+		dw3000_spi_init();
+	}
+
+	/* the IRQ line signals SPIRDY, fall back to polling if that is not
+	 * supported or did not happen */
+	dw3000_hw_ready_wait_prepare();
 	dw3000_hw_wakeup();
+	dw3000_hw_ready_wait(DWHW_WAKEUP_IRQ_TIMEOUT_MS);
 
-	/* Wait for device to become ready (IDLE state) */
-	int cnt = 1000;
-	while (!dwt_checkidlerc() && cnt-- > 0) {
-		deca_sleep(1);
-	}
-	if (cnt <= 0) {
+	if (!dwhw_wait_idle_rc()) {
 		LOG_ERR("Wakeup did not leave IDLE state");
 		return false;
 	}
 
+	return dwhw_wakeup_restore();
+}
+
+/* device is in IDLE_RC after wake-up */
+static bool dwhw_wakeup_restore(void)
+{
+	warm.sleeping = 0;
+
 	int ret = dwt_check_dev_id();
 	if (ret != DWT_SUCCESS) {
 		LOG_ERR("Failed to read device ID after wakeup!");
@@ -172,6 +409,13 @@ bool dwhw_wakeup(void)
 	dwt_restoreconfig();
 #endif
 
+	/* the IRQ line stays high until the status is cleared */
+#ifdef DRIVER_VERSION_HEX // >= 0x060007
+	dwt_writesysstatuslo(DWHW_INT_SPIRDY | DWHW_INT_RCINIT);
+#else
+	dwt_write32bitreg(SYS_STATUS_ID, DWHW_INT_SPIRDY | DWHW_INT_RCINIT);
+#endif
+
 	dw3000_spi_speed_fast();
 	dwmac_cleanup_sleep_after_tx();
 
@@ -181,7 +425,6 @@ bool dwhw_wakeup(void)
 			dwt_read32bitreg(SYS_ENABLE_LO_ID));
 #endif
 
-	dwhw_update_calib_temp(); // DWT_PGFCAL was set
 	dwchip_ready = true;
 	return true;
 }
@@ -194,17 +437,26 @@ bool dwhw_is_ready(void)
 void dwhw_sleep_after_tx(void)
 {
 	dwchip_ready = false;
-	dw3000_spi_fini();
+	if (sleep_timer_on) {
+		/* keep SPI for the SPIRDY interrupt, slow for IDLE_RC */
+		dw3000_spi_speed_slow();
+	} else {
+		dw3000_spi_fini();
+	}
 }
 
-void dwhw_calib_if_temp_change(void)
+/* called in task context after SPIRDY */
+void dwhw_handle_spi_ready(void)
 {
-	uint16_t tv = dwt_readtempvbat();
-	float temp = dwt_convertrawtemperature(tv >> 8);
-	LOG_INF("TEMP %.2f last %.2f", (double)temp, (double)last_calib_temp);
-	if (temp >= last_calib_temp + 20.0f || temp <= last_calib_temp - 20.0f) {
-		LOG_WARN("Temperature changed by 20deg, calibrating");
-		last_calib_temp = temp;
-		dwt_pgf_cal(1);
+	if (dwchip_ready) {
+		return;
+	}
+
+	if (!dwhw_wakeup_restore()) {
+		return;
+	}
+
+	if (wakeup_cb) {
+		wakeup_cb();
 	}
 }
@@ -11,14 +11,28 @@
 #define DECA_HW_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 bool dwhw_init(void);
+bool dwhw_init_warm(void);
 void dwhw_sleep(void);
 bool dwhw_wakeup(void);
 bool dwhw_is_ready(void);
 void dwhw_sleep_after_tx(void);
 void dwhw_configure_sleep(void);
 void dwhw_enable_tx_interrupt(bool on);
-void dwhw_calib_if_temp_change(void);
+
+/* periodic wake-up by the DW3000 sleep counter */
+uint32_t dwhw_configure_sleep_timer(uint32_t interval_ms);
+void dwhw_disable_sleep_timer(void);
+void dwhw_set_wakeup_observer(void (*cb)(void));
+
+/* INTERNAL: called from task / scheduler context */
+void dwhw_handle_spi_ready(void);
+/* INTERNAL: save the state for dwhw_init_warm() when the configuration,
+ * antenna delay or XTAL trim changed */
+void dwhw_warm_save(void);
+/* INTERNAL: the saved state is valid from now, before the DW3000 sleeps */
+void dwhw_warm_sleep(void);
 
 #endif
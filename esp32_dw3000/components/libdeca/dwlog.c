@@ -0,0 +1,149 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "dwlog.h"
+#include "dwmac_task.h"
+#include "log.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+#define DWLOG_MASK	 (CONFIG_DECA_LOG_DEFERRED_ENTRIES - 1)
+#define DWLOG_TXTLEN 160
+
+_Static_assert((CONFIG_DECA_LOG_DEFERRED_ENTRIES & DWLOG_MASK) == 0,
+			   "CONFIG_DECA_LOG_DEFERRED_ENTRIES must be a power of two");
+
+/*
+ * Bounded multi-producer ring buffer. Each slot has a sequence number which
+ * tells producers and the consumer whether the slot is free (seq == lap) or
+ * filled (seq == lap + 1), where lap is the position without the index bits.
+ * This way an all-zero ring is empty and needs no initialization. Producers
+ * may be in IRQ context or on another core so the write position is reserved
+ * with a compare-and-swap and no locks are needed.
+ */
+struct dwlog_slot {
+	uint32_t seq;
+	struct dwlog_entry e;
+};
+
+static struct dwlog_slot ring[CONFIG_DECA_LOG_DEFERRED_ENTRIES];
+static uint32_t ring_head;
+static uint32_t ring_tail;
+static uint32_t ring_dropped;
+
+#define DWLOG_LAP(_pos) ((_pos) & ~DWLOG_MASK)
+
+/* may be called from IRQ context */
+void dwlog_put(uint8_t level, const char* fmt, uint8_t nargs,
+			   const uint32_t* args)
+{
+	struct dwlog_slot* slot;
+	uint32_t pos;
+
+	pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+	while (true) {
+		slot = &ring[pos & DWLOG_MASK];
+		uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		int32_t diff = (int32_t)(seq - DWLOG_LAP(pos));
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&ring_head, &pos, pos + 1, true,
+											__ATOMIC_RELAXED,
+											__ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (diff < 0) {
+			/* full */
+			__atomic_fetch_add(&ring_dropped, 1, __ATOMIC_RELAXED);
+			return;
+		} else {
+			pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+		}
+	}
+
+	if (nargs > DWLOG_MAX_ARGS) {
+		nargs = DWLOG_MAX_ARGS;
+	}
+
+	slot->e.fmt = fmt;
+	slot->e.time_us = dwtask_get_time_us();
+	slot->e.level = level;
+	slot->e.nargs = nargs;
+	memcpy(slot->e.args, args, nargs * sizeof(uint32_t));
+
+	__atomic_store_n(&slot->seq, DWLOG_LAP(pos) + 1, __ATOMIC_RELEASE);
+}
+
+/* only one consumer is allowed */
+bool dwlog_get(struct dwlog_entry* e)
+{
+	uint32_t pos = ring_tail;
+	struct dwlog_slot* slot = &ring[pos & DWLOG_MASK];
+	uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+	if (seq != DWLOG_LAP(pos) + 1) {
+		return false; // empty or not completely written yet
+	}
+
+	*e = slot->e;
+	ring_tail = pos + 1;
+	__atomic_store_n(&slot->seq,
+					 DWLOG_LAP(pos) + CONFIG_DECA_LOG_DEFERRED_ENTRIES,
+					 __ATOMIC_RELEASE);
+	return true;
+}
+
+int dwlog_process(int max)
+{
+	struct dwlog_entry e;
+	char txt[DWLOG_TXTLEN];
+	int cnt = 0;
+
+	while (cnt < max && dwlog_get(&e)) {
+		/* unused arguments are ignored by printf */
+		memset(&e.args[e.nargs], 0,
+			   (DWLOG_MAX_ARGS - e.nargs) * sizeof(uint32_t));
+		snprintf(txt, sizeof(txt), e.fmt, e.args[0], e.args[1], e.args[2],
+				 e.args[3], e.args[4], e.args[5]);
+
+		switch (e.level) {
+		case DWLOG_LVL_ERR:
+			LOG_ERR("(%" PRIu32 ") %s", e.time_us, txt);
+			break;
+		case DWLOG_LVL_WARN:
+			LOG_WARN("(%" PRIu32 ") %s", e.time_us, txt);
+			break;
+		case DWLOG_LVL_INF:
+			LOG_INF("(%" PRIu32 ") %s", e.time_us, txt);
+			break;
+		default:
+			LOG_DBG("(%" PRIu32 ") %s", e.time_us, txt);
+			break;
+		}
+		cnt++;
+	}
+
+	static uint32_t last_dropped;
+	uint32_t dropped = __atomic_load_n(&ring_dropped, __ATOMIC_RELAXED);
+	if (dropped != last_dropped) {
+		LOG_WARN("%" PRIu32 " log entries dropped", dropped - last_dropped);
+		last_dropped = dropped;
+	}
+
+	return cnt;
+}
+
+uint32_t dwlog_get_dropped(void)
+{
+	return __atomic_load_n(&ring_dropped, __ATOMIC_RELAXED);
+}
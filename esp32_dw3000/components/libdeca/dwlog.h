@@ -0,0 +1,93 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_DWLOG_H
+#define DECA_DWLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dwutil.h"
+
+#if ESP_PLATFORM
+#include <sdkconfig.h>
+#endif
+
+/* Deferred binary logging: instead of formatting text at the call site, only
+ * the address of the format string (the "token") and the raw arguments are
+ * put into a lock-free ring buffer. The text is formatted later from a low
+ * priority context by dwlog_process(). */
+#ifndef CONFIG_DECA_LOG_DEFERRED
+#define CONFIG_DECA_LOG_DEFERRED 0
+#endif
+
+/* Number of entries in the ring buffer, has to be a power of two */
+#ifndef CONFIG_DECA_LOG_DEFERRED_ENTRIES
+#define CONFIG_DECA_LOG_DEFERRED_ENTRIES 64
+#endif
+
+#define DWLOG_MAX_ARGS 6
+
+enum dwlog_level_e {
+	DWLOG_LVL_ERR,
+	DWLOG_LVL_WARN,
+	DWLOG_LVL_INF,
+	DWLOG_LVL_DBG,
+};
+
+struct dwlog_entry {
+	const char* fmt;  // format string, stays in flash
+	uint32_t time_us; // host time when logged
+	uint8_t level;
+	uint8_t nargs;
+	uint32_t args[DWLOG_MAX_ARGS];
+};
+
+/*
+ * Arguments are stored as uint32_t, so only integer arguments of up to 32 bit
+ * are possible. Use DWLOG_LADDR_FMT / DWLOG_LADDR_PAR for 64 bit addresses
+ * and DWLOG_STR() for static strings.
+ */
+#define DWLOG_NARGS(...)                                                       \
+	(sizeof((const uint32_t[]){0, ##__VA_ARGS__}) / sizeof(uint32_t) - 1)
+
+#define DWLOG(_lvl, _fmt, ...)                                                 \
+	do {                                                                       \
+		_Static_assert(DWLOG_NARGS(__VA_ARGS__) <= DWLOG_MAX_ARGS,             \
+					   "too many log arguments");                              \
+		dwlog_put(_lvl, _fmt, DWLOG_NARGS(__VA_ARGS__),                       \
+				  (const uint32_t[]){0, ##__VA_ARGS__} + 1);                   \
+	} while (0)
+
+#if CONFIG_DECA_LOG_DEFERRED
+#define DWLOG_INF(...)	   DWLOG(DWLOG_LVL_INF, __VA_ARGS__)
+#define DWLOG_ERR(...)	   DWLOG(DWLOG_LVL_ERR, __VA_ARGS__)
+#define DWLOG_LADDR_FMT	   "[%08" PRIX32 "%08" PRIX32 "]"
+#define DWLOG_LADDR_PAR(x) (uint32_t)((x) >> 32), (uint32_t)(x)
+/* only for strings which are not modified later (literals) */
+#define DWLOG_STR(x) (uint32_t)(uintptr_t)(x)
+#else
+#define DWLOG_INF(...)	   LOG_INF(__VA_ARGS__)
+#define DWLOG_ERR(...)	   LOG_ERR(__VA_ARGS__)
+#define DWLOG_LADDR_FMT	   LADDR_FMT
+#define DWLOG_LADDR_PAR(x) LADDR_PAR(x)
+#define DWLOG_STR(x)	   (x)
+#endif
+
+/** Put entry into ring buffer, safe to call from IRQ context */
+void dwlog_put(uint8_t level, const char* fmt, uint8_t nargs,
+			   const uint32_t* args);
+/** Get oldest entry in binary form (e.g. for sending to a host tool) */
+bool dwlog_get(struct dwlog_entry* e);
+/** Format and output up to max entries, returns number of entries output */
+int dwlog_process(int max);
+/** Number of entries lost because the ring buffer was full */
+uint32_t dwlog_get_dropped(void);
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <deca_device_api.h>
+
+#include "dwlpl.h"
+#include "dwmac.h"
+#include "dwphy.h"
+#include "log.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+/* SNIFF off time is given in units of 128/125 us, max 255 */
+#define DWLPL_OFF_MAX	   255
+#define US_TO_SNIFF_OFF(x) ((x) * 125 / 128)
+#define SNIFF_OFF_TO_US(x) ((x) * 128 / 125)
+
+static bool lpl_on;
+static uint32_t on_us;
+static uint32_t off_us;
+static uint32_t wakeup_latency_us;
+
+bool dwlpl_enable(bool on)
+{
+	if (!on) {
+		dwt_forcetrxoff();
+		dwt_setsniffmode(0, 0, 0);
+		dwphy_set_rx_preamble_symbols(0);
+		lpl_on = false;
+		dwmac_rx_reenable();
+		return true;
+	}
+
+	uint8_t prf = dwphy_get_prf();
+	uint32_t wake_us = PKTTIME_TO_USEC(
+		dwphy_calc_symbols_time(CONFIG_DECA_LPL_WAKEUP_PLEN, prf));
+	/* the normal preamble is needed for acquisition after detection */
+	uint32_t acq_us
+		= PKTTIME_TO_USEC(dwphy_calc_preamble_time(
+							  dwphy_get_plen(), prf, dwphy_get_rate())
+						  - dwphy_calc_sfd_time(prf, dwphy_get_rate()));
+
+	on_us = dwphy_pac_to_usec(DWLPL_ON_PAC);
+
+	/* one off and on period has to fit into the wake-up preamble */
+	if (wake_us <= on_us + acq_us + SNIFF_OFF_TO_US(1)) {
+		LOG_ERR("LPL wake-up preamble too short");
+		return false;
+	}
+
+	uint32_t off = US_TO_SNIFF_OFF(wake_us - on_us - acq_us);
+	if (off > DWLPL_OFF_MAX) {
+		off = DWLPL_OFF_MAX;
+	}
+	off_us = SNIFF_OFF_TO_US(off);
+	wakeup_latency_us = wake_us - acq_us;
+
+	dwt_forcetrxoff();
+	/* the ON time counter adds one PAC */
+	dwt_setsniffmode(1, DWLPL_ON_PAC - 1, off);
+	dwphy_set_rx_preamble_symbols(CONFIG_DECA_LPL_WAKEUP_PLEN);
+	lpl_on = true;
+	dwmac_rx_reenable();
+
+	LOG_INF("LPL on %" PRIu32 "us off %" PRIu32 "us (duty %d%%)", on_us,
+			off_us, dwlpl_get_duty_permille() / 10);
+	return true;
+}
+
+bool dwlpl_is_enabled(void)
+{
+	return lpl_on;
+}
+
+uint16_t dwlpl_get_duty_permille(void)
+{
+	if (!lpl_on) {
+		return 1000;
+	}
+	return on_us * 1000 / (on_us + off_us);
+}
+
+uint32_t dwlpl_get_wakeup_latency_us(void)
+{
+	return wakeup_latency_us;
+}
@@ -0,0 +1,52 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_LPL_H
+#define DECA_LPL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if ESP_PLATFORM
+#include <sdkconfig.h>
+#endif
+
+/*
+ * Low-power listening with the DW3000 SNIFF mode
+ *
+ * The receiver is switched on for a few PACs to hunt for preamble and then off
+ * for up to 255us. A frame is only detected if its preamble covers one whole
+ * off and on period plus the normal preamble needed for acquisition, so the
+ * senders have to use a longer "wake-up" preamble (dwmac_tx_set_wakeup()).
+ * Frames with the normal preamble are mostly missed while LPL is on.
+ *
+ * The wake-up preamble length in symbols has to be the same on all devices.
+ */
+#ifndef CONFIG_DECA_LPL_WAKEUP_PLEN
+#define CONFIG_DECA_LPL_WAKEUP_PLEN 384
+#endif
+
+/* RX on time in PACs (min. 2, max. 16) */
+#define DWLPL_ON_PAC 3
+
+_Static_assert(CONFIG_DECA_LPL_WAKEUP_PLEN % 8 == 0
+				   && CONFIG_DECA_LPL_WAKEUP_PLEN >= 64
+				   && CONFIG_DECA_LPL_WAKEUP_PLEN <= 2048,
+			   "CONFIG_DECA_LPL_WAKEUP_PLEN must be a multiple of 8 (64-2048)");
+
+/** Enable or disable LPL on the receiver. RX has to be re-enabled by
+ * dwmac_set_rx_reenable(true) to listen continuously */
+bool dwlpl_enable(bool on);
+bool dwlpl_is_enabled(void);
+/** RX on time per sniff period in per mille, 1000 if LPL is off */
+uint16_t dwlpl_get_duty_permille(void);
+/** Additional latency of a wake-up frame in us */
+uint32_t dwlpl_get_wakeup_latency_us(void);
+
+#endif
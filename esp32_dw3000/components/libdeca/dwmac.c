@@ -17,8 +17,10 @@
 #endif
 
 #include "dwhw.h"
+#include "dwlpl.h"
 #include "dwmac.h"
 #include "dwphy.h"
+#include "dwsec.h"
 #include "dwtime.h"
 #include "dwutil.h"
 #include "mac802154.h"
@@ -30,6 +32,16 @@
 #define SLOT_PROC_TIME	  500		 /* TODO: now used with systime: only TX */
 #define SLOT_GAP		  5
 
+#if CONFIG_DECA_MAX_FRAME_LEN > DWMAC_EXT_FRAME_LEN
+#error "CONFIG_DECA_MAX_FRAME_LEN too large"
+#endif
+
+/* the ESP-IDF SPI port copies header (max 3 bytes) and body into one buffer */
+#if defined(CONFIG_DW3000_SPI_TX_BUF_LEN)                                      \
+	&& CONFIG_DW3000_SPI_TX_BUF_LEN < CONFIG_DECA_MAX_FRAME_LEN + 3
+#error "CONFIG_DW3000_SPI_TX_BUF_LEN too small for CONFIG_DECA_MAX_FRAME_LEN"
+#endif
+
 #ifndef __ZEPHYR__
 static const char* LOG_TAG = "DECA";
 #endif
@@ -42,11 +54,18 @@ static deca_to_cb dwmac_to_cb = NULL;
 static deca_err_cb dwmac_err_cb = NULL;
 static uint32_t mac_tx_cnt = 0;
 static struct txbuf tx_buffer;
+/* part of the DW3000 TX buffer used by the last transmitted frame */
+static uint16_t txb_last_offset;
+static uint16_t txb_last_len;
 
 /* shared with dwmac_irq.c */
 struct rxbuf rx_buffer;
 struct txbuf* current_tx = NULL;
 bool rx_reenable = false;
+bool irq_timing_on = false;
+uint8_t rxdiag_mask = DWPHY_RXDIAG_ALL;
+static uint16_t ack_timeout = 0; // UUS, 0 if auto-ACK is disabled
+struct dwmac_irq_timing irq_timing;
 
 extern void dwmac_irq_rx_ok_cb(const dwt_cb_data_t* dat);
 extern void dwmac_irq_rx_to_cb(const dwt_cb_data_t* dat);
@@ -94,6 +113,10 @@ bool dwmac_init(uint16_t mypanId, uint16_t myAddr, deca_rx_cb rx_cb,
 	/* for 'dwcnt' command */
 	dwt_configeventcounters(1);
 
+#if CONFIG_DECA_READ_RXDIAG
+	dwphy_enable_full_diag();
+#endif
+
 #if DRIVER_VERSION_HEX >= 0x080202
 
 	dwt_setcallbacks(&dwmac_cbs);
@@ -153,6 +176,21 @@ void dwmac_set_frame_filter(void)
 								 | DWT_FF_COORD_EN);
 }
 
+void dwmac_set_auto_ack(bool enable)
+{
+	dwt_enableautoack(DWMAC_ACK_DELAY_SYM, enable);
+
+	if (enable) {
+		/* one preamble symbol is about 1us */
+		uint32_t us = PKTTIME_TO_USEC(
+			dwphy_calc_packet_time(dwphy_get_rate(), dwphy_get_plen(),
+								   dwphy_get_prf(), MAC154_ACK_LEN));
+		ack_timeout = US_TO_UUS(us + DWMAC_ACK_DELAY_SYM + DWMAC_ACK_MARGIN_US);
+	} else {
+		ack_timeout = 0;
+	}
+}
+
 void deca_print_sys_status(uint32_t status)
 {
 #ifdef DRIVER_VERSION_HEX // >= 0x060007
@@ -359,12 +397,19 @@ void dwmac_tx_prepare_null(struct txbuf* tx)
 	tx->resp_multi = false;
 	tx->ranging = false;
 	tx->sleep_after_tx = false;
+	tx->wakeup = false;
 	tx->rx_timeout = 0;
 	tx->txtime = 0;
 	tx->rx_delay = 0;
 	tx->pto = 0;
 	tx->to_cb = NULL;
 	tx->complete_cb = NULL;
+	tx->ack_state = DWMAC_ACK_NONE;
+	tx->ack_seq = 0;
+	tx->ack_retries = 0;
+	tx->ack_cb = NULL;
+	tx->secured = false;
+	tx->preloaded = false;
 }
 
 /* len is without FCS */
@@ -412,6 +457,12 @@ void dwmac_tx_set_sleep_after_tx(struct txbuf* tx)
 	tx->sleep_after_tx = true;
 }
 
+/* send with the long LPL wake-up preamble */
+void dwmac_tx_set_wakeup(struct txbuf* tx)
+{
+	tx->wakeup = true;
+}
+
 void dwmac_tx_set_timeout_handler(struct txbuf* tx, deca_to_cb toh)
 {
 	tx->to_cb = toh;
@@ -422,6 +473,36 @@ void dwmac_tx_set_complete_handler(struct txbuf* tx, deca_tx_complete_cb h)
 	tx->complete_cb = h;
 }
 
+/* Sets the AR bit in the frame control and waits for the ACK with a short RX
+ * timeout. If the ACK is missing the frame is sent again directly from IRQ
+ * context without rewriting the TX buffer. Frames with suppressed sequence
+ * number (long address frames) can't be acknowledged */
+bool dwmac_tx_set_ack_request(struct txbuf* tx, deca_ack_cb cb)
+{
+	uint16_t fc = tx->buf[0] | (tx->buf[1] << 8);
+
+	if (ack_timeout == 0) {
+		LOG_ERR("ACK request needs auto-ACK");
+		return false;
+	}
+
+	if ((fc & MAC154_FC_SEQ_SUPP)
+		|| (fc & MAC154_FC_DST_ADDR_MASK) == MAC154_FC_DST_ADDR_NONE) {
+		LOG_ERR("ACK request needs sequence number and destination");
+		return false;
+	}
+
+	fc |= MAC154_FC_ACK_REQ;
+	tx->buf[0] = fc & 0xff;
+	tx->buf[1] = fc >> 8;
+	tx->ack_state = DWMAC_ACK_WAIT;
+	tx->ack_seq = tx->buf[2];
+	tx->ack_retries = 0;
+	tx->ack_cb = cb;
+	dwmac_tx_set_rx_timeout(tx, ack_timeout);
+	return true;
+}
+
 /* time resolution of tx time is 8ns: given in DTU with last 9 bits 0 */
 void dwmac_tx_set_txtime(struct txbuf* tx, uint64_t time)
 {
@@ -432,25 +513,51 @@ bool dwmac_tx_raw(struct txbuf* tx)
 {
 	int ret;
 
+	if (tx->len > DWMAC_TXBUF_LEN) {
+		LOG_ERR("TX frame too large (%d)", (int)tx->len);
+		return false;
+	}
+
 	decaIrqStatus_t stat = decamutexon();
 
 	/* make sure we're out of RX mode before initiating TX */
 	dwt_forcetrxoff();
 
 	if (tx->sleep_after_tx) {
+		dwhw_warm_sleep();
 		dwhw_enable_tx_interrupt(false);
 		dwt_entersleepaftertx(1);
 	}
 
 	if (tx->len > 0) {
-		ret = dwt_writetxdata(tx->len, tx->buf, 0);
+		uint16_t offset = 0;
+		if (tx->preloaded && tx->preload_cnt == mac_tx_cnt) {
+			/* no other frame has been written since dwmac_tx_preload() */
+			offset = tx->txb_offset;
+			ret = DWT_SUCCESS;
+		}
+#if CONFIG_DECA_FRAME_SECURITY
+		/* secured in the TX buffer by the AES engine */
+		else if (mac154_is_secured(tx->buf[0] | (tx->buf[1] << 8))) {
+			ret = dwsec_write_tx(tx) ? DWT_SUCCESS : DWT_ERROR;
+		}
+#endif
+		else {
+			ret = dwt_writetxdata(tx->len, tx->buf, 0);
+		}
 		if (ret != DWT_SUCCESS) {
+			decamutexoff(stat);
 			return false;
 		}
 		// NOTE: this is not necessary to set if we use STS_MODE_ND
-		dwt_writetxfctrl(tx->len, 0, tx->ranging);
+		dwt_writetxfctrl(tx->len, offset, tx->ranging);
+		txb_last_offset = offset;
+		txb_last_len = tx->len;
 	}
 
+	/* long preamble of wake-up frames, written only when it changes */
+	dwphy_set_tx_plen_fine(tx->wakeup ? CONFIG_DECA_LPL_WAKEUP_PLEN : 0);
+
 	dwt_setrxtimeout(tx->rx_timeout);
 	dwt_setrxaftertxdelay(tx->rx_delay);
 	dwt_setpreambledetecttimeout(tx->pto);
@@ -464,6 +571,17 @@ bool dwmac_tx_raw(struct txbuf* tx)
 		(tx->txtime ? DWT_START_TX_DELAYED : DWT_START_TX_IMMEDIATE)
 		| (tx->resp || rx_reenable ? DWT_RESPONSE_EXPECTED : 0));
 
+#if CONFIG_DECA_STATS
+	/* margin left until TX time, read after starting so the SPI read does
+	 * not use it up. Late TX is counted below */
+	if (tx->txtime && ret == DWT_SUCCESS) {
+		uint64_t margin = (tx->txtime - dw_get_systime()) & DTU_MASK;
+		if (margin < DTU_MASK / 2) {
+			dwstats_hist_add(DWSTATS_TX_MARGIN, DTU_TO_US(margin));
+		}
+	}
+#endif
+
 	decamutexoff(stat);
 
 	// plat_led_act_trigger();
@@ -471,6 +589,7 @@ bool dwmac_tx_raw(struct txbuf* tx)
 	if (ret != DWT_SUCCESS) {
 		LOG_ERR("TX error (%p)", tx);
 		if (tx->txtime) {
+			dwstats_inc(DWSTATS_TX_LATE);
 			uint64_t systime = dw_get_systime();
 			LOG_ERR_TS("\tSYS Time:\t", systime);
 			LOG_ERR_TS("\tTX Time:\t", tx->txtime);
@@ -504,6 +623,27 @@ bool dwmac_tx_raw(struct txbuf* tx)
 	return true;
 }
 
+bool dwmac_tx_preload(struct txbuf* tx)
+{
+	/* the other half of the TX buffer than the last frame */
+	uint16_t offset = txb_last_offset ? 0 : TX_BUFFER_MAX_LEN / 2;
+
+	if (tx->len == 0 || tx->len > TX_BUFFER_MAX_LEN / 2
+		|| (offset > 0 && txb_last_len > offset)
+		|| mac154_is_secured(tx->buf[0] | (tx->buf[1] << 8))) {
+		return false;
+	}
+
+	decaIrqStatus_t stat = decamutexon();
+	int ret = dwt_writetxdata(tx->len, tx->buf, offset);
+	tx->preload_cnt = mac_tx_cnt;
+	decamutexoff(stat);
+
+	tx->txb_offset = offset;
+	tx->preloaded = ret == DWT_SUCCESS;
+	return tx->preloaded;
+}
+
 bool dwmac_transmit(struct txbuf* tx)
 {
 	if (tx == NULL) {
@@ -515,16 +655,56 @@ bool dwmac_transmit(struct txbuf* tx)
 	return dwmac_tx_raw(tx);
 }
 
+/* called for both ACK received and failure after all retries */
+static void dwmac_handle_ack_result(void)
+{
+	struct txbuf* tx = current_tx;
+	if (tx == NULL || tx->ack_state == DWMAC_ACK_WAIT
+		|| tx->ack_state == DWMAC_ACK_NONE) {
+		return;
+	}
+
+	bool ok = tx->ack_state == DWMAC_ACK_OK;
+	deca_ack_cb cb = tx->ack_cb;
+	tx->ack_state = DWMAC_ACK_NONE;
+	current_tx = NULL;
+
+#if CONFIG_DECA_FRAME_SECURITY
+	dwsec_handle_tx_done();
+#endif
+
+	if (cb) {
+		cb(ok);
+	}
+}
+
+/* A retransmission after a lost ACK has the same header as the frame before,
+ * drop it so upper layers don't see it twice */
+static bool dwmac_rx_is_duplicate(const struct rxbuf* rx)
+{
+	static uint8_t last_hdr[MAC154_HDR_CMP_LEN];
+	uint16_t fc = rx->buf[0] | (rx->buf[1] << 8);
+
+	if (!(fc & MAC154_FC_ACK_REQ) || rx->len < sizeof(last_hdr)) {
+		return false;
+	}
+
+	if (memcmp(last_hdr, rx->buf, sizeof(last_hdr)) == 0) {
+		return true;
+	}
+
+	memcpy(last_hdr, rx->buf, sizeof(last_hdr));
+	return false;
+}
+
 void dwmac_handle_rx_frame(const struct rxbuf* rx)
 {
-#if CONFIG_DECA_DEBUG_IRQ_TIME
-	uint64_t st = dw_get_systime();
-	LOG_INF("RX to CB:\t%d us", (int)DTU_TO_US(rx->ts_irq_start - rx->ts));
-	LOG_INF("RX to Sched:\t%d us", (int)DTU_TO_US(st - rx->ts));
-	LOG_INF("Time in CB:\t%d us",
-			(int)DTU_TO_US(rx->ts_irq_end - rx->ts_irq_start));
-	LOG_DBG("IRQ start %" PRIu32, (uint32_t)rx->ts_irq_start);
-	LOG_DBG("IRQ end %" PRIu32, (uint32_t)rx->ts_irq_end);
+	if (irq_timing_on) {
+		irq_timing.task_start = dw_get_systime();
+	}
+
+#if CONFIG_DECA_STATS
+	dwstats_hist_add(DWSTATS_CB_TO_TASK, dwtask_get_time_us() - rx->irq_us);
 #endif
 
 #if CONFIG_DECA_DEBUG_RX_DUMP
@@ -532,7 +712,9 @@ void dwmac_handle_rx_frame(const struct rxbuf* rx)
 #endif
 
 #if CONFIG_DECA_READ_RXDIAG
-	LOG_INF("DIAG preamb %d", rx->diag.rxPreamCount);
+	if (rx->diag.mask & DWPHY_RXDIAG_PREAMBLE) {
+		LOG_INF("DIAG preamb %d", rx->diag.preamble_cnt);
+	}
 #endif
 
 #if CONFIG_DECA_XTAL_TRIM
@@ -541,6 +723,18 @@ void dwmac_handle_rx_frame(const struct rxbuf* rx)
 	}
 #endif
 
+	/* ACKs are matched in IRQ context and not passed up */
+	if (rx->len == MAC154_ACK_LEN
+		&& (rx->buf[0] & MAC154_FC_TYPE_MASK) == MAC154_FC_TYPE_ACK) {
+		dwmac_handle_ack_result();
+		return;
+	}
+
+	if (dwmac_rx_is_duplicate(rx)) {
+		dwstats_inc(DWSTATS_ACK_DUP);
+		return;
+	}
+
 	if (dwmac_rx_cb != NULL) {
 		dwmac_rx_cb(rx);
 	}
@@ -552,6 +746,10 @@ void dwmac_handle_rx_timeout(uint32_t status)
 	deca_print_sys_status(status);
 #endif
 
+	if (current_tx && current_tx->ack_state == DWMAC_ACK_FAIL) {
+		dwmac_handle_ack_result();
+	}
+
 	if (current_tx && current_tx->to_cb != NULL) {
 		current_tx->to_cb(status);
 	}
@@ -575,6 +773,10 @@ void dwmac_handle_tx_done(void)
 		current_tx = NULL;
 	}
 
+#if CONFIG_DECA_FRAME_SECURITY
+	dwsec_handle_tx_done();
+#endif
+
 	if (cb) {
 		cb();
 	}
@@ -644,6 +846,11 @@ void dwmac_set_rx_reenable(bool b)
 	rx_reenable = b;
 }
 
+void dwmac_set_rxdiag(uint8_t mask)
+{
+	rxdiag_mask = mask;
+}
+
 void dwmac_print_event_counters(void)
 {
 	dwt_deviceentcnts_t counters;
@@ -689,6 +896,18 @@ void dwmac_set_mac64(uint64_t mac)
 	dwt_seteui((uint8_t*)&mac64);
 }
 
+/* capture timestamps of each RX IRQ: this costs two additional SPI reads of
+ * the system time per frame, so it's off by default */
+void dwmac_set_irq_timing(bool on)
+{
+	irq_timing_on = on;
+}
+
+const struct dwmac_irq_timing* dwmac_get_irq_timing(void)
+{
+	return &irq_timing;
+}
+
 uint32_t dwmac_get_tx_start_cnt(void)
 {
 	return mac_tx_cnt;
@@ -16,6 +16,10 @@
 
 #include <deca_device_api.h>
 
+#include "dwlog.h"
+#include "dwphy.h"
+#include "dwstats.h"
+
 #if ESP_PLATFORM
 #include <sdkconfig.h>
 #endif
@@ -26,11 +30,29 @@
 #define CONFIG_DECA_USE_CARRIERINTEG 0
 #endif
 
-/* Read the RX diag structure and include it in the RX buffer */
+/* Read the RX diagnostics selected by dwmac_set_rxdiag() and include them in
+ * the RX buffer */
 #ifndef CONFIG_DECA_READ_RXDIAG
 #define CONFIG_DECA_READ_RXDIAG 0
 #endif
 
+/* Read the phase difference of arrival, STS quality and STS timestamp and
+ * include them in the RX buffer. Needs PDoA configured with dwphy_set_pdoa() */
+#ifndef CONFIG_DECA_PDOA
+#define CONFIG_DECA_PDOA 0
+#endif
+
+/* Secure ranging with an STS from a session key (sts.h). Frames with bad STS
+ * quality are marked and the RX timestamp is taken from the STS */
+#ifndef CONFIG_DECA_STS_SECURE
+#define CONFIG_DECA_STS_SECURE 0
+#endif
+
+/* IEEE 802.15.4 frame security with the AES engine of the DW3000 (dwsec.h) */
+#ifndef CONFIG_DECA_FRAME_SECURITY
+#define CONFIG_DECA_FRAME_SECURITY 0
+#endif
+
 /* Perform XTAL trimming, adjusting the local clock to the clock offset of
  * another sender. Careful! This can reduce reception of other senders with a
  * different clock offset! */
@@ -40,10 +62,6 @@
 
 /* Debugging configs */
 
-#ifndef CONFIG_DECA_DEBUG_IRQ_TIME
-#define CONFIG_DECA_DEBUG_IRQ_TIME 0
-#endif
-
 #ifndef CONFIG_DECA_DEBUG_RX_DUMP
 #define CONFIG_DECA_DEBUG_RX_DUMP 0
 #endif
@@ -68,56 +86,113 @@
 #define CONFIG_DECA_DEBUG_OUTPUT_IRQ 0
 #endif
 
-/* Buffer length is optimized for FIRA at the moment */
-#define DWMAC_RXBUF_LEN 70
+/* Maximum frame length including FCS. The default is optimized for FIRA.
+ * Up to 127 bytes is the standard 802.15.4 PHR, longer frames up to 1023
+ * bytes use the non-standard DW3000 extended PHR mode, which then has to be
+ * configured on all devices */
+#ifndef CONFIG_DECA_MAX_FRAME_LEN
+#define CONFIG_DECA_MAX_FRAME_LEN 70
+#endif
 
+#define DWMAC_STD_FRAME_LEN 127
+#define DWMAC_EXT_FRAME_LEN 1023
+#define DWMAC_RXBUF_LEN		CONFIG_DECA_MAX_FRAME_LEN
+#define DWMAC_TXBUF_LEN		CONFIG_DECA_MAX_FRAME_LEN
+
+/* Auto-ACK: delay in preamble symbols before the receiver sends the ACK. 12
+ * is aTurnaroundTime of 802.15.4 and gives the sender time to turn on RX */
+#define DWMAC_ACK_DELAY_SYM 12
+/* ACK wait time in addition to the ACK air time and turnaround */
+#define DWMAC_ACK_MARGIN_US 50
+#define DWMAC_ACK_MAX_RETRY 3
+
+/* Used in the time critical path, so it uses deferred logging if enabled.
+ * Use DWLOG_LADDR_FMT / DWLOG_LADDR_PAR for long addresses */
 #define LOG_TX_RES(_res, ...)                                                  \
 	do {                                                                       \
-		if (res)                                                               \
-			LOG_INF("Sent " __VA_ARGS__);                                      \
+		if (_res)                                                              \
+			DWLOG_INF("Sent " __VA_ARGS__);                                    \
 		else                                                                   \
-			LOG_ERR("Failed to queue " __VA_ARGS__);                           \
+			DWLOG_ERR("Failed to queue " __VA_ARGS__);                         \
 	} while (0)
 
 struct rxbuf {
 	uint8_t buf[DWMAC_RXBUF_LEN];
 	size_t len;
 	uint64_t ts; /* RX timestamp from DW3000 */
-#if CONFIG_DECA_DEBUG_IRQ_TIME
-	uint64_t ts_irq_start; /* IRQ start timestamp */
-	uint64_t ts_irq_end;   /* IRQ end timestamp */
+#if CONFIG_DECA_STATS
+	uint32_t irq_us; /* host time in us at end of RX IRQ */
 #endif
 #if CONFIG_DECA_USE_CARRIERINTEG
 	int32_t ci; /* carrier integrator for clock offset */
 #endif
 #if CONFIG_DECA_READ_RXDIAG
-	dwt_rxdiag_t diag;
+	struct dwphy_rxdiag diag;
+#endif
+#if CONFIG_DECA_PDOA
+	int16_t pdoa; /* radian << 11 */
+#endif
+#if CONFIG_DECA_PDOA || CONFIG_DECA_STS_SECURE
+	bool sts_ok;	 /* STS quality good */
+	uint64_t sts_ts; /* RX timestamp of the STS */
+#endif
+#if CONFIG_DECA_FRAME_SECURITY
+	uint8_t sec_level; /* MAC154_SEC_LVL_* the frame was secured with */
 #endif
 };
 
+/* timestamps (DTU) of the last received frame, for benchmarking */
+struct dwmac_irq_timing {
+	uint64_t rx_ts;		 /* RX timestamp from DW3000 */
+	uint64_t irq_start;	 /* RX callback entered */
+	uint64_t irq_end;	 /* RX callback finished */
+	uint64_t task_start; /* frame handling started in task context */
+};
+
 typedef void (*deca_to_cb)(uint32_t status);
 typedef void (*deca_err_cb)(uint32_t status);
 typedef void (*deca_rx_cb)(const struct rxbuf* buf);
 typedef void (*deca_tx_complete_cb)(void);
+typedef void (*deca_ack_cb)(bool acked);
+
+enum dwmac_ack_e {
+	DWMAC_ACK_NONE, // no ACK requested
+	DWMAC_ACK_WAIT, // waiting for ACK
+	DWMAC_ACK_OK,	// ACK received
+	DWMAC_ACK_FAIL, // no ACK after all retries
+};
 
 struct txbuf {
-	uint8_t buf[DWMAC_RXBUF_LEN];
+	uint8_t buf[DWMAC_TXBUF_LEN];
 	size_t len;
 	bool resp;			 // response expected
 	bool resp_multi;	 // multiple responses expected
 	bool ranging;		 // ranging
 	bool sleep_after_tx; // goto sleep after TX
+	bool wakeup;		 // long preamble to wake up LPL receivers
 	uint16_t rx_timeout; // RX timeout
 	uint64_t txtime;	 // DTU
 	uint32_t rx_delay;	 // RX after TX delay in UUS
 	uint16_t pto;		 // preamble detect timeout in PAC (+1)
 	deca_to_cb to_cb;
 	deca_tx_complete_cb complete_cb;
+	uint8_t ack_state;	 // enum dwmac_ack_e, updated in IRQ context
+	uint8_t ack_seq;	 // sequence number of frame
+	uint8_t ack_retries; // retransmissions done
+	deca_ack_cb ack_cb;
+	bool secured; // auxiliary security header inserted (dwsec.h)
+	bool preloaded;		  // written by dwmac_tx_preload()
+	uint16_t txb_offset;  // offset in the TX buffer of the DW3000
+	uint32_t preload_cnt; // TX count at preload
 };
 
 bool dwmac_init(uint16_t mypanId, uint16_t myAddr, deca_rx_cb rx_cb,
 				deca_to_cb to_cb, deca_err_cb err_cb);
 void dwmac_set_frame_filter(void);
+/** Enable sending ACKs automatically for received frames with AR bit set.
+ * Needs the frame filter. Also required on the sender to know the ACK
+ * timeout */
+void dwmac_set_auto_ack(bool enable);
 void dwmac_set_mac64(uint64_t mac);
 
 /* TX buffers */
@@ -132,14 +207,26 @@ void dwmac_tx_expect_multiple_responses(struct txbuf* tx);
 void dwmac_tx_set_rx_timeout(struct txbuf* tx, uint16_t to);
 void dwmac_tx_set_preamble_timeout(struct txbuf* tx, uint16_t pto);
 void dwmac_tx_set_sleep_after_tx(struct txbuf* tx);
+void dwmac_tx_set_wakeup(struct txbuf* tx);
 void dwmac_tx_set_timeout_handler(struct txbuf* tx, deca_to_cb toh);
 void dwmac_tx_set_complete_handler(struct txbuf* tx, void (*h)(void));
+/** Request ACK for prepared frame, retransmit on timeout. cb is called instead
+ * of the complete handler. Only for frames with sequence number */
+bool dwmac_tx_set_ack_request(struct txbuf* tx, deca_ack_cb cb);
 bool dwmac_transmit(struct txbuf* tx);
+/** Write a prepared frame to the part of the DW3000 TX buffer which is not
+ * used by the last transmitted frame, while that may still be on air. The
+ * next dwmac_transmit() of it then only has to start TX. Not for secured
+ * frames or frames longer than half the TX buffer */
+bool dwmac_tx_preload(struct txbuf* tx);
 
 void dwmac_cleanup_sleep_after_tx(void);
 
 void dwmac_rx_reenable(void);
 void dwmac_set_rx_reenable(bool b);
+/** Fields of the RX diagnostics (DWPHY_RXDIAG_*) read for each received frame
+ * with CONFIG_DECA_READ_RXDIAG. Default is all */
+void dwmac_set_rxdiag(uint8_t mask);
 
 void deca_print_sys_status(uint32_t status);
 void dwmac_print_event_counters(void);
@@ -152,6 +239,8 @@ uint64_t dwmac_get_mac64(void);
 int dwmac_get_slot_us(size_t pkt_len, int slot_num);
 
 /* statistics */
+void dwmac_set_irq_timing(bool on);
+const struct dwmac_irq_timing* dwmac_get_irq_timing(void);
 uint32_t dwmac_get_tx_start_cnt(void);
 uint32_t dwmac_get_tx_done_cnt(void); // dwmac_irq.c
 
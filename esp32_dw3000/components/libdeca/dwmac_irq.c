@@ -12,15 +12,30 @@
 #include <deca_device_api.h>
 #include <deca_version.h>
 
+#include "cir.h"
 #include "dwmac.h"
+#include "dwphy.h"
+#include "dwsec.h"
 #include "dwtime.h"
 #include "log.h"
 #include "mac802154.h"
+#include "sts.h"
 #include "platform/dwmac_task.h"
 
 extern struct rxbuf rx_buffer;
 extern struct txbuf* current_tx;
 extern bool rx_reenable;
+extern bool irq_timing_on;
+extern uint8_t rxdiag_mask;
+extern struct dwmac_irq_timing irq_timing;
+
+#ifdef DRIVER_VERSION_HEX // >= 0x060007
+#define DWMAC_STATUS_AAT	 DWT_INT_AAT_BIT_MASK
+#define DWMAC_STATUS_SPIRDY DWT_INT_SPIRDY_BIT_MASK
+#else
+#define DWMAC_STATUS_AAT	 0x8	  /* SYS_STATUS_AAT */
+#define DWMAC_STATUS_SPIRDY 0x800000 /* SYS_STATUS_SPIRDY */
+#endif
 
 #ifndef __ZEPHYR__
 static const char* LOG_TAG = "DECA";
@@ -29,6 +44,51 @@ static uint32_t tx_done_cnt = 0;
 
 /*** all these functions are called from dwt_isr() in interrupt context ***/
 
+static void dwmac_queue_event(enum dwevent_e type, const void* data)
+{
+	if (dwtask_queue_event(type, data) != 0) {
+		dwstats_inc(DWSTATS_QUEUE_OVERRUN);
+	}
+}
+
+static bool dwmac_is_waiting_for_ack(void)
+{
+	return current_tx != NULL && current_tx->ack_state == DWMAC_ACK_WAIT;
+}
+
+/* RX on again, or after the rest of a CIR capture is read in the task */
+static void dwmac_irq_rx_enable(bool on, bool cir_hold)
+{
+	if (cir_hold) {
+		cir_finish_rx(on);
+	} else if (on) {
+		dwt_rxenable(DWT_START_RX_IMMEDIATE);
+	}
+}
+
+/* The frame is still in the TX buffer of the DW3000, so a retransmission is
+ * only a TX start command */
+static bool dwmac_ack_retransmit(void)
+{
+	if (current_tx->ack_retries >= DWMAC_ACK_MAX_RETRY) {
+		current_tx->ack_state = DWMAC_ACK_FAIL;
+		dwstats_inc(DWSTATS_ACK_FAIL);
+		return false;
+	}
+
+	current_tx->ack_retries++;
+	dwt_setrxtimeout(current_tx->rx_timeout);
+	if (dwt_starttx(DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED)
+		!= DWT_SUCCESS) {
+		current_tx->ack_state = DWMAC_ACK_FAIL;
+		dwstats_inc(DWSTATS_ACK_FAIL);
+		return false;
+	}
+
+	dwstats_inc(DWSTATS_ACK_RETRY);
+	return true;
+}
+
 void dwmac_irq_rx_ok_cb(const dwt_cb_data_t* status)
 {
 	DBG_UWB_IRQ("*** RX 0x%" PRIx32 " flags 0x%x", status->status,
@@ -36,9 +96,17 @@ void dwmac_irq_rx_ok_cb(const dwt_cb_data_t* status)
 
 	struct rxbuf* rx = &rx_buffer;
 
-#if CONFIG_DECA_DEBUG_IRQ_TIME
-	rx->ts_irq_start = dw_get_systime();
+	/* the IRQ latency needs an SPI read, so the statistics only sample it */
+	bool rx_lat = irq_timing_on;
+#if CONFIG_DECA_STATS
+	static uint8_t rx_lat_cnt;
+	rx_lat = rx_lat || rx_lat_cnt++ % DWSTATS_RX_TO_CB_SAMPLE == 0;
 #endif
+	uint64_t irq_start = rx_lat ? dw_get_systime() : 0;
+
+	if (irq_timing_on) {
+		irq_timing.irq_start = irq_start;
+	}
 
 	if (current_tx != NULL && current_tx->pto != 0) {
 		/* sometimes PTO triggers even though we just received a frame.
@@ -49,6 +117,10 @@ void dwmac_irq_rx_ok_cb(const dwt_cb_data_t* status)
 
 	if (status->datalength > DWMAC_RXBUF_LEN) {
 		LOG_ERR_IRQ("Received frame too large");
+		dwstats_inc(DWSTATS_RX_DROP_LEN);
+#if CONFIG_DECA_STS_SECURE
+		sts_handle_rx();
+#endif
 		if (rx_reenable) {
 			dwt_rxenable(DWT_START_RX_IMMEDIATE);
 		}
@@ -63,51 +135,118 @@ void dwmac_irq_rx_ok_cb(const dwt_cb_data_t* status)
 		dwt_readrxdata(rx->buf, status->datalength, 0);
 	}
 
-	if (status->rx_flags & DWT_CB_DATA_RX_FLAG_CPER) {
+	/* without an STS configured (no session or PDoA yet) there is nothing to
+	 * check and the frame has no good STS */
+	bool sts_on = (dwphy_get_sts_mode() & DWT_STS_CONFIG_MASK)
+				  != DWT_STS_MODE_OFF;
+	bool sts_ok = sts_on;
+	if (sts_on && status->rx_flags & DWT_CB_DATA_RX_FLAG_CPER) {
 		uint16_t stat;
 		dwt_readstsstatus(&stat, 0);
+		/* 0x100 is only the "peak growth rate" warning */
 		if (stat & ~0x100) {
-			// TODO: Don't log status "Peak growth rate warning"
 			LOG_ERR_IRQ("STS error STS_TOAST: %x", stat);
+			sts_ok = false;
 		}
-		// TODO: handle error
-	} else if (status->rx_flags & DWT_CB_DATA_RX_FLAG_ND) {
-		// TODO: STS can also be used with data frames
+	}
+	if (sts_ok
+		&& (status->rx_flags & DWT_CB_DATA_RX_FLAG_ND || CONFIG_DECA_STS_SECURE
+			|| CONFIG_DECA_PDOA)) {
 		int16_t stsq;
 #if DRIVER_VERSION_HEX >= 0x080202
-		int sts_ok = dwt_readstsquality(&stsq, 0);
+		sts_ok = dwt_readstsquality(&stsq, 0) >= 0;
 #else
-		int sts_ok = dwt_readstsquality(&stsq);
+		sts_ok = dwt_readstsquality(&stsq) >= 0;
 #endif
 		if (!sts_ok) {
 			LOG_ERR_IRQ("STS Qual not good %d", stsq);
-			// TODO: handle error
 		}
 	}
+	if (sts_on && !sts_ok) {
+		dwstats_inc(DWSTATS_RX_STS_BAD);
+	}
+
+#if CONFIG_DECA_PDOA || CONFIG_DECA_STS_SECURE
+	uint8_t sts_ts[5];
+	dwt_readrxtimestamp_sts(sts_ts);
+	rx->sts_ts = dw_timestamp_u64(sts_ts);
+	rx->sts_ok = sts_ok;
+#endif
+
+#if CONFIG_DECA_STS_SECURE
+	/* the STS can not be predicted by an attacker like the preamble */
+	if (sts_on) {
+		rx->ts = rx->sts_ts;
+	}
+	sts_handle_rx();
+#endif
 
 #if CONFIG_DECA_USE_CARRIERINTEG
 	rx->ci = dwt_readcarrierintegrator();
 #endif
 
 #if CONFIG_DECA_READ_RXDIAG
-	dwt_readdiagnostics(&rx->diag);
+	dwphy_read_rxdiag(&rx->diag, rxdiag_mask);
 #endif
 
-	if (rx_reenable || rx->buf[0] & MAC154_FC_FRAME_PEND
-		|| (current_tx != NULL && current_tx->resp_multi)) {
-		dwt_rxenable(DWT_START_RX_IMMEDIATE);
+#if CONFIG_DECA_PDOA
+	rx->pdoa = dwt_readpdoa();
+#endif
+
+	/* before RX is enabled again and overwrites the accumulator */
+	bool cir_hold = cir_handle_rx(rx->ts);
+
+#if CONFIG_DECA_FRAME_SECURITY
+	/* verified and decrypted in the RX buffer, before RX is enabled again */
+	if (!dwsec_handle_rx(rx)) {
+		LOG_ERR_IRQ("Frame security check failed");
+		dwstats_inc(DWSTATS_RX_SEC_BAD);
+		dwmac_irq_rx_enable(rx_reenable
+								|| (current_tx != NULL && current_tx->resp_multi)
+								|| dwmac_is_waiting_for_ack(),
+							cir_hold);
+		return;
 	}
+#endif
 
-#if CONFIG_DECA_DEBUG_IRQ_TIME
-	rx->ts_irq_end = dw_get_systime();
+	bool ack_wait = dwmac_is_waiting_for_ack();
+	if (ack_wait && rx->len == MAC154_ACK_LEN
+		&& (rx->buf[0] & MAC154_FC_TYPE_MASK) == MAC154_FC_TYPE_ACK
+		&& rx->buf[2] == current_tx->ack_seq) {
+		current_tx->ack_state = DWMAC_ACK_OK;
+		dwt_setrxtimeout(0);
+		dwstats_inc(DWSTATS_ACK_OK);
+		ack_wait = false;
+	}
+
+	/* while the DW3000 sends an auto-ACK RX is enabled after TX done */
+	dwmac_irq_rx_enable(!(status->status & DWMAC_STATUS_AAT)
+							&& (rx_reenable || rx->buf[0] & MAC154_FC_FRAME_PEND
+								|| (current_tx != NULL && current_tx->resp_multi)
+								|| ack_wait),
+						cir_hold);
+
+#if CONFIG_DECA_STATS
+	dwstats_inc(DWSTATS_RX_FRAMES);
+	if (rx_lat) {
+		dwstats_hist_add(DWSTATS_RX_TO_CB,
+						 DTU_TO_US((irq_start - rx->ts) & DTU_MASK));
+	}
+	rx->irq_us = dwtask_get_time_us();
 #endif
 
-	dwtask_queue_event(DWEVT_RX, rx);
+	if (irq_timing_on) {
+		irq_timing.rx_ts = rx->ts;
+		irq_timing.irq_end = dw_get_systime();
+	}
+
+	dwmac_queue_event(DWEVT_RX, rx);
 }
 
 void dwmac_irq_rx_to_cb(const dwt_cb_data_t* dat)
 {
 	DBG_UWB_IRQ("*** RX TO 0x%" PRIx32, dat->status);
+	dwstats_inc(DWSTATS_RX_TIMEOUT);
 
 	/* reset timeout values to zero, if not they keep triggering */
 #ifdef DRIVER_VERSION_HEX // >= 0x060007
@@ -126,7 +265,15 @@ void dwmac_irq_rx_to_cb(const dwt_cb_data_t* dat)
 	}
 #endif
 
-	dwtask_queue_event(DWEVT_RX_TIMEOUT, &dat->status);
+	if (dwmac_is_waiting_for_ack() && dwmac_ack_retransmit()) {
+		return;
+	}
+
+#if CONFIG_DECA_STS_SECURE
+	sts_handle_rx();
+#endif
+
+	dwmac_queue_event(DWEVT_RX_TIMEOUT, &dat->status);
 
 	if (rx_reenable || (current_tx != NULL && current_tx->resp_multi)) {
 		dwt_rxenable(DWT_START_RX_IMMEDIATE);
@@ -136,18 +283,33 @@ void dwmac_irq_rx_to_cb(const dwt_cb_data_t* dat)
 void dwmac_irq_err_cb(const dwt_cb_data_t* dat)
 {
 	DBG_UWB_IRQ("*** ERR 0x%x 0x%" PRIx32, dat->rx_flags, dat->status);
+	dwstats_inc(DWSTATS_RX_ERR);
+#ifdef DRIVER_VERSION_HEX // >= 0x060007
+	if (dat->status & DWT_INT_RXOVRR_BIT_MASK) {
+		dwstats_inc(DWSTATS_RX_OVERRUN);
+	}
+#endif
+
+	/* a corrupted ACK counts as missing */
+	if (dwmac_is_waiting_for_ack() && dwmac_ack_retransmit()) {
+		return;
+	}
+
+#if CONFIG_DECA_STS_SECURE
+	sts_handle_rx();
+#endif
 
 	if (rx_reenable || (current_tx != NULL && current_tx->resp_multi)) {
 		dwt_rxenable(DWT_START_RX_IMMEDIATE);
 	}
 
-	dwtask_queue_event(DWEVT_ERR, &dat->status);
+	dwmac_queue_event(DWEVT_ERR, &dat->status);
 
 	/* in case we are waiting for a timeout, also queue a RX_TIMEOUT event (!)
 	 * so the timeout handlers are called. */
 	if (current_tx != NULL
 		&& (current_tx->rx_timeout != 0 || current_tx->pto != 0)) {
-		dwtask_queue_event(DWEVT_RX_TIMEOUT, &dat->status);
+		dwmac_queue_event(DWEVT_RX_TIMEOUT, &dat->status);
 	}
 }
 
@@ -156,11 +318,25 @@ void dwmac_irq_tx_done_cb(const dwt_cb_data_t* dat)
 	DBG_UWB_IRQ("*** TX Done 0x%" PRIx32, dat->status);
 	tx_done_cnt++;
 
-	if (current_tx == NULL) {
+#if CONFIG_DECA_STS_SECURE
+	sts_handle_tx();
+#endif
+
+	if (dat->status & DWMAC_STATUS_AAT) {
+		/* auto-ACK sent, not our frame */
+		dwstats_inc(DWSTATS_ACK_SENT);
+		if (rx_reenable) {
+			dwt_rxenable(DWT_START_RX_IMMEDIATE);
+		}
+		return;
+	}
+
+	/* for frames with ACK request only the ACK result is reported */
+	if (current_tx == NULL || current_tx->ack_state != DWMAC_ACK_NONE) {
 		return;
 	}
 
-	dwtask_queue_event(DWEVT_TX_DONE, NULL);
+	dwmac_queue_event(DWEVT_TX_DONE, NULL);
 }
 
 void dwmac_irq_spi_err_cb(const dwt_cb_data_t* dat)
@@ -170,11 +346,14 @@ void dwmac_irq_spi_err_cb(const dwt_cb_data_t* dat)
 
 void dwmac_irq_spi_rdy_cb(const dwt_cb_data_t* dat)
 {
-	LOG_INF_IRQ("*** SPI RDY");
-	// dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_SPIRDY_BIT_MASK);
+	DBG_UWB_IRQ("*** SPI RDY");
+	/* only enabled for waking up from sleep by the sleep counter */
+	if (dat->status & DWMAC_STATUS_SPIRDY) {
+		dwmac_queue_event(DWEVT_SPI_RDY, NULL);
+	}
 }
 
-uint32_t dwmac_get_tx_irq_cnt(void)
+uint32_t dwmac_get_tx_done_cnt(void)
 {
 	return tx_done_cnt;
 }
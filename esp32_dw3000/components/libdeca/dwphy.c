@@ -9,14 +9,25 @@
 
 #include <stdlib.h> // abs
 
+#ifdef ESP_PLATFORM
+#include <sdkconfig.h>
+#endif
+
 #include <deca_device_api.h>
+#include <deca_private.h>
 #include <deca_version.h>
 #ifdef DW3000_DRIVER_VERSION // == 0x040000
 #include <deca_regs.h>
+#elif CONFIG_DW3000_CHIP_DW3720
+#include <dw3720/dw3720_deca_regs.h>
+#else
+#include <dw3000/dw3000_deca_regs.h>
 #endif
 
+#include "dwhw.h"
 #include "dwphy.h"
 #include "dwproto.h"
+#include "platform/dwstore.h"
 
 #include "log.h"
 #define DWPHY_PRF			DWT_PRF_64M
@@ -44,6 +55,12 @@ static dwt_config_t config = {
 	.pdoaMode = DWT_PDOA_M0 /* off */
 };
 #else
+#if DWMAC_RXBUF_LEN > DWMAC_STD_FRAME_LEN
+#define DWPHY_PHRMODE DWT_PHRMODE_EXT
+#else
+#define DWPHY_PHRMODE DWT_PHRMODE_STD
+#endif
+
 // default config
 static dwt_config_t config = {
 	.chan = 9,
@@ -53,7 +70,7 @@ static dwt_config_t config = {
 	.rxCode = 11,
 	.sfdType = DWT_SFD_IEEE_4Z,
 	.dataRate = DWT_BR_6M8,
-	.phrMode = DWT_PHRMODE_STD,
+	.phrMode = DWPHY_PHRMODE,
 	.phrRate = DWT_PHRRATE_STD,
 	.sfdTO = (64 + 1 + 8 - 8),	 /* (plen + 1 + SFD length - PAC size) */
 	.stsMode = DWT_STS_MODE_OFF, // DWT_STS_MODE_1 | DWT_STS_MODE_SDC,
@@ -80,6 +97,26 @@ dwt_txconfig_t txconfig_ch9 = {
 	0x0			/* PG count */
 };
 
+static uint16_t antd_cal;	// calibrated antenna delay
+static int16_t antd_offset; // e.g. for temperature
+static bool full_diag;
+static uint8_t plen_fine; // FINE_PLEN as last written
+
+static void dwphy_apply_antenna_delay(void)
+{
+	uint16_t antd = antd_cal + antd_offset;
+	dwt_setrxantennadelay(antd);
+	dwt_settxantennadelay(antd);
+	/* also after each dwphy_config() */
+	dwhw_warm_save();
+}
+
+/* FINE_PLEN as dwt_configure() writes it: 4096 is set by TXPSR instead */
+static uint8_t dwphy_plen_fine_config(void)
+{
+	return config.txPreambLength == DWT_PLEN_4096 ? 0 : config.txPreambLength;
+}
+
 static uint8_t phy_get_recommended_pac(uint16_t plen)
 {
 	/* TODO: check following comment from forum "with a preamble length 256
@@ -179,14 +216,19 @@ bool dwphy_config(void)
 	}
 
 	dwt_configure(&config);
+	plen_fine = dwphy_plen_fine_config();
 	if (config.chan == 9) {
 		dwt_configuretxrf(&txconfig_ch9);
 	} else {
 		dwt_configuretxrf(&txconfig_ch5);
 	}
 
-	dwt_setrxantennadelay(0);
-	dwt_settxantennadelay(0);
+	if (full_diag) {
+		dwt_configciadiag(DW_CIA_DIAG_LOG_ALL);
+	}
+
+	/* calibrated antenna delay and offset survive a new configuration */
+	dwphy_apply_antenna_delay();
 
 	/* activate this for RX/TX timing debugging via GPIO5/6 */
 	// dwt_setfinegraintxseq(0);
@@ -197,8 +239,41 @@ bool dwphy_config(void)
 
 void dwphy_set_antenna_delay(uint16_t antdelay)
 {
-	dwt_setrxantennadelay(antdelay);
-	dwt_settxantennadelay(antdelay);
+	antd_cal = antdelay;
+	dwphy_apply_antenna_delay();
+}
+
+uint16_t dwphy_get_antenna_delay(void)
+{
+	/* not set since reset, e.g. kept by the DW3000 over a warm start */
+	return antd_cal ? antd_cal : dwt_gettxantennadelay() - antd_offset;
+}
+
+void dwphy_set_antenna_delay_offset(int16_t offset)
+{
+	antd_cal = dwphy_get_antenna_delay();
+	antd_offset = offset;
+	dwphy_apply_antenna_delay();
+}
+
+/* Set the calibrated antenna delay of this device from persistent storage,
+ * or def if there is none */
+uint16_t dwphy_load_antenna_delay(uint16_t def)
+{
+	uint16_t antd;
+
+	if (dwstore_read(DWPHY_ANTD_KEY, &antd, sizeof(antd)) && antd != 0) {
+		LOG_INF("Calibrated antenna delay %d", antd);
+	} else {
+		antd = def;
+	}
+	dwphy_set_antenna_delay(antd);
+	return antd;
+}
+
+bool dwphy_store_antenna_delay(uint16_t antdelay)
+{
+	return dwstore_write(DWPHY_ANTD_KEY, &antdelay, sizeof(antdelay));
 }
 
 const char* dwphy_rate_str(uint8_t br)
@@ -283,20 +358,26 @@ int dwphy_prf_int(uint8_t prf)
 	return -1;
 }
 
+/** returns time of a number of preamble symbols in picoseconds / 10 */
+uint32_t dwphy_calc_symbols_time(int symbols, uint8_t prf_dwt)
+{
+	/* preamble symbol duration in ns from User Manual:
+	 * PRF 16MHz: 993.59, PRF 64MHz: 1017.63 */
+	if (prf_dwt == DWT_PRF_16M) {
+		return symbols * 99359;
+	} else {
+		return symbols * 101763;
+	}
+}
+
 /** returns time of synchronization header SHR (preamble + SFD) in picoseconds /
  * 10 */
 uint32_t dwphy_calc_preamble_time(uint8_t plen_dwt, uint8_t prf_dwt,
 								  uint8_t rate_dwt)
 {
-	/* preamble symbol duration in ns from User Manual:
-	 * PRF 16MHz: 993.59, PRF 64MHz: 1017.63 */
 	uint32_t plen = dwphy_plen_int(plen_dwt);
 	plen += phy_sfd_len(rate_dwt, false);
-	if (prf_dwt == DWT_PRF_16M) {
-		return plen * 99359;
-	} else {
-		return plen * 101763;
-	}
+	return dwphy_calc_symbols_time(plen, prf_dwt);
 }
 
 /** returns time of SFD (it is included in preamble time) in picoseconds / 10 */
@@ -346,12 +427,23 @@ uint32_t dwphy_calc_phyhdr_time(uint8_t rate_dwt)
 	return 21 * 102564;
 }
 
+/** returns time of the STS of the current config (including the gap) in
+ * picoseconds / 10 */
+uint32_t dwphy_calc_sts_time(void)
+{
+	if ((config.stsMode & DWT_STS_CONFIG_MASK) == DWT_STS_MODE_OFF) {
+		return 0;
+	}
+	/* STS length in blocks of 512 chips, 1.0256us */
+	return ((32 << config.stsLength) + 1) * 102564;
+}
+
 /** returns time of complete frame time in picoseconds / 10 */
 uint64_t dwphy_calc_packet_time(uint8_t rate_dwt, uint8_t plen_dwt,
 								uint8_t prf_dwt, int data_len)
 {
 	return dwphy_calc_preamble_time(plen_dwt, prf_dwt, rate_dwt)
-		   + dwphy_calc_phyhdr_time(rate_dwt)
+		   + dwphy_calc_sts_time() + dwphy_calc_phyhdr_time(rate_dwt)
 		   + dwphy_calc_data_time(rate_dwt, data_len);
 }
 
@@ -484,11 +576,167 @@ void dwphy_xtal_trim(void)
 		if (tmp == 0 || tmp != xtalTrim) {
 			xtalTrim = tmp;
 			dwt_setxtaltrim(xtalTrim);
+			dwhw_warm_save();
 			// LOG_INF("Set XTAL trim %d", xtalTrim);
 		}
 	}
 }
 
+uint8_t dwphy_nlos_likelihood(float rx_pwr, float fp_pwr)
+{
+	float diff = rx_pwr - fp_pwr;
+
+	if (diff <= DWPHY_NLOS_LOS_DB) {
+		return 0;
+	} else if (diff >= DWPHY_NLOS_NLOS_DB) {
+		return 100;
+	}
+	return 100 * (diff - DWPHY_NLOS_LOS_DB)
+		   / (DWPHY_NLOS_NLOS_DB - DWPHY_NLOS_LOS_DB);
+}
+
+/* The driver API has no selective read of the CIA results, they are read
+ * by offset from IP_TOA_LO, the start of the CIA results */
+#define DWPHY_CIA(reg)		 ((reg) - IP_TOA_LO_ID)
+#define DWPHY_IP_DIAG_END	 (DWPHY_CIA(IP_DIAG_12_ID) + 2)
+/* read over gaps up to this size instead of starting a new SPI transfer */
+#define DWPHY_RXDIAG_MAX_GAP 16
+
+/* register ranges in the CIA results, ordered by offset */
+static const struct {
+	uint8_t fields;
+	uint8_t off;
+	uint8_t len;
+} dwphy_rxdiag_regs[] = {
+	{DWPHY_RXDIAG_PEAK, DWPHY_CIA(IP_DIAG_0_ID), 4},
+	{DWPHY_RXDIAG_POWER, DWPHY_CIA(IP_DIAG_1_ID), 4},
+	{DWPHY_RXDIAG_FP_AMPL, DWPHY_CIA(IP_DIAG_2_ID), 12}, // IP_DIAG_2..4
+	{DWPHY_RXDIAG_FP_INDEX, DWPHY_CIA(IP_DIAG_8_ID), 2},
+	{DWPHY_RXDIAG_POWER | DWPHY_RXDIAG_FP_AMPL, DWPHY_CIA(IP_DIAG_12_ID), 2},
+};
+
+#define DWPHY_RXDIAG_REGS                                                      \
+	(sizeof(dwphy_rxdiag_regs) / sizeof(dwphy_rxdiag_regs[0]))
+
+static uint32_t dwphy_le32(const uint8_t* b)
+{
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint16_t dwphy_le16(const uint8_t* b)
+{
+	return b[0] | (b[1] << 8);
+}
+
+/* The CIA writes the diagnostic registers (IP_DIAG_*) only when it logs all
+ * of them, otherwise they read 0. This takes a bit longer for each frame, so
+ * it is only enabled for the users of the diagnostics */
+void dwphy_enable_full_diag(void)
+{
+	if (full_diag) {
+		return;
+	}
+	full_diag = true;
+	dwt_configciadiag(DW_CIA_DIAG_LOG_ALL);
+}
+
+void dwphy_read_rxdiag(struct dwphy_rxdiag* d, uint8_t mask)
+{
+	uint8_t buf[DWPHY_IP_DIAG_END];
+	int start = -1;
+	int end = 0;
+
+	for (size_t i = 0; i < DWPHY_RXDIAG_REGS; i++) {
+		if (!(dwphy_rxdiag_regs[i].fields & mask)) {
+			continue;
+		}
+		int off = dwphy_rxdiag_regs[i].off;
+		if (start >= 0 && off > end + DWPHY_RXDIAG_MAX_GAP) {
+			dwt_readfromdevice(IP_TOA_LO_ID, start, end - start,
+							   &buf[start]);
+			start = -1;
+		}
+		if (start < 0) {
+			start = off;
+		}
+		end = off + dwphy_rxdiag_regs[i].len;
+	}
+	if (start >= 0) {
+		dwt_readfromdevice(IP_TOA_LO_ID, start, end - start,
+						   &buf[start]);
+	}
+
+	d->mask = mask & DWPHY_RXDIAG_ALL;
+
+	if (mask & DWPHY_RXDIAG_PEAK) {
+		uint32_t v = dwphy_le32(&buf[DWPHY_CIA(IP_DIAG_0_ID)]);
+		/* the amplitude is below the location */
+		d->peak_ampl = v & ((1UL << IP_DIAG_0_PEAKLOC_BIT_OFFSET) - 1);
+		d->peak_index = (v & IP_DIAG_0_PEAKLOC_BIT_MASK)
+						>> IP_DIAG_0_PEAKLOC_BIT_OFFSET;
+	}
+	if (mask & DWPHY_RXDIAG_POWER) {
+		/* the width of the channel area differs between DW3000 and DW3720 */
+		d->power = dwphy_le32(&buf[DWPHY_CIA(IP_DIAG_1_ID)])
+				   & IP_DIAG_1_IPCHANNELAREA_BIT_MASK;
+	}
+	if (mask & DWPHY_RXDIAG_FP_AMPL) {
+		d->f1 = dwphy_le32(&buf[DWPHY_CIA(IP_DIAG_2_ID)])
+				& IP_DIAG_2_IPF1_BIT_MASK;
+		d->f2 = dwphy_le32(&buf[DWPHY_CIA(IP_DIAG_3_ID)])
+				& IP_DIAG_3_IPF2_BIT_MASK;
+		d->f3 = dwphy_le32(&buf[DWPHY_CIA(IP_DIAG_4_ID)])
+				& IP_DIAG_4_IPF3_BIT_MASK;
+	}
+	if (mask & DWPHY_RXDIAG_FP_INDEX) {
+		d->fp_index = dwphy_le16(&buf[DWPHY_CIA(IP_DIAG_8_ID)])
+					  & IP_DIAG_8_IPFPLOC_BIT_MASK;
+	}
+	if (mask & (DWPHY_RXDIAG_POWER | DWPHY_RXDIAG_FP_AMPL)) {
+		d->accum_count = dwphy_le16(&buf[DWPHY_CIA(IP_DIAG_12_ID)])
+						 & IP_DIAG_12_IPNACC_BIT_MASK;
+	}
+	if (mask & DWPHY_RXDIAG_PREAMBLE) {
+		dwt_readfromdevice(RX_FINFO_ID, 0, 4, buf);
+		d->preamble_cnt = (dwphy_le32(buf) & RX_FINFO_RXPACC_BIT_MASK)
+						  >> RX_FINFO_RXPACC_BIT_OFFSET;
+	}
+}
+
+bool dwphy_read_rx_quality(struct dwphy_rx_quality* q)
+{
+	struct dwphy_rxdiag d;
+	dwt_cirdiags_t diag = {0};
+	int16_t rx_pwr;
+	int16_t fp_pwr;
+
+	dwphy_read_rxdiag(&d, DWPHY_RXDIAG_POWER | DWPHY_RXDIAG_FP_AMPL);
+	diag.power = d.power;
+	diag.F1 = d.f1;
+	diag.F2 = d.f2;
+	diag.F3 = d.f3;
+	diag.accumCount = d.accum_count;
+
+	if (dwt_calculate_rssi(&diag, DWT_ACC_IDX_IP_M, &rx_pwr) != DWT_SUCCESS
+		|| dwt_calculate_first_path_power(&diag, DWT_ACC_IDX_IP_M, &fp_pwr)
+			   != DWT_SUCCESS) {
+		return false;
+	}
+
+	/* Q8.8 */
+	q->rx_pwr = rx_pwr / 256.0f;
+	q->fp_pwr = fp_pwr / 256.0f;
+	q->clock_offset = (float)dwt_readclockoffset() * CLOCK_OFFSET_PPM_TO_RATIO
+					  * 1e6f;
+	q->nlos = dwphy_nlos_likelihood(q->rx_pwr, q->fp_pwr);
+	return true;
+}
+
+uint8_t dwphy_get_channel(void)
+{
+	return config.chan;
+}
+
 void dwphy_set_rate(uint8_t br)
 {
 	config.dataRate = br;
@@ -509,7 +757,90 @@ uint8_t dwphy_get_plen(void)
 	return config.txPreambLength;
 }
 
+void dwphy_set_tx_plen_fine(uint16_t symbols)
+{
+	uint8_t v = symbols ? symbols / 8 - 1 : dwphy_plen_fine_config();
+	if (v != plen_fine) {
+		dwt_setplenfine(v);
+		plen_fine = v;
+	}
+}
+
+/* PDoA needs STS. Without an STS configured use mode 1 with super
+ * deterministic codes, which needs no key. Call dwphy_config() afterwards */
+void dwphy_set_pdoa(uint8_t mode)
+{
+	config.pdoaMode = mode;
+	if (mode != DWT_PDOA_M0 && config.stsMode == DWT_STS_MODE_OFF) {
+		config.stsMode = DWT_STS_MODE_1 | DWT_STS_MODE_SDC;
+	}
+}
+
+uint8_t dwphy_get_pdoa(void)
+{
+	return config.pdoaMode;
+}
+
+/* Call dwphy_config() afterwards */
+void dwphy_set_sts(uint8_t mode, uint8_t len)
+{
+	config.stsMode = mode;
+	config.stsLength = len;
+}
+
+uint8_t dwphy_get_sts_mode(void)
+{
+	return config.stsMode;
+}
+
 uint8_t dwphy_get_prf(void)
 {
 	return DWPHY_PRF;
 }
+
+uint8_t dwphy_get_pac(void)
+{
+	return config.rxPAC;
+}
+
+/* SFD timeout for receiving a longer preamble of plen symbols than
+ * configured, 0 restores the configured value */
+void dwphy_set_rx_preamble_symbols(int plen)
+{
+	if (plen == 0) {
+		dwt_setsfdtimeout(config.sfdTO);
+	} else {
+		dwt_setsfdtimeout(plen + 1 + phy_sfd_len(config.dataRate, false)
+						  - dwphy_pac_int(config.rxPAC));
+	}
+}
+
+const dwt_config_t* dwphy_get_config(void)
+{
+	return &config;
+}
+
+/* Take over the configuration the DW3000 still has after a warm start. Only
+ * dwt_configure() sets the driver data for long frames and STS, so it has to
+ * be run again in these cases */
+bool dwphy_restore_config(const dwt_config_t* cfg)
+{
+	config = *cfg;
+	if (config.phrMode != DWT_PHRMODE_STD
+		|| config.stsMode != DWT_STS_MODE_OFF) {
+		return dwphy_config();
+	}
+	return true;
+}
+
+uint8_t dwphy_get_xtal_trim(void)
+{
+	return xtalTrim != 0 ? xtalTrim : dwt_getxtaltrim();
+}
+
+void dwphy_set_xtal_trim(uint8_t trim)
+{
+	xtalTrim = trim;
+	dwt_setxtaltrim(xtalTrim);
+	dwhw_warm_save();
+}
@@ -13,6 +13,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <deca_device_api.h>
+
 #include "dwutil.h"
 
 /* Default antenna delay values for 64 MHz PRF, usually calibrated
@@ -24,13 +26,54 @@
 // #define DWPHY_ANTENNA_DELAY 16405
 #define DWPHY_ANTENNA_DELAY 16368
 
+/* storage key of the calibrated antenna delay (antcal.h) */
+#define DWPHY_ANTD_KEY "antd"
+
 /* the phy_get_[preable/sfd/phyhdr/data/packet]_time functions return in units
  * of (picoseconds / 10) = (nanoseconds * 100), so this macro can be used to
  * convert to microseconds */
 #define PKTTIME_TO_USEC(ft) CEIL_DIV(ft, 100000)
 
+/* difference of RX and first path power for the NLOS likelihood: below LOS
+ * the channel is line of sight, above NLOS it is not */
+#define DWPHY_NLOS_LOS_DB  6.0f
+#define DWPHY_NLOS_NLOS_DB 10.0f
+
+/* fields of the selective RX diagnostics read */
+#define DWPHY_RXDIAG_PEAK	  0x01 // CIR peak amplitude and index
+#define DWPHY_RXDIAG_POWER	  0x02 // CIR power and accumulated symbols
+#define DWPHY_RXDIAG_FP_AMPL  0x04 // first path amplitudes and accumulated symbols
+#define DWPHY_RXDIAG_FP_INDEX 0x08 // first path index
+#define DWPHY_RXDIAG_PREAMBLE 0x10 // received preamble symbols
+#define DWPHY_RXDIAG_ALL	  0x1f
+
+/* diagnostics of the Ipatov CIR, only the fields in mask are valid */
+struct dwphy_rxdiag {
+	uint8_t mask;
+	uint16_t peak_index;
+	uint32_t peak_ampl;
+	uint32_t power;
+	uint32_t f1, f2, f3;
+	uint16_t fp_index; // Q10.6
+	uint16_t accum_count;
+	uint16_t preamble_cnt;
+};
+
+struct dwphy_rx_quality {
+	float rx_pwr;		// dBm
+	float fp_pwr;		// dBm, first path
+	float clock_offset; // ppm, positive when the local clock is slower
+	uint8_t nlos;		// NLOS likelihood in percent
+};
+
 bool dwphy_config(void);
+/** Calibrated antenna delay, the offset is added to it */
 void dwphy_set_antenna_delay(uint16_t antdelay);
+uint16_t dwphy_get_antenna_delay(void);
+/** Offset to the calibrated antenna delay, e.g. for temperature (dwtemp.h) */
+void dwphy_set_antenna_delay_offset(int16_t offset);
+uint16_t dwphy_load_antenna_delay(uint16_t def);
+bool dwphy_store_antenna_delay(uint16_t antdelay);
 
 /* phy time calculations */
 const char* dwphy_rate_str(uint8_t br);
@@ -40,7 +83,9 @@ int dwphy_prf_int(uint8_t p);
 int dwphy_pac_int(uint8_t p);
 uint32_t dwphy_calc_preamble_time(uint8_t plen_dwt, uint8_t prf_dwt,
 								  uint8_t rate_dwt);
+uint32_t dwphy_calc_symbols_time(int symbols, uint8_t prf_dwt);
 uint32_t dwphy_calc_sfd_time(uint8_t prf_dwt, uint8_t rate_dwt);
+uint32_t dwphy_calc_sts_time(void);
 uint32_t dwphy_calc_phyhdr_time(uint8_t rate_dwt);
 uint64_t dwphy_calc_data_time(uint8_t rate_dwt, int len);
 uint64_t dwphy_calc_packet_time(uint8_t rate_dwt, uint8_t plen_dwt,
@@ -54,11 +99,35 @@ void dwphy_print_packet_times(void);
 float dwphy_get_rx_clock_offset_ci(int32_t ci);
 void dwphy_xtal_trim(void);
 
+/* diagnostics and link quality of the last received frame. Only the
+ * registers of the requested fields are read, in as few SPI transfers as
+ * possible. They need dwphy_enable_full_diag() */
+void dwphy_enable_full_diag(void);
+void dwphy_read_rxdiag(struct dwphy_rxdiag* d, uint8_t mask);
+bool dwphy_read_rx_quality(struct dwphy_rx_quality* q);
+uint8_t dwphy_nlos_likelihood(float rx_pwr, float fp_pwr);
+
 /* get / set config */
+uint8_t dwphy_get_channel(void);
 void dwphy_set_rate(uint8_t br);
 uint8_t dwphy_get_rate(void);
 void dwphy_set_plen(uint8_t plen);
 uint8_t dwphy_get_plen(void);
+/** TX preamble length in symbols (multiple of 8, 64..2048) overriding the
+ * configured one until it is called with 0. With the DW3000 mutex held */
+void dwphy_set_tx_plen_fine(uint16_t symbols);
 uint8_t dwphy_get_prf(void);
+void dwphy_set_pdoa(uint8_t mode);
+uint8_t dwphy_get_pdoa(void);
+void dwphy_set_sts(uint8_t mode, uint8_t len);
+uint8_t dwphy_get_sts_mode(void);
+uint8_t dwphy_get_pac(void);
+void dwphy_set_rx_preamble_symbols(int plen);
+
+/* warm start: state which is kept by the DW3000 during sleep */
+const dwt_config_t* dwphy_get_config(void);
+bool dwphy_restore_config(const dwt_config_t* cfg);
+uint8_t dwphy_get_xtal_trim(void);
+void dwphy_set_xtal_trim(uint8_t trim);
 
 #endif
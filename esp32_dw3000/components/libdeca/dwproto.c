@@ -7,9 +7,12 @@
  * Version 3. See the file LICENSE.txt for more details.
  */
 
+#include <antcal.h>
 #include <blink.h>
+#include <bulk.h>
 #include <dwmac.h>
 #include <dwproto.h>
+#include <dwsec.h>
 #include <dwutil.h>
 #include <mac802154.h>
 #include <ranging.h>
@@ -20,6 +23,34 @@
 // static const char* LOG_TAG = "PROTO";
 static uint8_t seqNo;
 
+/* directly indexed by function code */
+static dwprot_handler_t handlers[256] = {
+	[TWR_MSG_GROUP ... TWR_MSG_GROUP + 0x0F] = twr_handle_message,
+	[SYNC_MSG] = sync_handle_msg,
+	[ANTCAL_MSG] = antcal_handle_message,
+	[BULK_MSG_GROUP ... BULK_MSG_GROUP + 0x0F] = bulk_handle_message,
+};
+
+/* the auxiliary security header and MIC are added when the frame is sent */
+static uint16_t dwprot_fc(uint16_t fc)
+{
+	if (CONFIG_DECA_FRAME_SECURITY
+		&& dwsec_get_level() != MAC154_SEC_LVL_NONE) {
+		fc |= MAC154_FC_SECURITY;
+	}
+	return fc;
+}
+
+/* Frame control for comparing with MAC154_FC_SHORT/LONG/LONG_SRC: ACK request
+ * and frame pending don't change the header. The security bit is not masked,
+ * dwsec_handle_rx() removes it together with the auxiliary header, if it is
+ * still set the header is not ours */
+static uint16_t dwprot_rx_fc(const uint8_t* buf)
+{
+	uint16_t fc = buf[0] | (buf[1] << 8);
+	return fc & ~(MAC154_FC_ACK_REQ | MAC154_FC_FRAME_PEND);
+}
+
 /* len is user protocol length without headers */
 void* dwprot_short_prepare(struct txbuf* tx, size_t len, uint8_t func,
 						   uint16_t dst)
@@ -29,7 +60,7 @@ void* dwprot_short_prepare(struct txbuf* tx, size_t len, uint8_t func,
 
 	struct prot_short* ps = (struct prot_short*)tx->buf;
 	/* prepare header */
-	ps->hdr.fc = MAC154_FC_SHORT;
+	ps->hdr.fc = dwprot_fc(MAC154_FC_SHORT);
 	ps->hdr.src = dwmac_get_mac16();
 	ps->hdr.dst = dst;
 	ps->hdr.panId = dwmac_get_panid();
@@ -49,7 +80,7 @@ void* dwprot_long_prepare(struct txbuf* tx, size_t len, uint8_t func,
 
 	struct prot_long* pl = (struct prot_long*)tx->buf;
 	/* prepare header */
-	pl->hdr.fc = MAC154_FC_LONG;
+	pl->hdr.fc = dwprot_fc(MAC154_FC_LONG);
 	pl->hdr.dst = dst;
 	pl->hdr.src = dwmac_get_mac64();
 
@@ -76,7 +107,7 @@ void* dwprot_long_src_prepare(struct txbuf* tx, size_t len, uint8_t func,
 
 	struct prot_long_src* pl = (struct prot_long_src*)tx->buf;
 	/* prepare header */
-	pl->hdr.fc = MAC154_FC_LONG_SRC;
+	pl->hdr.fc = dwprot_fc(MAC154_FC_LONG_SRC);
 	pl->hdr.src = src;
 
 	pl->func = func;
@@ -87,12 +118,13 @@ void* dwprot_long_src_prepare(struct txbuf* tx, size_t len, uint8_t func,
 uint64_t dwprot_get_src(const uint8_t* buf)
 {
 	const struct prot_short* ps = (const struct prot_short*)buf;
-	if (ps->hdr.fc == MAC154_FC_SHORT) {
+	uint16_t fc = dwprot_rx_fc(buf);
+	if (fc == MAC154_FC_SHORT) {
 		return ps->hdr.src;
-	} else if (ps->hdr.fc == MAC154_FC_LONG) {
+	} else if (fc == MAC154_FC_LONG) {
 		const struct prot_long* pl = (const struct prot_long*)buf;
 		return pl->hdr.src;
-	} else if (ps->hdr.fc == MAC154_FC_LONG_SRC) {
+	} else if (fc == MAC154_FC_LONG_SRC) {
 		const struct prot_long_src* pl = (const struct prot_long_src*)buf;
 		return pl->hdr.src;
 	}
@@ -102,12 +134,13 @@ uint64_t dwprot_get_src(const uint8_t* buf)
 uint8_t dwprot_get_func(const uint8_t* buf)
 {
 	const struct prot_short* ps = (const struct prot_short*)buf;
-	if (ps->hdr.fc == MAC154_FC_SHORT) {
+	uint16_t fc = dwprot_rx_fc(buf);
+	if (fc == MAC154_FC_SHORT) {
 		return ps->func;
-	} else if (ps->hdr.fc == MAC154_FC_LONG) {
+	} else if (fc == MAC154_FC_LONG) {
 		const struct prot_long* pl = (const struct prot_long*)buf;
 		return pl->func;
-	} else if (ps->hdr.fc == MAC154_FC_LONG_SRC) {
+	} else if (fc == MAC154_FC_LONG_SRC) {
 		const struct prot_long_src* pl = (const struct prot_long_src*)buf;
 		return pl->func;
 	}
@@ -116,7 +149,7 @@ uint8_t dwprot_get_func(const uint8_t* buf)
 
 size_t dwprot_get_payload_len(const uint8_t* buf, size_t len)
 {
-	uint16_t fc = *(uint16_t*)buf;
+	uint16_t fc = dwprot_rx_fc(buf);
 	if (fc == MAC154_FC_SHORT) {
 		return len - DWMAC_PROTO_SHORT_LEN;
 	} else if (fc == MAC154_FC_LONG) {
@@ -130,12 +163,13 @@ size_t dwprot_get_payload_len(const uint8_t* buf, size_t len)
 const void* dwprot_get_payload(const uint8_t* buf)
 {
 	const struct prot_short* ps = (const struct prot_short*)buf;
-	if (ps->hdr.fc == MAC154_FC_SHORT) {
+	uint16_t fc = dwprot_rx_fc(buf);
+	if (fc == MAC154_FC_SHORT) {
 		return ps->pbuf;
-	} else if (ps->hdr.fc == MAC154_FC_LONG) {
+	} else if (fc == MAC154_FC_LONG) {
 		const struct prot_long* pl = (const struct prot_long*)buf;
 		return pl->pbuf;
-	} else if (ps->hdr.fc == MAC154_FC_LONG_SRC) {
+	} else if (fc == MAC154_FC_LONG_SRC) {
 		const struct prot_long_src* pl = (const struct prot_long_src*)buf;
 		return pl->pbuf;
 	}
@@ -148,7 +182,7 @@ bool dwprot_check_min_len(const uint8_t* buf, size_t len)
 		return false; // not even FC
 	}
 
-	uint16_t fc = *(uint16_t*)buf;
+	uint16_t fc = dwprot_rx_fc(buf);
 	if (fc == MAC154_FC_SHORT) {
 		return len >= DWMAC_PROTO_SHORT_LEN;
 	} else if (fc == MAC154_FC_LONG) {
@@ -159,8 +193,69 @@ bool dwprot_check_min_len(const uint8_t* buf, size_t len)
 	return false;
 }
 
+bool dwprot_parse(const struct rxbuf* rx, struct dwprot_frame* f)
+{
+	size_t hdr_len;
+
+	if (rx->len < 2) {
+		return false; // not even FC
+	}
+
+	uint16_t fc = dwprot_rx_fc(rx->buf);
+	if (fc == MAC154_FC_SHORT) {
+		const struct prot_short* ps = (const struct prot_short*)rx->buf;
+		if (rx->len < DWMAC_PROTO_SHORT_LEN) {
+			return false;
+		}
+		f->src = ps->hdr.src;
+		f->dst = ps->hdr.dst;
+		f->func = ps->func;
+		hdr_len = sizeof(struct prot_short);
+	} else if (fc == MAC154_FC_LONG) {
+		const struct prot_long* pl = (const struct prot_long*)rx->buf;
+		if (rx->len < DWMAC_PROTO_LONG_LEN) {
+			return false;
+		}
+		f->src = pl->hdr.src;
+		f->dst = pl->hdr.dst;
+		f->func = pl->func;
+		hdr_len = sizeof(struct prot_long);
+	} else if (fc == MAC154_FC_LONG_SRC) {
+		const struct prot_long_src* pl = (const struct prot_long_src*)rx->buf;
+		if (rx->len < DWMAC_PROTO_LONG_SRC_LEN) {
+			return false;
+		}
+		f->src = pl->hdr.src;
+		f->dst = 0;
+		f->func = pl->func;
+		hdr_len = sizeof(struct prot_long_src);
+	} else {
+		return false;
+	}
+
+	f->payload = rx->buf + hdr_len;
+	f->payload_len = rx->len - hdr_len - MAC154_FCS_LEN;
+	f->rx = rx;
+	return true;
+}
+
+void dwprot_register(uint8_t func, dwprot_handler_t h)
+{
+	handlers[func] = h;
+}
+
+void dwprot_register_group(uint8_t group, dwprot_handler_t h)
+{
+	group &= DWMAC_PROTO_MSG_MASK;
+	for (int i = 0; i <= (uint8_t)~DWMAC_PROTO_MSG_MASK; i++) {
+		handlers[group | i] = h;
+	}
+}
+
 void dwprot_rx_handler(const struct rxbuf* rx)
 {
+	struct dwprot_frame f;
+
 	if (rx->len < 2) {
 		return; // too short
 	}
@@ -174,15 +269,9 @@ void dwprot_rx_handler(const struct rxbuf* rx)
 	} else if ((uint8_t)fc == MAC154_FC_BLINK_LONG) {
 		blink_handle_msg_long(rx);
 	} else if (fc & MAC154_FC_TYPE_DATA) {
-		if (!dwprot_check_min_len(rx->buf, rx->len)) {
-			// checks also frame types we are responsible for
-			return;
-		}
-		uint8_t func = dwprot_get_func(rx->buf);
-		if ((func & DWMAC_PROTO_MSG_MASK) == TWR_MSG_GROUP) {
-			twr_handle_message(rx);
-		} else if (func == SYNC_MSG) {
-			sync_handle_msg(rx);
+		// checks also frame types we are responsible for
+		if (dwprot_parse(rx, &f) && handlers[f.func] != NULL) {
+			handlers[f.func](&f);
 		}
 	}
 }
@@ -39,6 +39,18 @@ struct prot_long_src {
 	uint8_t pbuf[0];
 } __attribute__((packed));
 
+/** Received frame, parsed once in dwprot_rx_handler() */
+struct dwprot_frame {
+	uint64_t src;
+	uint64_t dst; // 0 if the frame has no destination address
+	uint8_t func;
+	const uint8_t* payload; // after header and func
+	size_t payload_len;		// without FCS
+	const struct rxbuf* rx; // for timestamp and diagnostics
+};
+
+typedef void (*dwprot_handler_t)(const struct dwprot_frame* f);
+
 /* return pointer to space after header and func */
 void* dwprot_short_prepare(struct txbuf* tx, size_t len, uint8_t func,
 						   uint16_t dst);
@@ -50,6 +62,13 @@ void* dwprot_long_src_prepare(struct txbuf* tx, size_t len, uint8_t func,
 							  uint64_t src);
 
 void dwprot_rx_handler(const struct rxbuf* rx);
+/** parse short, long or long_src frame header, false if not our protocol */
+bool dwprot_parse(const struct rxbuf* rx, struct dwprot_frame* f);
+/** register handler for one function code. TWR and Sync are registered by
+ * default, NULL removes the handler */
+void dwprot_register(uint8_t func, dwprot_handler_t h);
+/** register handler for a group of 16 function codes (func & 0xF0) */
+void dwprot_register_group(uint8_t group, dwprot_handler_t h);
 
 /** get from either short or long */
 uint64_t dwprot_get_src(const uint8_t* buf);
@@ -0,0 +1,401 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <string.h>
+
+#include <deca_device_api.h>
+
+#include "dwsec.h"
+#include "log.h"
+#include "platform/dwmac_task.h"
+#include "platform/dwstore.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+#define DWSEC_AUX_LEN	sizeof(struct mac154_aux_sec_idx)
+#define DWSEC_NONCE_LEN 13
+
+struct dwsec_key {
+	bool used;
+	uint8_t index;
+	dwt_aes_key_t key;
+	uint32_t floor; // highest counter of the evicted peers
+	bool floor_set;
+};
+
+/* last frame counter of each source and key */
+struct dwsec_peer {
+	bool used;
+	uint8_t key_index;
+	uint64_t addr;
+	uint32_t counter;
+};
+
+static struct dwsec_key keys[DWSEC_MAX_KEYS];
+static struct dwsec_peer peers[CONFIG_DECA_SEC_PEERS];
+static uint8_t tx_level;
+static uint8_t tx_key_index;
+static bool required;
+static uint32_t frame_counter;
+static uint32_t counter_limit = UINT32_MAX;
+static volatile bool store_pending;
+
+static struct dwsec_key* dwsec_find_key(uint8_t key_index)
+{
+	for (int i = 0; i < DWSEC_MAX_KEYS; i++) {
+		if (keys[i].used && keys[i].index == key_index) {
+			return &keys[i];
+		}
+	}
+	return NULL;
+}
+
+bool dwsec_set_key(uint8_t key_index, const uint8_t key[DWSEC_KEY_LEN])
+{
+	struct dwsec_key* k = dwsec_find_key(key_index);
+	for (int i = 0; k == NULL && i < DWSEC_MAX_KEYS; i++) {
+		if (!keys[i].used) {
+			k = &keys[i];
+		}
+	}
+	if (k == NULL) {
+		LOG_ERR("Frame security: too many keys");
+		return false;
+	}
+
+	memset(k, 0, sizeof(*k));
+	memcpy(&k->key, key, DWSEC_KEY_LEN);
+	k->index = key_index;
+	k->used = true;
+	/* the frame counters of the peers start again with a new key */
+	for (int i = 0; i < CONFIG_DECA_SEC_PEERS; i++) {
+		if (peers[i].key_index == key_index) {
+			peers[i].used = false;
+		}
+	}
+	return true;
+}
+
+void dwsec_clear_keys(void)
+{
+	memset(keys, 0, sizeof(keys));
+	memset(peers, 0, sizeof(peers));
+	tx_level = MAC154_SEC_LVL_NONE;
+}
+
+bool dwsec_set_level(uint8_t level, uint8_t key_index)
+{
+	if (!CONFIG_DECA_FRAME_SECURITY) {
+		LOG_ERR("Frame security needs CONFIG_DECA_FRAME_SECURITY");
+		return false;
+	}
+
+	if (level > MAC154_SEC_LVL_ENCMIC128 || level == MAC154_SEC_LVL_RES
+		|| (level != MAC154_SEC_LVL_NONE
+			&& dwsec_find_key(key_index) == NULL)) {
+		LOG_ERR("Frame security: invalid level %d or key %d", level, key_index);
+		return false;
+	}
+
+	tx_level = level;
+	tx_key_index = key_index;
+	return true;
+}
+
+uint8_t dwsec_get_level(void)
+{
+	return tx_level;
+}
+
+void dwsec_set_required(bool req)
+{
+	required = req;
+}
+
+uint32_t dwsec_get_frame_counter(void)
+{
+	return frame_counter;
+}
+
+static bool dwsec_reserve_counter(void)
+{
+	uint32_t limit = UINT32_MAX - frame_counter > DWSEC_FC_RESERVE
+						 ? frame_counter + DWSEC_FC_RESERVE
+						 : UINT32_MAX;
+
+	/* stored before the counters are used */
+	if (!dwstore_write(DWSEC_FC_KEY, &limit, sizeof(limit))) {
+		return false;
+	}
+	counter_limit = limit;
+	return true;
+}
+
+bool dwsec_load_counter(void)
+{
+	uint32_t fc;
+
+	if (dwstore_read(DWSEC_FC_KEY, &fc, sizeof(fc))) {
+		frame_counter = fc;
+		LOG_INF("Frame counter %" PRIu32, fc);
+	}
+	return dwsec_reserve_counter();
+}
+
+bool dwsec_save_counter(void)
+{
+	if (counter_limit - frame_counter > DWSEC_FC_RESERVE / 2) {
+		return true;
+	}
+	return dwsec_reserve_counter();
+}
+
+static void dwsec_store_task(void)
+{
+	store_pending = false;
+	if (!dwsec_save_counter()) {
+		LOG_ERR("Frame security: storing the frame counter failed");
+	}
+}
+
+void dwsec_handle_tx_done(void)
+{
+	/* only when the counters are kept in storage. The flash write is queued
+	 * once, so it runs after the TX done callbacks and not in their path. If
+	 * it can't be queued, the next frame tries again */
+	if (counter_limit == UINT32_MAX || store_pending
+		|| counter_limit - frame_counter > DWSEC_FC_RESERVE / 2) {
+		return;
+	}
+	store_pending = true;
+	if (dwtask_call(dwsec_store_task) != 0) {
+		store_pending = false;
+	}
+}
+
+/* The extended source address, or PAN ID and short address */
+static uint64_t dwsec_src_addr(const uint8_t* buf, size_t hdr_len)
+{
+	uint16_t fc = buf[0] | (buf[1] << 8);
+	uint64_t addr = 0;
+
+	if ((fc & MAC154_FC_SRC_ADDR_MASK) == MAC154_FC_SRC_ADDR_LONG) {
+		memcpy(&addr, buf + hdr_len - 8, 8);
+	} else if ((fc & MAC154_FC_SRC_ADDR_MASK) == MAC154_FC_SRC_ADDR_SHORT) {
+		addr = ((uint64_t)dwmac_get_panid() << 16) | buf[hdr_len - 2]
+			   | (buf[hdr_len - 1] << 8);
+	}
+	return addr;
+}
+
+/* CCM* nonce: source address, frame counter (both MSB first) and level */
+static void dwsec_nonce(uint8_t* nonce, uint64_t addr, uint32_t counter,
+						uint8_t level)
+{
+	for (int i = 0; i < 8; i++) {
+		nonce[i] = addr >> (56 - 8 * i);
+	}
+	for (int i = 0; i < 4; i++) {
+		nonce[8 + i] = counter >> (24 - 8 * i);
+	}
+	nonce[12] = level;
+}
+
+/* Encrypt in the TX buffer or decrypt in the RX buffer of the DW3000. hdr_len
+ * includes the auxiliary header, len is without MIC and FCS. Only the payload
+ * is encrypted, with MIC only levels everything is authenticated */
+static bool dwsec_aes(uint8_t* buf, size_t hdr_len, size_t len,
+					  const struct mac154_aux_sec_idx* aux,
+					  const struct dwsec_key* k, dwt_aes_mode_e mode)
+{
+	uint8_t level = aux->ctrl & MAC154_SEC_LVL_MASK;
+	uint8_t mic = mac154_mic_len(level);
+	uint8_t nonce[DWSEC_NONCE_LEN];
+	bool enc = mode == AES_Encrypt;
+	dwt_aes_config_t cfg = {
+		.aes_otp_sel_key_block = AES_key_otp_sel_1st_128,
+		.aes_key_otp_type = AES_key_RAM,
+		.aes_core_type = AES_core_type_CCM,
+		.mic = dwt_mic_size_from_bytes(mic),
+		.key_src = AES_KEY_Src_Register,
+		.key_load = AES_KEY_Load,
+		.key_addr = 0,
+		.key_size = AES_KEY_128bit,
+		.mode = mode,
+	};
+	dwt_aes_job_t job = {
+		.nonce = nonce,
+		.header = buf,
+		.header_len = (level & MAC154_SEC_LVL_ENC) ? hdr_len : len,
+		.src_port = enc ? AES_Src_Tx_buf : AES_Src_Rx_buf_0,
+		.dst_port = enc ? AES_Dst_Tx_buf : AES_Dst_Rx_buf_0,
+		.mode = mode,
+		.mic_size = mic,
+	};
+	job.payload = buf + job.header_len;
+	job.payload_len = len - job.header_len;
+
+	dwsec_nonce(nonce, dwsec_src_addr(buf, hdr_len - DWSEC_AUX_LEN),
+				aux->frame_counter, level);
+	dwt_set_keyreg_128((dwt_aes_key_t*)&k->key);
+	dwt_configure_aes(&cfg);
+	int8_t ret = dwt_do_aes(&job, AES_core_type_CCM);
+	return ret >= 0 && !(ret & DWT_AES_ERRORS);
+}
+
+bool dwsec_write_tx(struct txbuf* tx)
+{
+	uint16_t fc = tx->buf[0] | (tx->buf[1] << 8);
+	size_t hdr_len = mac154_hdr_len(fc);
+	struct mac154_aux_sec_idx* aux = (void*)(tx->buf + hdr_len);
+
+	/* a frame which is sent again keeps its frame counter */
+	if (!tx->secured) {
+		size_t add = DWSEC_AUX_LEN + mac154_mic_len(tx_level);
+		if (tx_level == MAC154_SEC_LVL_NONE || hdr_len == 0
+			|| tx->len < hdr_len + MAC154_FCS_LEN
+			|| tx->len + add > DWMAC_TXBUF_LEN) {
+			LOG_ERR("Frame security: can't secure frame");
+			return false;
+		}
+		if (!(tx_level & MAC154_SEC_LVL_ENC)
+			&& tx->len + DWSEC_AUX_LEN - MAC154_FCS_LEN
+				   > DWSEC_MIC_ONLY_MAX_LEN) {
+			LOG_ERR("Frame security: frame too long for MIC only level");
+			return false;
+		}
+		if (frame_counter >= counter_limit) {
+			LOG_ERR("Frame security: frame counters used up");
+			return false;
+		}
+
+		memmove(tx->buf + hdr_len + DWSEC_AUX_LEN, tx->buf + hdr_len,
+				tx->len - hdr_len - MAC154_FCS_LEN);
+		aux->ctrl = tx_level | MAC154_SEC_KEY_ID_INDEX;
+		aux->frame_counter = frame_counter++;
+		aux->key_index = tx_key_index;
+		tx->len += add;
+		tx->secured = true;
+	}
+
+	const struct dwsec_key* k = dwsec_find_key(aux->key_index);
+	uint8_t mic = mac154_mic_len(aux->ctrl & MAC154_SEC_LVL_MASK);
+	if (k == NULL) {
+		LOG_ERR("Frame security: no key %d", aux->key_index);
+		return false;
+	}
+	return dwsec_aes(tx->buf, hdr_len + DWSEC_AUX_LEN,
+					 tx->len - mic - MAC154_FCS_LEN, aux, k, AES_Encrypt);
+}
+
+#if CONFIG_DECA_FRAME_SECURITY
+static struct dwsec_peer* dwsec_find_peer(uint64_t addr, uint8_t key_index)
+{
+	for (int i = 0; i < CONFIG_DECA_SEC_PEERS; i++) {
+		if (peers[i].used && peers[i].addr == addr
+			&& peers[i].key_index == key_index) {
+			return &peers[i];
+		}
+	}
+	return NULL;
+}
+
+/* A free entry, or the one with the lowest counter. Its counter becomes the
+ * floor of its key, so its old frames are not accepted again */
+static struct dwsec_peer* dwsec_new_peer(void)
+{
+	struct dwsec_peer* p = &peers[0];
+	for (int i = 0; i < CONFIG_DECA_SEC_PEERS; i++) {
+		if (!peers[i].used) {
+			return &peers[i];
+		}
+		if (peers[i].counter < p->counter) {
+			p = &peers[i];
+		}
+	}
+
+	struct dwsec_key* k = dwsec_find_key(p->key_index);
+	if (k != NULL && (!k->floor_set || p->counter > k->floor)) {
+		k->floor = p->counter;
+		k->floor_set = true;
+	}
+	return p;
+}
+#endif
+
+bool dwsec_handle_rx(struct rxbuf* rx)
+{
+#if CONFIG_DECA_FRAME_SECURITY
+	rx->sec_level = MAC154_SEC_LVL_NONE;
+	if (rx->len < 2) {
+		return true;
+	}
+
+	uint16_t fc = rx->buf[0] | (rx->buf[1] << 8);
+	if (!mac154_is_secured(fc)) {
+		/* ACKs and blinks are never secured */
+		return !required
+			   || (fc & MAC154_FC_TYPE_MASK) != MAC154_FC_TYPE_DATA;
+	}
+
+	size_t hdr_len = mac154_hdr_len(fc);
+	if (hdr_len == 0 || rx->len < hdr_len + DWSEC_AUX_LEN + MAC154_FCS_LEN) {
+		return false;
+	}
+
+	struct mac154_aux_sec_idx aux;
+	memcpy(&aux, rx->buf + hdr_len, sizeof(aux));
+	uint8_t level = aux.ctrl & MAC154_SEC_LVL_MASK;
+	size_t mic = mac154_mic_len(level);
+	const struct dwsec_key* k = dwsec_find_key(aux.key_index);
+	if ((aux.ctrl & MAC154_SEC_KEY_ID_MASK) != MAC154_SEC_KEY_ID_INDEX
+		|| level == MAC154_SEC_LVL_NONE || level == MAC154_SEC_LVL_RES
+		|| k == NULL
+		|| rx->len < hdr_len + DWSEC_AUX_LEN + mic + MAC154_FCS_LEN) {
+		return false;
+	}
+
+	size_t len = rx->len - mic - MAC154_FCS_LEN;
+	if (!(level & MAC154_SEC_LVL_ENC) && len > DWSEC_MIC_ONLY_MAX_LEN) {
+		return false;
+	}
+
+	/* replay check against the last frame of the source, or the floor of
+	 * the key for sources which are not in the table (any more) */
+	uint64_t src = dwsec_src_addr(rx->buf, hdr_len);
+	struct dwsec_peer* p = dwsec_find_peer(src, aux.key_index);
+	if (p != NULL ? aux.frame_counter <= p->counter
+				  : k->floor_set && aux.frame_counter <= k->floor) {
+		return false;
+	}
+
+	if (!dwsec_aes(rx->buf, hdr_len + DWSEC_AUX_LEN, len, &aux, k,
+				   AES_Decrypt)) {
+		return false;
+	}
+
+	if (p == NULL) {
+		p = dwsec_new_peer();
+		p->used = true;
+		p->key_index = aux.key_index;
+		p->addr = src;
+	}
+	p->counter = aux.frame_counter;
+
+	/* pass it on like an unsecured frame */
+	memmove(rx->buf + hdr_len, rx->buf + hdr_len + DWSEC_AUX_LEN,
+			len - hdr_len - DWSEC_AUX_LEN);
+	rx->len -= DWSEC_AUX_LEN + mic;
+	rx->buf[0] &= ~MAC154_FC_SECURITY;
+	rx->sec_level = level;
+#endif
+	return true;
+}
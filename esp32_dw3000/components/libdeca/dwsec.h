@@ -0,0 +1,100 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_SEC_H
+#define DECA_SEC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dwmac.h"
+#include "mac802154.h"
+
+/*
+ * IEEE 802.15.4 frame security with the AES engine of the DW3000
+ *
+ * With CONFIG_DECA_FRAME_SECURITY and a security level set by
+ * dwsec_set_level(), the frames of dwproto.h get the security bit and an
+ * auxiliary security header (level, key index and frame counter) after the
+ * addresses. They are authenticated (MIC) or encrypted and authenticated
+ * (ENCMIC) with AES-128 CCM* by the DW3000 in place in its TX and RX buffers,
+ * so the processing time is a few SPI transfers and does not depend on the
+ * host CPU.
+ *
+ * - With MIC only levels the whole frame is authenticated data, which the
+ *   AES engine limits to DWSEC_MIC_ONLY_MAX_LEN bytes (header_len of
+ *   dwt_aes_job_t). Longer frames are not sent and dropped when received,
+ *   they need an ENCMIC level.
+ * - Keys are set in a table by their key index, only key ID mode 1 (index)
+ *   is supported.
+ * - The nonce is the extended source address, the frame counter and the
+ *   level. For short source addresses the PAN ID and short address are used
+ *   instead of the extended address, which the receiver does not know.
+ * - Received frames are verified (and decrypted) in the RX IRQ, frames with
+ *   a bad MIC, an unknown key or a frame counter not newer than the last one
+ *   of the same source are dropped and counted as "RX sec bad". Others are
+ *   passed on without the auxiliary header, MIC and security bit, with the
+ *   level in rxbuf.sec_level.
+ * - The replay check keeps the last counter of CONFIG_DECA_SEC_PEERS sources
+ *   per key. When the table is full the source with the lowest counter is
+ *   replaced and its counter becomes the floor of the key: sources which are
+ *   not in the table must send a higher counter. Size the table for all
+ *   sources of the network, or new sources with low counters are dropped
+ *   until they pass the floor. A new key resets only its own counters.
+ * - The frame counter must never repeat with the same key. It can be kept in
+ *   persistent storage: dwsec_load_counter() reserves a range of counters.
+ *   When half of it is used, a sent frame queues the store of the next range
+ *   with dwtask_call(), so the flash write is not in the TX done path.
+ *   Without that, set new keys after each boot.
+ */
+
+#ifndef CONFIG_DECA_SEC_PEERS
+#define CONFIG_DECA_SEC_PEERS 8
+#endif
+
+#define DWSEC_KEY_LEN	 16
+#define DWSEC_MAX_KEYS	 4
+#define DWSEC_FC_RESERVE 4096 // frame counters reserved per store
+#define DWSEC_FC_KEY	 "secfc"
+/* frame length without MIC and FCS for MIC only levels */
+#define DWSEC_MIC_ONLY_MAX_LEN 127
+/* auxiliary header and MIC of the highest level */
+#define DWSEC_MAX_OVERHEAD (sizeof(struct mac154_aux_sec_idx) + 16)
+/* to be left free in frames which may be secured */
+#if CONFIG_DECA_FRAME_SECURITY
+#define DWSEC_FRAME_RESERVE DWSEC_MAX_OVERHEAD
+#else
+#define DWSEC_FRAME_RESERVE 0
+#endif
+
+/** Add or replace the key for a key index */
+bool dwsec_set_key(uint8_t key_index, const uint8_t key[DWSEC_KEY_LEN]);
+void dwsec_clear_keys(void);
+/** Level (MAC154_SEC_LVL_*) and key for sent frames, NONE disables it */
+bool dwsec_set_level(uint8_t level, uint8_t key_index);
+uint8_t dwsec_get_level(void);
+/** Drop received data frames without security */
+void dwsec_set_required(bool req);
+
+uint32_t dwsec_get_frame_counter(void);
+/** Continue at the stored frame counter and reserve the next counters */
+bool dwsec_load_counter(void);
+/** Extend the reserved counters when half of them are used (task context).
+ * Done automatically after sent frames */
+bool dwsec_save_counter(void);
+
+/* INTERNAL: insert the auxiliary header and write the secured frame to the TX
+ * buffer of the DW3000, with the DW3000 mutex held */
+bool dwsec_write_tx(struct txbuf* tx);
+/* INTERNAL: verify and decrypt a received frame in the RX IRQ */
+bool dwsec_handle_rx(struct rxbuf* rx);
+/* INTERNAL: in the MAC task after a frame was sent, queues the counter store */
+void dwsec_handle_tx_done(void);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "dwstats.h"
+#include "log.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+static const char* hist_names[DWSTATS_HIST_NUM] = {
+	"RX to CB",
+	"CB to task",
+	"TX margin",
+};
+
+static const char* cnt_names[DWSTATS_CNT_NUM] = {
+	"RX frames",   "RX drop len",	 "RX error", "RX timeout",
+	"RX overrun",  "Queue overrun", "TX late",	"ACK ok",
+	"ACK retry",   "ACK fail",		 "ACK sent", "ACK dup",
+	"RX STS bad",  "RX sec bad",
+};
+
+static struct dwstats stats;
+
+#if CONFIG_DECA_STATS
+
+/* may be called from IRQ context */
+void dwstats_hist_add(enum dwstats_hist_e h, uint32_t us)
+{
+	struct dwstats_hist* hist = &stats.hist[h];
+	int idx = us == 0 ? 0 : 32 - __builtin_clz(us);
+	if (idx >= DWSTATS_HIST_BUCKETS) {
+		idx = DWSTATS_HIST_BUCKETS - 1;
+	}
+	hist->bucket[idx]++;
+	hist->count++;
+	if (us > hist->max_us) {
+		hist->max_us = us;
+	}
+}
+
+/* may be called from IRQ context */
+void dwstats_inc(enum dwstats_cnt_e c)
+{
+	stats.cnt[c]++;
+}
+
+#endif
+
+const struct dwstats* dwstats_get(void)
+{
+	return &stats;
+}
+
+void dwstats_reset(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+uint32_t dwstats_bucket_low_us(int idx)
+{
+	return idx == 0 ? 0 : 1 << (idx - 1);
+}
+
+void dwstats_print(void)
+{
+	for (int i = 0; i < DWSTATS_CNT_NUM; i++) {
+		LOG_INF("%-14s %" PRIu32, cnt_names[i], stats.cnt[i]);
+	}
+
+	for (int h = 0; h < DWSTATS_HIST_NUM; h++) {
+		const struct dwstats_hist* hist = &stats.hist[h];
+		LOG_INF("%s: %" PRIu32 " samples, max %" PRIu32 " us", hist_names[h],
+				hist->count, hist->max_us);
+		for (int i = 0; i < DWSTATS_HIST_BUCKETS; i++) {
+			if (hist->bucket[i] > 0) {
+				LOG_INF("  >= %5" PRIu32 " us: %" PRIu32,
+						dwstats_bucket_low_us(i), hist->bucket[i]);
+			}
+		}
+	}
+}
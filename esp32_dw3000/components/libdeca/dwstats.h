@@ -0,0 +1,86 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_STATS_H
+#define DECA_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if ESP_PLATFORM
+#include <sdkconfig.h>
+#endif
+
+/* Latency histograms and counters, on by default in Kconfig. Updating them
+ * costs a few CPU cycles and one SPI read of the system time per RX IRQ and
+ * delayed TX */
+#ifndef CONFIG_DECA_STATS
+#define CONFIG_DECA_STATS 0
+#endif
+
+/* Histogram buckets are powers of two in microseconds: bucket 0 is < 1us,
+ * bucket n is [2^(n-1), 2^n - 1] us and the last bucket includes everything
+ * bigger */
+#define DWSTATS_HIST_BUCKETS 16
+/* RX to callback is sampled every n frames, it costs an SPI read */
+#define DWSTATS_RX_TO_CB_SAMPLE 16
+
+enum dwstats_hist_e {
+	DWSTATS_RX_TO_CB,	// RX timestamp to RX callback (IRQ latency)
+	DWSTATS_CB_TO_TASK, // end of RX callback to frame handling in task
+	DWSTATS_TX_MARGIN,	// delayed TX: txtime - systime after starting TX
+	DWSTATS_HIST_NUM,
+};
+
+enum dwstats_cnt_e {
+	DWSTATS_RX_FRAMES,		// received frames
+	DWSTATS_RX_DROP_LEN,	// dropped because too large for buffer
+	DWSTATS_RX_ERR,			// RX errors (PHE, CRC, sync loss, ...)
+	DWSTATS_RX_TIMEOUT,		// RX timeouts (frame wait and preamble)
+	DWSTATS_RX_OVERRUN,		// RX overrun (double buffer)
+	DWSTATS_QUEUE_OVERRUN,	// event could not be queued to task
+	DWSTATS_TX_LATE,		// delayed TX failed because it was too late
+	DWSTATS_ACK_OK,			// ACK received for frame with AR bit
+	DWSTATS_ACK_RETRY,		// frame sent again because ACK was missing
+	DWSTATS_ACK_FAIL,		// no ACK after all retries
+	DWSTATS_ACK_SENT,		// auto-ACK sent by DW3000
+	DWSTATS_ACK_DUP,		// received retransmission dropped
+	DWSTATS_RX_STS_BAD,		// STS error or bad STS quality
+	DWSTATS_RX_SEC_BAD,		// frame security check failed
+	DWSTATS_CNT_NUM,
+};
+
+struct dwstats_hist {
+	uint32_t bucket[DWSTATS_HIST_BUCKETS];
+	uint32_t count;
+	uint32_t max_us;
+};
+
+struct dwstats {
+	struct dwstats_hist hist[DWSTATS_HIST_NUM];
+	uint32_t cnt[DWSTATS_CNT_NUM];
+};
+
+#if CONFIG_DECA_STATS
+void dwstats_hist_add(enum dwstats_hist_e h, uint32_t us);
+void dwstats_inc(enum dwstats_cnt_e c);
+#else
+#define dwstats_hist_add(_h, _us)
+#define dwstats_inc(_c)
+#endif
+
+/** Get current statistics. Values may be updated from IRQ context while they
+ * are read, so copy them if consistency is important */
+const struct dwstats* dwstats_get(void);
+void dwstats_reset(void);
+/** Lower bound of histogram bucket in us */
+uint32_t dwstats_bucket_low_us(int idx);
+void dwstats_print(void);
+
+#endif
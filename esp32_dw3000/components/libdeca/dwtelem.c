@@ -0,0 +1,132 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <deca_device_api.h>
+
+#include "dwmac.h"
+#include "dwmac_task.h"
+#include "dwtelem.h"
+#include "log.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+static const char* cnt_names[DWTELEM_NUM] = {
+	"phe",	"rsl",	"crcg", "crcb", "arfe",		"over",
+	"sfdto", "pto", "rto",	"txf",	"hpw",		"crce",
+	"prej", "sfdd", "stse", "tx_start", "tx_done",
+};
+
+static struct dwtelem telem;
+static dwtelem_cb_t telem_cb;
+static uint32_t telem_interval_us;
+static uint32_t last_tx_start;
+static uint32_t last_tx_done;
+
+void dwtelem_init(uint32_t interval_ms)
+{
+	memset(&telem, 0, sizeof(telem));
+	telem_interval_us = interval_ms * 1000;
+	telem.time_us = dwtask_get_time_us();
+	last_tx_start = dwmac_get_tx_start_cnt();
+	last_tx_done = dwmac_get_tx_done_cnt();
+	dwt_configeventcounters(1); // clear and enable
+}
+
+const struct dwtelem* dwtelem_sample(void)
+{
+	dwt_deviceentcnts_t c;
+	uint32_t now = dwtask_get_time_us();
+	uint32_t tx_start = dwmac_get_tx_start_cnt();
+	uint32_t tx_done = dwmac_get_tx_done_cnt();
+
+	/* events between reading and clearing are lost, but this is only the
+	 * time of one SPI transfer */
+	dwt_readeventcounters(&c);
+	dwt_configeventcounters(1);
+
+	telem.period_us = now - telem.time_us;
+	telem.time_us = now;
+
+	telem.delta[DWTELEM_PHE] = c.PHE;
+	telem.delta[DWTELEM_RSL] = c.RSL;
+	telem.delta[DWTELEM_CRCG] = c.CRCG;
+	telem.delta[DWTELEM_CRCB] = c.CRCB;
+	telem.delta[DWTELEM_ARFE] = c.ARFE;
+	telem.delta[DWTELEM_OVER] = c.OVER;
+	telem.delta[DWTELEM_SFDTO] = c.SFDTO;
+	telem.delta[DWTELEM_PTO] = c.PTO;
+	telem.delta[DWTELEM_RTO] = c.RTO;
+	telem.delta[DWTELEM_TXF] = c.TXF;
+	telem.delta[DWTELEM_HPW] = c.HPW;
+	telem.delta[DWTELEM_CRCE] = c.CRCE;
+	telem.delta[DWTELEM_PREJ] = c.PREJ;
+#ifdef DRIVER_VERSION_HEX // >= 0x060007
+	telem.delta[DWTELEM_SFDD] = c.SFDD;
+	telem.delta[DWTELEM_STSE] = c.STSE;
+#endif
+	telem.delta[DWTELEM_TX_START] = tx_start - last_tx_start;
+	telem.delta[DWTELEM_TX_DONE] = tx_done - last_tx_done;
+	last_tx_start = tx_start;
+	last_tx_done = tx_done;
+
+	for (int i = 0; i < DWTELEM_NUM; i++) {
+		telem.total[i] += telem.delta[i];
+		telem.rate[i] = telem.period_us > 0
+							? telem.delta[i] * 1000000.0f / telem.period_us
+							: 0;
+	}
+
+	if (telem_cb) {
+		telem_cb(&telem);
+	}
+
+	return &telem;
+}
+
+const struct dwtelem* dwtelem_poll(void)
+{
+	if (telem_interval_us == 0
+		|| dwtask_get_time_us() - telem.time_us < telem_interval_us) {
+		return NULL;
+	}
+	return dwtelem_sample();
+}
+
+const struct dwtelem* dwtelem_get(void)
+{
+	return &telem;
+}
+
+void dwtelem_set_observer(dwtelem_cb_t cb)
+{
+	telem_cb = cb;
+}
+
+void dwtelem_print(const struct dwtelem* t)
+{
+	char buf[DWTELEM_NUM * 40 + 32];
+	int len = snprintf(buf, sizeof(buf), "{\"period_ms\":%" PRIu32,
+					   t->period_us / 1000);
+
+	/* only the deltas and rates which are not zero to keep it compact */
+	for (int i = 0; i < DWTELEM_NUM && len < (int)sizeof(buf); i++) {
+		if (t->delta[i] > 0) {
+			len += snprintf(buf + len, sizeof(buf) - len,
+							",\"%s\":[%" PRIu32 ",%.1f]", cnt_names[i],
+							t->delta[i], t->rate[i]);
+		}
+	}
+
+	LOG_INF("TELEM %s}", buf);
+}
@@ -0,0 +1,69 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_TELEM_H
+#define DECA_TELEM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Periodic telemetry of the DW3000 event counters and the libdeca TX counters.
+ *
+ * The DW3000 counters are only 8 or 12 bit wide and saturate, so they are
+ * read and cleared on every sample. Deltas, per second rates and 32 bit
+ * totals are kept here.
+ */
+
+enum dwtelem_cnt_e {
+	DWTELEM_PHE,	  // header error
+	DWTELEM_RSL,	  // frame sync loss
+	DWTELEM_CRCG,	  // good CRC
+	DWTELEM_CRCB,	  // bad CRC
+	DWTELEM_ARFE,	  // address filter error
+	DWTELEM_OVER,	  // RX buffer overrun
+	DWTELEM_SFDTO,	  // SFD timeout
+	DWTELEM_PTO,	  // preamble timeout
+	DWTELEM_RTO,	  // RX frame wait timeout
+	DWTELEM_TXF,	  // transmitted frames
+	DWTELEM_HPW,	  // half period warning
+	DWTELEM_CRCE,	  // SPI CRC error
+	DWTELEM_PREJ,	  // preamble rejection
+	DWTELEM_SFDD,	  // SFD detection
+	DWTELEM_STSE,	  // STS error/warning
+	DWTELEM_TX_START, // dwmac TX started
+	DWTELEM_TX_DONE,  // dwmac TX done IRQ
+	DWTELEM_NUM,
+};
+
+struct dwtelem {
+	uint32_t time_us;	// host time of this sample
+	uint32_t period_us; // time since last sample
+	uint32_t delta[DWTELEM_NUM];
+	float rate[DWTELEM_NUM]; // per second
+	uint32_t total[DWTELEM_NUM];
+};
+
+typedef void (*dwtelem_cb_t)(const struct dwtelem* t);
+
+/** Clear counters and start sampling every interval_ms from dwtelem_poll() */
+void dwtelem_init(uint32_t interval_ms);
+/** Take a sample now. Uses SPI, so call it from task context */
+const struct dwtelem* dwtelem_sample(void);
+/** Take a sample if the interval has passed, call this periodically. Returns
+ * the new sample or NULL */
+const struct dwtelem* dwtelem_poll(void);
+/** Last sample */
+const struct dwtelem* dwtelem_get(void);
+/** Called for every new sample */
+void dwtelem_set_observer(dwtelem_cb_t cb);
+/** Output sample as one JSON line prefixed with "TELEM " */
+void dwtelem_print(const struct dwtelem* t);
+
+#endif
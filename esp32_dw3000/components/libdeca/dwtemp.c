@@ -0,0 +1,157 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <math.h>
+
+#include <deca_device_api.h>
+
+#include "dwhw.h"
+#include "dwmac.h"
+#include "platform/dwmac_task.h"
+#include "dwphy.h"
+#include "dwtemp.h"
+#include "log.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+static uint32_t temp_interval_us;
+static uint32_t last_sample_us;
+static float temp_cur;
+static float temp_cal;
+static bool temp_cal_set;
+static int16_t antd_cur; // offset applied
+static const struct dwtemp_antd* antd_table;
+static size_t antd_num;
+static dwtemp_cb_t temp_cb;
+
+static float dwtemp_read(void)
+{
+	uint16_t tv = dwt_readtempvbat();
+	return dwt_convertrawtemperature(tv >> 8);
+}
+
+void dwtemp_init(uint32_t interval_ms)
+{
+	temp_interval_us = interval_ms * 1000;
+	temp_cal_set = false;
+	dwtemp_sample();
+}
+
+void dwtemp_set_antd_table(const struct dwtemp_antd* table, size_t num)
+{
+	antd_table = num > 0 ? table : NULL;
+	antd_num = num;
+}
+
+int16_t dwtemp_get_antd_offset(float temp)
+{
+	if (antd_table == NULL) {
+		return 0;
+	}
+
+	if (temp <= antd_table[0].temp) {
+		return antd_table[0].offset;
+	}
+
+	for (size_t i = 1; i < antd_num; i++) {
+		const struct dwtemp_antd* lo = &antd_table[i - 1];
+		const struct dwtemp_antd* hi = &antd_table[i];
+		if (temp <= hi->temp) {
+			float f = (temp - lo->temp) / (hi->temp - lo->temp);
+			return lroundf(lo->offset + f * (hi->offset - lo->offset));
+		}
+	}
+
+	return antd_table[antd_num - 1].offset;
+}
+
+static void dwtemp_recalibrate(void)
+{
+	dwt_forcetrxoff();
+	if (dwt_pll_cal() != DWT_SUCCESS) {
+		LOG_ERR("PLL calibration failed");
+	}
+	dwt_pgf_cal(1);
+	dwmac_rx_reenable();
+}
+
+/* in the MAC task, serialized with the TX and RX handling */
+static void dwtemp_sample_task(void)
+{
+	bool recal = false;
+
+	/* it may have gone to sleep since */
+	if (!dwhw_is_ready()) {
+		return;
+	}
+
+	decaIrqStatus_t stat = decamutexon();
+	temp_cur = dwtemp_read();
+
+	if (!temp_cal_set) {
+		/* reference for the next calibration */
+		temp_cal = temp_cur;
+		temp_cal_set = true;
+	} else if (temp_cur >= temp_cal + CONFIG_DECA_TEMP_RECAL_DEG
+			   || temp_cur <= temp_cal - CONFIG_DECA_TEMP_RECAL_DEG) {
+		LOG_INF("Temperature %.1f (was %.1f), calibrating", (double)temp_cur,
+				(double)temp_cal);
+		temp_cal = temp_cur;
+		dwtemp_recalibrate();
+		recal = true;
+	}
+
+	/* also back to 0 when the table is removed */
+	int16_t offset = dwtemp_get_antd_offset(temp_cur);
+	if (offset != antd_cur) {
+		dwphy_set_antenna_delay_offset(offset);
+		antd_cur = offset;
+	}
+	decamutexoff(stat);
+
+	if (temp_cb) {
+		temp_cb(temp_cur, antd_cur, recal);
+	}
+}
+
+bool dwtemp_sample(void)
+{
+	/* don't wake up the DW3000 */
+	if (!dwhw_is_ready()) {
+		return false;
+	}
+
+	last_sample_us = dwtask_get_time_us();
+	if (dwtask_call(dwtemp_sample_task) != 0) {
+		LOG_ERR("Temperature sample not queued");
+		return false;
+	}
+	return true;
+}
+
+bool dwtemp_poll(void)
+{
+	if (temp_interval_us == 0
+		|| dwtask_get_time_us() - last_sample_us < temp_interval_us) {
+		return false;
+	}
+	return dwtemp_sample();
+}
+
+float dwtemp_get(void)
+{
+	return temp_cur;
+}
+
+void dwtemp_set_observer(dwtemp_cb_t cb)
+{
+	temp_cb = cb;
+}
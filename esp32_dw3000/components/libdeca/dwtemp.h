@@ -0,0 +1,67 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_TEMP_H
+#define DECA_TEMP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if ESP_PLATFORM
+#include <sdkconfig.h>
+#endif
+
+/*
+ * Temperature compensation
+ *
+ * The DW3000 temperature is sampled periodically from dwtemp_poll(), in the
+ * MAC task so it does not interfere with TX and RX. When it has changed by
+ * CONFIG_DECA_TEMP_RECAL_DEG since the last calibration, the PGF (RX filter)
+ * and the PLL are calibrated again. This is the only temperature triggered
+ * calibration. It switches the radio off shortly, so dwtemp_poll() should be
+ * called between exchanges.
+ *
+ * The antenna delay also drifts with temperature. Its offset from the
+ * calibrated antenna delay (dwphy_set_antenna_delay) can be given as a table
+ * of calibration points, which is interpolated linearly and added to it on
+ * every sample. Outside of the table the first or last value is used.
+ */
+#ifndef CONFIG_DECA_TEMP_RECAL_DEG
+#define CONFIG_DECA_TEMP_RECAL_DEG 10
+#endif
+
+struct dwtemp_antd {
+	int8_t temp;	// degree Celsius
+	int16_t offset; // DTU, added to the calibrated antenna delay
+};
+
+/** Called for every sample in the MAC task, recal is true if calibration was
+ * run */
+typedef void (*dwtemp_cb_t)(float temp, int16_t antd_offset, bool recal);
+
+/** Start sampling every interval_ms from dwtemp_poll(). The first sample is
+ * the reference for the next calibration */
+void dwtemp_init(uint32_t interval_ms);
+/** Antenna delay offset table sorted by temperature. It has to stay valid,
+ * NULL disables the compensation */
+void dwtemp_set_antd_table(const struct dwtemp_antd* table, size_t num);
+/** Antenna delay offset for temp from the table, 0 if there is none */
+int16_t dwtemp_get_antd_offset(float temp);
+/** Sample now in the MAC task, from task context. Returns false if the DW3000
+ * is sleeping or the call could not be queued */
+bool dwtemp_sample(void);
+/** Sample if the interval has passed, call this periodically. Returns true if
+ * a sample was taken */
+bool dwtemp_poll(void);
+/** Last sampled temperature */
+float dwtemp_get(void);
+void dwtemp_set_observer(dwtemp_cb_t cb);
+
+#endif
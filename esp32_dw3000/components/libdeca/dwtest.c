@@ -1,14 +1,32 @@
-#include "dwtime.h"
-#include "log.h"
+#include <math.h>
+
 #include <deca_device_api.h>
+#include <deca_version.h>
 // #include <zephyr/timing/timing.h>
 
+#include "bulk.h"
+#include "dwmac.h"
+#include "dwphy.h"
+#include "dwproto.h"
+#include "dwtest.h"
+#include "dwtime.h"
+#include "log.h"
+#include "platform/dwmac_task.h"
+#include "pos.h"
+#include "ranging.h"
+
 static int sizes[] = {10, 12, 14, 15, 16, 18, 20, 50, 100, 200, 512};
 static unsigned char buf[1024] = {1};
 
 static const char* LOG_TAG = "DWTEST";
 
-#define DWTEST_REPETITIONS 1000
+#define DWTEST_REPETITIONS	  1000
+#define DWTEST_TX_REPETITIONS 100
+#define DWTEST_TWR_TIMEOUT_MS 200
+#define DWTEST_POLL_US		  20
+#define DWTEST_TASK_TIMEOUT_MS 1000
+#define DWTEST_BULK_LEN		  4096
+#define DWTEST_BULK_TIMEOUT_MS 5000
 
 #if defined(__ZEPHYR__) && CONFIG_TIMING_FUNCTIONS
 
@@ -55,3 +73,414 @@ void dwtest_spi(void)
 	}
 }
 #endif
+
+/*
+ * Benchmarks
+ *
+ * All benchmarks use the DW3000 system time as time base, so they work the
+ * same on all platforms. Reading the system time is a SPI transfer itself,
+ * so this overhead is measured first and subtracted from single measurements.
+ */
+
+struct bench_stat {
+	uint32_t n;
+	uint64_t sum; // DTU
+	uint64_t min;
+	uint64_t max;
+};
+
+static uint64_t bench_overhead;
+
+static uint64_t bench_diff(uint64_t start, uint64_t end)
+{
+	/* system time wraps after ~17 seconds */
+	return (end - start) & DTU_MASK;
+}
+
+static void bench_stat_reset(struct bench_stat* st)
+{
+	st->n = 0;
+	st->sum = 0;
+	st->min = UINT64_MAX;
+	st->max = 0;
+}
+
+static void bench_stat_add(struct bench_stat* st, uint64_t dtu)
+{
+	st->n++;
+	st->sum += dtu;
+	if (dtu < st->min) {
+		st->min = dtu;
+	}
+	if (dtu > st->max) {
+		st->max = dtu;
+	}
+}
+
+static void bench_output(const char* test, int param, struct bench_stat* st)
+{
+	if (st->n == 0) {
+		LOG_INF("BENCH {\"test\":\"%s\",\"param\":%d,\"n\":0}", test, param);
+		return;
+	}
+
+	LOG_INF("BENCH {\"test\":\"%s\",\"param\":%d,\"n\":%" PRIu32
+			",\"avg_ns\":%" PRIu32 ",\"min_ns\":%" PRIu32 ",\"max_ns\":%" PRIu32
+			"}",
+			test, param, st->n, (uint32_t)DTU_TO_NS(st->sum / st->n),
+			(uint32_t)DTU_TO_NS(st->min), (uint32_t)DTU_TO_NS(st->max));
+}
+
+/* output the average of a loop of DWTEST_REPETITIONS, where min and max are
+ * unknown */
+static void bench_output_loop(const char* test, int param, uint64_t total)
+{
+	LOG_INF("BENCH {\"test\":\"%s\",\"param\":%d,\"n\":%d,\"avg_ns\":%" PRIu32
+			"}",
+			test, param, DWTEST_REPETITIONS,
+			(uint32_t)DTU_TO_NS(total / DWTEST_REPETITIONS));
+}
+
+static void bench_calibrate(void)
+{
+	bench_overhead = UINT64_MAX;
+	for (int i = 0; i < 100; i++) {
+		uint64_t start = dw_get_systime();
+		uint64_t end = dw_get_systime();
+		uint64_t diff = bench_diff(start, end);
+		if (diff < bench_overhead) {
+			bench_overhead = diff;
+		}
+	}
+}
+
+/* single measurement with systime read overhead removed */
+static uint64_t bench_single(uint64_t start, uint64_t end)
+{
+	uint64_t diff = bench_diff(start, end);
+	return diff > bench_overhead ? diff - bench_overhead : 0;
+}
+
+void dwtest_bench_info(void)
+{
+	LOG_INF("BENCH {\"test\":\"info\",\"driver\":\"%s\",\"devid\":\"%08" PRIX32
+			"\",\"spi_mhz\":%d,\"chan\":%d,\"rate_kbps\":%d,\"plen\":%d,"
+			"\"prf\":%d,\"frame_len\":%d}",
+			DRIVER_VERSION_STR, dwt_readdevid(),
+#ifdef CONFIG_DW3000_SPI_MAX_MHZ
+			CONFIG_DW3000_SPI_MAX_MHZ,
+#else
+			0,
+#endif
+			dwphy_get_channel(), dwphy_rate_int(dwphy_get_rate()),
+			dwphy_plen_int(dwphy_get_plen()), dwphy_prf_int(dwphy_get_prf()),
+			DWMAC_RXBUF_LEN);
+}
+
+void dwtest_bench_spi(void)
+{
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		uint64_t start = dw_get_systime();
+		for (int j = 0; j < DWTEST_REPETITIONS; j++) {
+			dwt_writetxdata(sizes[i], buf, 0);
+		}
+		bench_output_loop("spi_write", sizes[i],
+						  bench_single(start, dw_get_systime()));
+	}
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		uint64_t start = dw_get_systime();
+		for (int j = 0; j < DWTEST_REPETITIONS; j++) {
+			dwt_readrxdata(buf, sizes[i], 0);
+		}
+		bench_output_loop("spi_read", sizes[i],
+						  bench_single(start, dw_get_systime()));
+	}
+}
+
+static int bench_tx_len;
+static struct bench_stat bench_tx_st;
+static volatile bool bench_tx_done;
+
+/* in the MAC task, so it does not race with the handling of TX done and RX */
+static void bench_tx_setup_run(void)
+{
+	bench_stat_reset(&bench_tx_st);
+	for (int j = 0; j < DWTEST_TX_REPETITIONS; j++) {
+		uint64_t start = dw_get_systime();
+
+		/* delayed TX far enough in the future to never happen */
+		struct txbuf* tx = dwmac_txbuf_get();
+		dwprot_short_prepare(tx, bench_tx_len, 0, 0xffff);
+		dwmac_tx_set_txtime(tx, (start + (uint64_t)MS_TO_DTU(100)) & DTU_MASK);
+		bool res = dwmac_transmit(tx);
+
+		uint64_t end = dw_get_systime();
+
+		dwt_forcetrxoff();
+		dwmac_handle_tx_done(); // release current TX
+
+		if (res) {
+			bench_stat_add(&bench_tx_st, bench_single(start, end));
+		}
+	}
+	dwmac_rx_reenable();
+	bench_tx_done = true;
+}
+
+void dwtest_bench_tx_setup(void)
+{
+	static const int payload_sizes[] = {0, 10, 50};
+
+	for (size_t i = 0; i < sizeof(payload_sizes) / sizeof(payload_sizes[0]);
+		 i++) {
+		bench_tx_len = payload_sizes[i];
+		bench_tx_done = false;
+		if (dwtask_call(bench_tx_setup_run) != 0) {
+			LOG_ERR("BENCH tx_setup: MAC task call failed");
+			return;
+		}
+		/* sleep, so the MAC task can run on the same core */
+		for (int t = 0; !bench_tx_done; t++) {
+			if (t > DWTEST_TASK_TIMEOUT_MS) {
+				LOG_ERR("BENCH tx_setup: timeout");
+				return;
+			}
+			deca_sleep(1);
+		}
+		bench_output("tx_setup", payload_sizes[i], &bench_tx_st);
+	}
+}
+
+static volatile uint32_t bench_twr_failed;
+
+static void bench_twr_cb(uint64_t src, uint64_t dst, uint16_t dist,
+						 uint16_t num)
+{
+	if (dist == TWR_FAILED_VALUE) {
+		bench_twr_failed++;
+	}
+}
+
+static bool bench_wait_twr(void)
+{
+	for (int i = 0; i < DWTEST_TWR_TIMEOUT_MS * 1000 / DWTEST_POLL_US; i++) {
+		if (!twr_in_progress()) {
+			return true;
+		}
+		deca_usleep(DWTEST_POLL_US);
+	}
+	return false;
+}
+
+bool dwtest_bench_twr(uint64_t dst, int rounds, bool single_sided)
+{
+	struct bench_stat st_round;
+	struct bench_stat st_rx_irq;
+	struct bench_stat st_isr;
+	struct bench_stat st_irq_task;
+	uint64_t total = 0;
+	uint32_t ok = 0;
+
+	bench_stat_reset(&st_round);
+	bench_stat_reset(&st_rx_irq);
+	bench_stat_reset(&st_isr);
+	bench_stat_reset(&st_irq_task);
+
+	twr_cb_t prev_cb = twr_get_observer();
+	twr_set_observer(bench_twr_cb);
+	dwmac_set_irq_timing(true);
+	const struct dwmac_irq_timing* it = dwmac_get_irq_timing();
+
+	uint64_t last = dw_get_systime();
+
+	for (int i = 0; i < rounds; i++) {
+		uint32_t failed = bench_twr_failed;
+		uint64_t start = dw_get_systime();
+
+		bool res = single_sided ? twr_start_ss(dst) : twr_start(dst);
+		if (!res || !bench_wait_twr()) {
+			twr_cancel();
+			continue;
+		}
+
+		uint64_t end = dw_get_systime();
+		total += bench_diff(last, end);
+		last = end;
+
+		if (bench_twr_failed != failed) {
+			continue;
+		}
+
+		ok++;
+		bench_stat_add(&st_round, bench_single(start, end));
+
+		/* timing of the last frame received in this round */
+		bench_stat_add(&st_rx_irq, bench_diff(it->rx_ts, it->irq_start));
+		bench_stat_add(&st_isr, bench_diff(it->irq_start, it->irq_end));
+		bench_stat_add(&st_irq_task, bench_diff(it->irq_end, it->task_start));
+	}
+
+	dwmac_set_irq_timing(false);
+	twr_set_observer(prev_cb);
+
+	bench_output(single_sided ? "sstwr_round" : "dstwr_round", rounds,
+				 &st_round);
+	bench_output("rx_to_irq", rounds, &st_rx_irq);
+	bench_output("irq_rx_cb", rounds, &st_isr);
+	bench_output("irq_to_task", rounds, &st_irq_task);
+
+	uint32_t total_us = DTU_TO_US(total);
+	LOG_INF("BENCH {\"test\":\"%s\",\"param\":%d,\"ok\":%" PRIu32
+			",\"total_us\":%" PRIu32 ",\"ranges_per_s\":%" PRIu32 "}",
+			single_sided ? "sstwr_rate" : "dstwr_rate", rounds, ok, total_us,
+			total_us ? (uint32_t)((uint64_t)ok * 1000000 / total_us) : 0);
+
+	return ok > 0;
+}
+
+static volatile bool bench_bulk_ok;
+
+static void bench_bulk_cb(uint64_t dst, uint32_t len, bool ok)
+{
+	bench_bulk_ok = ok;
+}
+
+bool dwtest_bench_bulk(uint64_t dst, uint32_t len, int rounds)
+{
+	static uint8_t data[DWTEST_BULK_LEN];
+	uint64_t total = 0;
+	uint32_t ok = 0;
+
+	if (len > sizeof(data)) {
+		len = sizeof(data);
+	}
+	for (size_t i = 0; i < len; i++) {
+		data[i] = i;
+	}
+
+	struct bulk_stats st_start = *bulk_get_stats();
+
+	for (int i = 0; i < rounds; i++) {
+		bench_bulk_ok = false;
+		uint64_t start = dw_get_systime();
+
+		if (!bulk_send(dst, data, len, bench_bulk_cb)) {
+			continue;
+		}
+
+		for (int j = 0; j < DWTEST_BULK_TIMEOUT_MS * 1000 / DWTEST_POLL_US
+						&& bulk_in_progress();
+			 j++) {
+			deca_usleep(DWTEST_POLL_US);
+		}
+
+		if (bulk_in_progress()) {
+			bulk_cancel();
+			continue;
+		}
+
+		if (bench_bulk_ok) {
+			total += bench_single(start, dw_get_systime());
+			ok++;
+		}
+	}
+
+	const struct bulk_stats* st = bulk_get_stats();
+
+	/* upper limit with pacing: payload of one full frame per frame time */
+	size_t frag = bulk_get_frag_size(dst);
+	uint32_t frame_us
+		= PKTTIME_TO_USEC(dwphy_calc_packet_time(
+			  dwphy_get_rate(), dwphy_get_plen(), dwphy_get_prf(),
+			  DWMAC_TXBUF_LEN))
+		  + BULK_FRAME_GAP_US;
+
+	uint32_t total_us = DTU_TO_US(total);
+	LOG_INF("BENCH {\"test\":\"bulk\",\"param\":%" PRIu32 ",\"ok\":%" PRIu32
+			",\"total_us\":%" PRIu32 ",\"goodput_kbps\":%" PRIu32
+			",\"paced_kbps\":%" PRIu32 ",\"rate_kbps\":%d,\"frag\":%d"
+			",\"frames\":%" PRIu32 ",\"retrans\":%" PRIu32 ",\"late\":%" PRIu32
+			",\"polls\":%" PRIu32 "}",
+			len, ok, total_us,
+			total_us ? (uint32_t)((uint64_t)ok * len * 8 * 1000 / total_us)
+					 : 0,
+			(uint32_t)((uint64_t)frag * 8 * 1000 / frame_us),
+			dwphy_rate_int(dwphy_get_rate()), (int)frag,
+			st->frames - st_start.frames, st->retrans - st_start.retrans,
+			st->late - st_start.late, st->polls - st_start.polls);
+
+	return ok > 0;
+}
+
+/* anchors at different heights in a 10 x 8 m room */
+static const struct pos_anchor bench_anchors[] = {
+	{1, 0, 0, 2.5f}, {2, 10, 0, 2.0f}, {3, 10, 8, 2.8f},
+	{4, 0, 8, 1.0f}, {5, 5, -1, 0.5f}, {6, 5, 9, 2.2f},
+};
+#define BENCH_NUM_ANCHORS (sizeof(bench_anchors) / sizeof(bench_anchors[0]))
+
+static void bench_pos_one(const char* test, size_t num, bool is_3d, bool tdoa,
+						  int rounds)
+{
+	const float tag[3] = {3.3f, 4.7f, 1.2f};
+	float m[BENCH_NUM_ANCHORS];
+	struct bench_stat st;
+	struct pos_fix fix;
+
+	/* distances with some cm of noise */
+	for (size_t i = 0; i < num; i++) {
+		const struct pos_anchor* a = &bench_anchors[i];
+		float dx = tag[0] - a->x;
+		float dy = tag[1] - a->y;
+		float dz = tag[2] - a->z;
+		m[i] = sqrtf(dx * dx + dy * dy + dz * dz) + ((i & 1) ? 0.02f : -0.01f);
+	}
+	if (tdoa) {
+		for (size_t i = num; i-- > 0;) {
+			m[i] -= m[0];
+		}
+	}
+
+	bench_stat_reset(&st);
+	for (int i = 0; i < rounds; i++) {
+		uint64_t start = dw_get_systime();
+		bool ok = tdoa
+					  ? pos_solve_tdoa(bench_anchors, m, num, is_3d, tag[2], &fix)
+					  : pos_solve_twr(bench_anchors, m, num, is_3d, tag[2], &fix);
+		uint64_t end = dw_get_systime();
+		if (ok) {
+			bench_stat_add(&st, bench_single(start, end));
+		}
+	}
+	bench_output(test, num, &st);
+}
+
+void dwtest_bench_pos(int rounds)
+{
+	for (size_t num = 4; num <= BENCH_NUM_ANCHORS; num += 2) {
+		bench_pos_one("pos_twr_2d", num, false, false, rounds);
+		bench_pos_one("pos_twr_3d", num, true, false, rounds);
+		bench_pos_one("pos_tdoa_2d", num, false, true, rounds);
+		bench_pos_one("pos_tdoa_3d", num, true, true, rounds);
+	}
+}
+
+void dwtest_bench(uint64_t twr_peer, int rounds)
+{
+	bench_calibrate();
+	dwtest_bench_info();
+	LOG_INF("BENCH {\"test\":\"systime_read\",\"param\":0,\"n\":1,"
+			"\"avg_ns\":%" PRIu32 "}",
+			(uint32_t)DTU_TO_NS(bench_overhead));
+
+	dwtest_bench_spi();
+	dwtest_bench_tx_setup();
+	dwtest_bench_pos(rounds);
+
+	if (twr_peer != 0) {
+		dwtest_bench_twr(twr_peer, rounds, false);
+		dwtest_bench_twr(twr_peer, rounds, true);
+		dwtest_bench_bulk(twr_peer, DWTEST_BULK_LEN, rounds / 10 + 1);
+	}
+}
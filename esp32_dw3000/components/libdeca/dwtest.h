@@ -1,3 +1,32 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 void dwtest_spi(void);
+
+/*
+ * On-target benchmarks. Results are output as one JSON object per line,
+ * prefixed with "BENCH ", so they can be collected from the log and compared
+ * between boards, SPI clocks and firmware versions. All times are in ns.
+ *
+ * Run these from a task with lower priority than the dwmac task, after the
+ * library has been initialized (dwhw_init, dwphy_config, dwmac_init, twr_init)
+ */
+
+/** Run all benchmarks. TWR and bulk transfer benchmarks are only run if
+ * twr_peer is not 0 */
+void dwtest_bench(uint64_t twr_peer, int rounds);
+/** Output firmware, driver and PHY configuration */
+void dwtest_bench_info(void);
+/** SPI write and read time per transfer size */
+void dwtest_bench_spi(void);
+/** Time to prepare and schedule a delayed TX frame */
+void dwtest_bench_tx_setup(void);
+/** TWR round duration, IRQ timing and maximum sustained ranges per second */
+bool dwtest_bench_twr(uint64_t dst, int rounds, bool single_sided);
+/** Goodput of bulk transfers of len bytes (max 4096) */
+bool dwtest_bench_bulk(uint64_t dst, uint32_t len, int rounds);
+/** Solve time per position fix (TWR and TDoA, 2D and 3D) per number of
+ * anchors */
+void dwtest_bench_pos(int rounds);
@@ -13,3 +13,56 @@ void mac154_set_frame_pending(uint8_t* buf)
 {
 	buf[0] |= MAC154_FC_FRAME_PEND;
 }
+
+static size_t mac154_addr_len(uint16_t mode)
+{
+	switch (mode) {
+	case MAC154_FC_DST_ADDR_SHORT:
+		return 2;
+	case MAC154_FC_DST_ADDR_LONG:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+size_t mac154_hdr_len(uint16_t fc)
+{
+	uint8_t type = fc & MAC154_FC_TYPE_MASK;
+	if ((type != MAC154_FC_TYPE_DATA && type != MAC154_FC_TYPE_COMMAND)
+		|| (fc & MAC154_FC_IE_PRESENT)) {
+		return 0;
+	}
+
+	bool comp = fc & MAC154_FC_PAN_ID_COMP;
+	uint16_t dst_mode = fc & MAC154_FC_DST_ADDR_MASK;
+	uint16_t src_mode = (fc & MAC154_FC_SRC_ADDR_MASK) >> 4;
+	size_t dst_len = mac154_addr_len(dst_mode);
+	size_t src_len = mac154_addr_len(src_mode);
+	size_t len = 2 + (fc & MAC154_FC_SEQ_SUPP ? 0 : 1) + dst_len + src_len;
+
+	/* PAN IDs (table 7-2 of 802.15.4-2020 for version 2) */
+	if ((fc & MAC154_FC_VERSION_MASK) != MAC154_FC_VERSION_2) {
+		len += (dst_len ? 2 : 0) + (src_len && !comp ? 2 : 0);
+	} else if (!dst_len || !src_len) {
+		len += (dst_len || src_len) != comp ? 2 : 0;
+	} else if (dst_len == 8 && src_len == 8) {
+		len += comp ? 0 : 2;
+	} else {
+		len += 2 + (comp ? 0 : 2);
+	}
+	return len;
+}
+
+bool mac154_is_secured(uint16_t fc)
+{
+	uint8_t type = fc & MAC154_FC_TYPE_MASK;
+	return (type == MAC154_FC_TYPE_DATA || type == MAC154_FC_TYPE_COMMAND)
+		   && (fc & MAC154_FC_SECURITY);
+}
+
+uint8_t mac154_mic_len(uint8_t level)
+{
+	level &= 0x03;
+	return level ? 2 << level : 0;
+}
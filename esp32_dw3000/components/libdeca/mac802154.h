@@ -10,6 +10,8 @@
 #ifndef MAC_802_15_4
 #define MAC_802_15_4
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define MAC154_FC_TYPE_MASK		 0x0007 /* Frame Type */
@@ -57,6 +59,9 @@
 #define MAC154_SEC_KEY_ID_8BYTE		  0x18
 #define MAC154_SEC_FRAME_COUNTER_SUPP 0x20
 #define MAC154_SEC_ASN_IN_NONCE		  0x40
+#define MAC154_SEC_LVL_MASK			  0x07
+#define MAC154_SEC_LVL_ENC			  0x04 /* payload encrypted */
+#define MAC154_SEC_KEY_ID_MASK		  0x18
 
 #define MAC154_IE_TYPE_HEADER	 0x0
 #define MAC154_IE_TYPE_PAYLOAD	 0x1
@@ -109,6 +114,10 @@
 	(MAC154_FC_TYPE_MULTI | MAC154_FC_MULTI_SRC_ADDR_LONG)
 
 #define MAC154_FCS_LEN 2
+/* Imm-Ack: FC, sequence number and FCS */
+#define MAC154_ACK_LEN 5
+/* FC, sequence number, PAN ID, short destination and source address */
+#define MAC154_HDR_CMP_LEN 9
 
 #define MAC154_IE 0
 
@@ -167,6 +176,21 @@ struct mac154_hdr_long {
 	uint64_t src;
 } __attribute__((packed));
 
+/* auxiliary security header with frame counter and key index, follows the
+ * addressing fields when MAC154_FC_SECURITY is set */
+struct mac154_aux_sec_idx {
+	uint8_t ctrl; // level and MAC154_SEC_KEY_ID_INDEX
+	uint32_t frame_counter;
+	uint8_t key_index;
+} __attribute__((packed));
+
 void mac154_set_frame_pending(uint8_t* buf);
+/** Length of FC, sequence number and addressing fields of a data frame,
+ * 0 for frames with IEs or unsupported types */
+size_t mac154_hdr_len(uint16_t fc);
+/** Data or command frame with the security bit */
+bool mac154_is_secured(uint16_t fc);
+/** Length of the MIC for a security level */
+uint8_t mac154_mic_len(uint8_t level);
 
 #endif
@@ -9,13 +9,24 @@
 
 #pragma once
 
+#include <stdint.h>
+
 enum dwevent_e
 {
     DWEVT_RX,
     DWEVT_RX_TIMEOUT,
     DWEVT_TX_DONE,
     DWEVT_ERR,
+    DWEVT_SPI_RDY, /* DW3000 woke up */
+    DWEVT_CALL,    /* call a function in the MAC task */
 };
 
+typedef void (*dwtask_fn_t)(void);
+
 int dwtask_init();
 int dwtask_queue_event(enum dwevent_e type, const void* data);
+/* run fn in the MAC task, serialized with the event handling, from task
+ * context only */
+int dwtask_call(dwtask_fn_t fn);
+/* free running host time in microseconds, may be called from IRQ context */
+uint32_t dwtask_get_time_us(void);
@@ -0,0 +1,18 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* persistent per-device storage of small values (NVS on ESP-IDF, settings on
+ * Zephyr). Returns false if the key was not found or it is not supported */
+bool dwstore_read(const char* key, void* data, size_t len);
+bool dwstore_write(const char* key, const void* data, size_t len);
@@ -8,12 +8,14 @@
  */
 
 #include <esp_err.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 #include <freertos/task.h>
 
 #include "dw3000_hw.h"
 #include "dwhw.h"
+#include "dwlog.h"
 #include "dwmac.h"
 #include "dwmac_task.h"
 #include "dwphy.h"
@@ -24,6 +26,10 @@
 #define DWMAC_TASK_PRIO		  5	   // TODO
 #define DWMAC_QUEUE_LEN		  10
 
+#define DWLOG_TASK_STACK_SIZE 3072
+#define DWLOG_TASK_PRIO		  1
+#define DWLOG_TASK_PERIOD_MS  20
+
 struct dwmac_event_s {
 	enum dwevent_e type;
 	union {
@@ -36,6 +42,9 @@ static const char* LOG_TAG = "DWTASK";
 static TaskHandle_t dwmac_task_hdl;
 static QueueHandle_t dwmac_queue;
 static struct dwmac_event_s dwmac_evt;
+#if CONFIG_DECA_LOG_DEFERRED
+static TaskHandle_t dwlog_task_hdl;
+#endif
 
 static void dwmac_task(void* pvParameters)
 {
@@ -57,11 +66,29 @@ static void dwmac_task(void* pvParameters)
 				break;
 			case DWEVT_ERR:
 				dwmac_handle_error(dwmac_evt.u.status);
+				break;
+			case DWEVT_SPI_RDY:
+				dwhw_handle_spi_ready();
+				break;
+			case DWEVT_CALL:
+				((dwtask_fn_t)dwmac_evt.u.ptr)();
+				break;
 			}
 		}
 	}
 }
 
+#if CONFIG_DECA_LOG_DEFERRED
+static void dwlog_task(void* pvParameters)
+{
+	while (true) {
+		if (dwlog_process(CONFIG_DECA_LOG_DEFERRED_ENTRIES) == 0) {
+			vTaskDelay(pdMS_TO_TICKS(DWLOG_TASK_PERIOD_MS));
+		}
+	}
+}
+#endif
+
 int dwtask_init(void)
 {
 	if (dwmac_queue == NULL) {
@@ -82,6 +109,18 @@ int dwtask_init(void)
 			return ESP_FAIL;
 		}
 	}
+
+#if CONFIG_DECA_LOG_DEFERRED
+	if (dwlog_task_hdl == NULL) {
+		BaseType_t err
+			= xTaskCreate(dwlog_task, "dwlog_task", DWLOG_TASK_STACK_SIZE, NULL,
+						  DWLOG_TASK_PRIO, &dwlog_task_hdl);
+		if (err != pdTRUE) {
+			LOG_ERR("create log task failed");
+			return ESP_FAIL;
+		}
+	}
+#endif
 	return ESP_OK;
 }
 
@@ -91,7 +130,7 @@ int dwtask_queue_event(enum dwevent_e type, const void* data)
 		.type = type,
 	};
 
-	if (type == DWEVT_RX) {
+	if (type == DWEVT_RX || type == DWEVT_CALL) {
 		evt.u.ptr = data;
 	} else if (type == DWEVT_RX_TIMEOUT || type == DWEVT_ERR) {
 		evt.u.status = *(uint32_t*)data;
@@ -112,3 +151,22 @@ int dwtask_queue_event(enum dwevent_e type, const void* data)
 
 	return ESP_OK;
 }
+
+int dwtask_call(dwtask_fn_t fn)
+{
+	struct dwmac_event_s evt = {
+		.type = DWEVT_CALL,
+		.u.ptr = fn,
+	};
+
+	if (xQueueSendToBack(dwmac_queue, &evt, portMAX_DELAY) != pdTRUE) {
+		LOG_ERR("Queue failed");
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+uint32_t dwtask_get_time_us(void)
+{
+	return (uint32_t)esp_timer_get_time();
+}
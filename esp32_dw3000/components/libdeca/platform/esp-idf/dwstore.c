@@ -0,0 +1,50 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <nvs.h>
+
+#include "dwstore.h"
+#include "log.h"
+
+#define DWSTORE_NAMESPACE "libdeca"
+
+static const char* LOG_TAG = "DECA";
+
+/* nvs_flash_init() has to be called by the application */
+bool dwstore_read(const char* key, void* data, size_t len)
+{
+	nvs_handle_t h;
+	size_t l = len;
+
+	if (nvs_open(DWSTORE_NAMESPACE, NVS_READONLY, &h) != ESP_OK) {
+		return false;
+	}
+	esp_err_t err = nvs_get_blob(h, key, data, &l);
+	nvs_close(h);
+	return err == ESP_OK && l == len;
+}
+
+bool dwstore_write(const char* key, const void* data, size_t len)
+{
+	nvs_handle_t h;
+
+	if (nvs_open(DWSTORE_NAMESPACE, NVS_READWRITE, &h) != ESP_OK) {
+		LOG_ERR("NVS open failed");
+		return false;
+	}
+	esp_err_t err = nvs_set_blob(h, key, data, len);
+	if (err == ESP_OK) {
+		err = nvs_commit(h);
+	}
+	nvs_close(h);
+	if (err != ESP_OK) {
+		LOG_ERR("NVS write %s failed", key);
+	}
+	return err == ESP_OK;
+}
@@ -19,11 +19,17 @@
 
 #define DBG_UWB(...) ESP_LOGD(LOG_TAG, __VA_ARGS__)
 
+#if CONFIG_DECA_LOG_DEFERRED
+#include "dwlog.h"
+#define LOG_INF_IRQ(...) DWLOG(DWLOG_LVL_INF, __VA_ARGS__)
+#define LOG_ERR_IRQ(...) DWLOG(DWLOG_LVL_ERR, __VA_ARGS__)
+#else
 #define LOG_INF_IRQ(...) ESP_DRAM_LOGI(LOG_TAG, __VA_ARGS__)
 #define LOG_ERR_IRQ(...) ESP_DRAM_LOGE(LOG_TAG, __VA_ARGS__)
+#endif
 
 #if CONFIG_DECA_DEBUG_OUTPUT_IRQ
-#define DBG_UWB_IRQ(...) ESP_DRAM_LOGI(LOG_TAG, __VA_ARGS__)
+#define DBG_UWB_IRQ(...) LOG_INF_IRQ(__VA_ARGS__)
 #else
 #define DBG_UWB_IRQ(...) // don't log
 #endif
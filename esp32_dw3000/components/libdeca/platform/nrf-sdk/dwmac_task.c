@@ -7,8 +7,13 @@
  * Version 3. See the file LICENSE.txt for more details.
  */
 
+#include <string.h>
+
 #include "app_scheduler.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
 
+#include "dwhw.h"
 #include "dwmac.h"
 #include "log.h"
 #include "platform/dwmac_task.h"
@@ -41,6 +46,18 @@ static void dwmac_sched_error(void* data, uint16_t size)
 	dwmac_handle_error(*(uint32_t*)data);
 }
 
+static void dwmac_sched_spi_ready(void* data, uint16_t size)
+{
+	dwhw_handle_spi_ready();
+}
+
+static void dwmac_sched_call(void* data, uint16_t size)
+{
+	dwtask_fn_t fn;
+	memcpy(&fn, data, sizeof(fn));
+	fn();
+}
+
 int dwtask_queue_event(enum dwevent_e type, const void* data)
 {
 	ret_code_t ret = NRF_ERROR_INVALID_PARAM;
@@ -54,6 +71,10 @@ int dwtask_queue_event(enum dwevent_e type, const void* data)
 		ret = app_sched_event_put(NULL, 0, dwmac_sched_tx_done);
 	} else if (type == DWEVT_ERR) {
 		ret = app_sched_event_put(data, 4, dwmac_sched_error);
+	} else if (type == DWEVT_SPI_RDY) {
+		ret = app_sched_event_put(NULL, 0, dwmac_sched_spi_ready);
+	} else if (type == DWEVT_CALL) {
+		ret = app_sched_event_put(&data, sizeof(data), dwmac_sched_call);
 	} else {
 		LOG_ERR("Unknown event %d", type);
 	}
@@ -64,3 +85,29 @@ int dwtask_queue_event(enum dwevent_e type, const void* data)
 
 	return ret;
 }
+
+int dwtask_call(dwtask_fn_t fn)
+{
+	return dwtask_queue_event(DWEVT_CALL, fn);
+}
+
+/* Note: resolution is one RTC tick (~30 us). The 24 bit RTC counter wraps
+ * after 512 seconds, the wraps are counted so the microseconds wrap at 32 bit.
+ * A wrap is only seen if this is called at least once in 512 seconds */
+uint32_t dwtask_get_time_us(void)
+{
+	static uint32_t last_cnt;
+	static uint64_t wraps;
+	uint64_t ticks;
+
+	CRITICAL_REGION_ENTER();
+	uint32_t cnt = app_timer_cnt_get();
+	if (cnt < last_cnt) {
+		wraps++;
+	}
+	last_cnt = cnt;
+	ticks = (wraps << 24) | cnt;
+	CRITICAL_REGION_EXIT();
+
+	return (uint32_t)(ticks * 1000000 / APP_TIMER_CLOCK_FREQ);
+}
@@ -0,0 +1,22 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include "platform/dwstore.h"
+
+/* FDS is asynchronous and configured by the application, so persistent
+ * storage is not implemented here */
+bool dwstore_read(const char* key, void* data, size_t len)
+{
+	return false;
+}
+
+bool dwstore_write(const char* key, const void* data, size_t len)
+{
+	return false;
+}
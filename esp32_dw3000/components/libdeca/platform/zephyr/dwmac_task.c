@@ -7,12 +7,24 @@
  * Version 3. See the file LICENSE.txt for more details.
  */
 
+#include <zephyr/kernel.h>
+
+#include "dwhw.h"
 #include "dwmac.h"
 #include "platform/dwmac_task.h"
 #include "log.h"
 
+static struct k_work call_work;
+static dwtask_fn_t call_fn;
+
+static void dwtask_call_work_handler(struct k_work* item)
+{
+	call_fn();
+}
+
 int dwtask_init()
 {
+	k_work_init(&call_work, dwtask_call_work_handler);
 	return 0;
 }
 
@@ -28,9 +40,34 @@ int dwtask_queue_event(enum dwevent_e type, const void* data)
 		dwmac_handle_tx_done();
 	} else if (type == DWEVT_ERR) {
 		dwmac_handle_error(*(uint32_t*)data);
+	} else if (type == DWEVT_SPI_RDY) {
+		dwhw_handle_spi_ready();
+	} else if (type == DWEVT_CALL) {
+		((dwtask_fn_t)data)();
 	} else {
 		LOG_ERR("Unknown event %d", type);
 	}
 
 	return 0;
 }
+
+/* on the system workqueue like the ISR work, one call at a time */
+int dwtask_call(dwtask_fn_t fn)
+{
+	if (k_work_is_pending(&call_work)) {
+		return -EBUSY;
+	}
+	call_fn = fn;
+	return k_work_submit(&call_work) < 0 ? -EIO : 0;
+}
+
+/* converted from a 64 bit time, so the microseconds wrap at 32 bit and not
+ * when the 32 bit cycle counter wraps */
+uint32_t dwtask_get_time_us(void)
+{
+#if CONFIG_TIMER_HAS_64BIT_CYCLE_COUNTER
+	return (uint32_t)k_cyc_to_us_floor64(k_cycle_get_64());
+#else
+	return (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks());
+#endif
+}
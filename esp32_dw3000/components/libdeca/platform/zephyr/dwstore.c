@@ -0,0 +1,78 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <stdio.h>
+
+#include <zephyr/kernel.h>
+#if CONFIG_SETTINGS
+#include <zephyr/settings/settings.h>
+#endif
+
+#include "platform/dwstore.h"
+#include "log.h"
+
+#define DWSTORE_SUBTREE "libdeca"
+
+#if CONFIG_SETTINGS
+
+struct dwstore_load {
+	void* data;
+	size_t len;
+	bool found;
+};
+
+static int dwstore_load_cb(const char* key, size_t len,
+						   settings_read_cb read_cb, void* cb_arg, void* param)
+{
+	struct dwstore_load* ld = param;
+
+	/* only the exact key, not its children */
+	if (settings_name_next(key, NULL) != 0 || len != ld->len) {
+		return 0;
+	}
+	ld->found = read_cb(cb_arg, ld->data, ld->len) == (ssize_t)ld->len;
+	return 0;
+}
+
+/* settings_subsys_init() has to be called by the application */
+bool dwstore_read(const char* key, void* data, size_t len)
+{
+	char name[SETTINGS_MAX_NAME_LEN];
+	struct dwstore_load ld = {.data = data, .len = len};
+
+	snprintf(name, sizeof(name), DWSTORE_SUBTREE "/%s", key);
+	settings_load_subtree_direct(name, dwstore_load_cb, &ld);
+	return ld.found;
+}
+
+bool dwstore_write(const char* key, const void* data, size_t len)
+{
+	char name[SETTINGS_MAX_NAME_LEN];
+
+	snprintf(name, sizeof(name), DWSTORE_SUBTREE "/%s", key);
+	if (settings_save_one(name, data, len) != 0) {
+		LOG_ERR("Settings write %s failed", name);
+		return false;
+	}
+	return true;
+}
+
+#else
+
+bool dwstore_read(const char* key, void* data, size_t len)
+{
+	return false;
+}
+
+bool dwstore_write(const char* key, const void* data, size_t len)
+{
+	return false;
+}
+
+#endif
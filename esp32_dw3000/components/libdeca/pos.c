@@ -0,0 +1,192 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <string.h>
+
+#include <deca_device_api.h>
+
+#include "dwtime.h"
+#include "dwutil.h"
+#include "log.h"
+#include "pos.h"
+#include "ranging.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+/* measurements of one tag in the current round */
+struct pos_tag {
+	uint64_t addr;
+	uint32_t seq; // TDoA: blink sequence number
+	uint32_t mask; // anchors which have reported
+	bool tdoa;
+	union {
+		float dist_m[POS_MAX_ANCHORS];
+		uint64_t ts[POS_MAX_ANCHORS];
+	};
+};
+
+static struct pos_anchor anchors[POS_MAX_ANCHORS];
+static size_t num_anchors;
+static bool pos_3d;
+static float pos_z;
+static struct pos_tag tags[POS_MAX_TAGS];
+static size_t tag_next; // replaced next if the table is full
+static pos_cb_t pos_cb;
+
+bool pos_init(const struct pos_anchor* a, size_t num, bool is_3d)
+{
+	if (num > POS_MAX_ANCHORS) {
+		LOG_ERR("Too many anchors");
+		return false;
+	}
+
+	memcpy(anchors, a, num * sizeof(anchors[0]));
+	num_anchors = num;
+	pos_3d = is_3d;
+	memset(tags, 0, sizeof(tags));
+	tag_next = 0;
+	return true;
+}
+
+void pos_set_height(float z)
+{
+	pos_z = z;
+}
+
+void pos_set_observer(pos_cb_t cb)
+{
+	pos_cb = cb;
+}
+
+static int pos_find_anchor(uint64_t addr)
+{
+	for (size_t i = 0; i < num_anchors; i++) {
+		if (anchors[i].addr == addr) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static struct pos_tag* pos_get_tag(uint64_t addr, bool tdoa)
+{
+	for (size_t i = 0; i < POS_MAX_TAGS; i++) {
+		if (tags[i].addr == addr && tags[i].tdoa == tdoa) {
+			return &tags[i];
+		}
+	}
+
+	struct pos_tag* t = &tags[tag_next];
+	tag_next = (tag_next + 1) % POS_MAX_TAGS;
+	memset(t, 0, sizeof(*t));
+	t->addr = addr;
+	t->tdoa = tdoa;
+	return t;
+}
+
+static void pos_solve_round(struct pos_tag* t)
+{
+	struct pos_anchor a[POS_MAX_ANCHORS];
+	float m[POS_MAX_ANCHORS];
+	struct pos_fix fix;
+	size_t n = 0;
+	int ref = -1;
+	bool ok;
+
+	for (size_t i = 0; i < num_anchors; i++) {
+		if (!(t->mask & (1 << i))) {
+			continue;
+		}
+		a[n] = anchors[i];
+		if (!t->tdoa) {
+			m[n] = t->dist_m[i];
+		} else {
+			/* range difference to the first anchor, 40 bit timestamps */
+			if (ref < 0) {
+				ref = i;
+			}
+			int64_t diff = (int64_t)((t->ts[i] - t->ts[ref]) << 24) >> 24;
+			m[n] = DTU_TO_DISTANCE(diff);
+		}
+		n++;
+	}
+
+	t->mask = 0;
+
+	if (t->tdoa) {
+		ok = pos_solve_tdoa(a, m, n, pos_3d, pos_z, &fix);
+	} else {
+		ok = pos_solve_twr(a, m, n, pos_3d, pos_z, &fix);
+	}
+
+	if (!ok) {
+		LOG_DBG("No fix for " LADDR_FMT " with %d anchors",
+				LADDR_PAR(t->addr), (int)n);
+		return;
+	}
+
+	if (pos_cb) {
+		pos_cb(t->addr, &fix);
+	}
+}
+
+static bool pos_round_complete(const struct pos_tag* t)
+{
+	return t->mask == (1U << num_anchors) - 1;
+}
+
+void pos_handle_twr(uint64_t src, uint64_t dst, uint16_t dist, uint16_t num)
+{
+	if (dist == TWR_FAILED_VALUE || dist == TWR_OK_VALUE) {
+		return;
+	}
+
+	/* the initiator is the tag, on both sides */
+	int i = pos_find_anchor(dst);
+	if (i < 0) {
+		return;
+	}
+
+	struct pos_tag* t = pos_get_tag(src, false);
+	if (t->mask & (1 << i)) {
+		/* next round started */
+		pos_solve_round(t);
+	}
+
+	t->dist_m[i] = dist / 100.0f;
+	t->mask |= 1 << i;
+
+	if (pos_round_complete(t)) {
+		pos_solve_round(t);
+	}
+}
+
+void pos_handle_tdoa(uint64_t tag, uint32_t seq, uint64_t anchor, uint64_t ts)
+{
+	int i = pos_find_anchor(anchor);
+	if (i < 0) {
+		return;
+	}
+
+	struct pos_tag* t = pos_get_tag(tag, true);
+	if (t->mask != 0 && t->seq != seq) {
+		/* next blink, not all anchors have received the last one */
+		pos_solve_round(t);
+	}
+
+	t->seq = seq;
+	t->ts[i] = ts;
+	t->mask |= 1 << i;
+
+	if (pos_round_complete(t)) {
+		pos_solve_round(t);
+	}
+}
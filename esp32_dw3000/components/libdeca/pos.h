@@ -0,0 +1,81 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_POS_H
+#define DECA_POS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Position solver
+ *
+ * Multilateration from TWR distances and hyperbolic positioning from TDoA
+ * (time difference of arrival) in 2D or 3D, in single precision float.
+ *
+ * The solvers start from a linear least squares estimate (TWR) or the
+ * centroid of the anchors (TDoA) and refine it with Gauss-Newton iterations.
+ * In 2D the height of the tag is fixed (pos_set_height()), but the anchors can
+ * be at different heights. pos_solve.c does not depend on the driver, so it
+ * can be built and tested on a host (utest/test_pos_solve.cc).
+ *
+ * The engine (pos.c) collects distances from the TWR observer and TDoA
+ * timestamps of blinks, and calls the observer with a new fix when a round
+ * is complete: when all anchors have reported or the first one reports again.
+ */
+
+#define POS_MAX_ANCHORS 16
+#define POS_MAX_TAGS	8
+#define POS_MAX_ITER	10
+#define POS_CONVERGED_M 0.001f
+
+struct pos_anchor {
+	uint64_t addr;
+	float x, y, z; // meters
+};
+
+struct pos_fix {
+	float x, y, z;
+	float rmse;	   // root mean square of the residuals in meters
+	uint8_t num;   // number of anchors used
+	uint8_t iter;  // Gauss-Newton iterations
+	bool tdoa;
+};
+
+typedef void (*pos_cb_t)(uint64_t tag, const struct pos_fix* fix);
+
+/* solvers */
+
+/** 2D (tag height fixed to z) or 3D multilateration from distances in meters.
+ * Needs 3 (2D) or 4 (3D) anchors */
+bool pos_solve_twr(const struct pos_anchor* anchors, const float* dist_m,
+				   size_t num, bool is_3d, float z, struct pos_fix* fix);
+/** 2D or 3D hyperbolic solution from range differences in meters to the
+ * first anchor (rd_m[i] = dist to anchor i - dist to anchor 0). Needs 3 (2D)
+ * or 4 (3D) anchors */
+bool pos_solve_tdoa(const struct pos_anchor* anchors, const float* rd_m,
+					size_t num, bool is_3d, float z, struct pos_fix* fix);
+
+/* engine */
+
+/** Anchor geometry. The table is copied */
+bool pos_init(const struct pos_anchor* anchors, size_t num, bool is_3d);
+/** Fixed height of the tag in 2D mode */
+void pos_set_height(float z);
+void pos_set_observer(pos_cb_t cb);
+/** Can be used as TWR observer (twr_set_observer()) or be called from it */
+void pos_handle_twr(uint64_t src, uint64_t dst, uint16_t dist, uint16_t num);
+/** Blink seq of tag received by anchor at ts (DTU, 40 bit). All timestamps
+ * have to be in the same time base, e.g. converted with the clock model of
+ * the reference anchor */
+void pos_handle_tdoa(uint64_t tag, uint32_t seq, uint64_t anchor,
+					 uint64_t ts);
+
+#endif
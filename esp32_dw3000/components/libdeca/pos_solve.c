@@ -0,0 +1,244 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <math.h>
+
+#include "pos.h"
+
+/* no dependencies to the driver or platform here */
+
+/* Solve a * x = b for n <= 3 by Gaussian elimination with partial pivoting,
+ * solution in b */
+static bool pos_lin_solve(float a[3][3], float b[3], int n)
+{
+	for (int c = 0; c < n; c++) {
+		int p = c;
+		for (int r = c + 1; r < n; r++) {
+			if (fabsf(a[r][c]) > fabsf(a[p][c])) {
+				p = r;
+			}
+		}
+		if (fabsf(a[p][c]) < 1e-9f) {
+			return false;
+		}
+		if (p != c) {
+			for (int k = 0; k < n; k++) {
+				float t = a[c][k];
+				a[c][k] = a[p][k];
+				a[p][k] = t;
+			}
+			float t = b[c];
+			b[c] = b[p];
+			b[p] = t;
+		}
+		for (int r = c + 1; r < n; r++) {
+			float f = a[r][c] / a[c][c];
+			for (int k = c; k < n; k++) {
+				a[r][k] -= f * a[c][k];
+			}
+			b[r] -= f * b[c];
+		}
+	}
+
+	for (int c = n - 1; c >= 0; c--) {
+		for (int k = c + 1; k < n; k++) {
+			b[c] -= a[c][k] * b[k];
+		}
+		b[c] /= a[c][c];
+	}
+	return true;
+}
+
+static float pos_dist(const struct pos_anchor* a, const float p[3])
+{
+	float dx = p[0] - a->x;
+	float dy = p[1] - a->y;
+	float dz = p[2] - a->z;
+	return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+/* unit vector from anchor to p */
+static void pos_unit(const struct pos_anchor* a, const float p[3], float d,
+					 float u[3])
+{
+	if (d < 1e-6f) {
+		u[0] = u[1] = u[2] = 0;
+		return;
+	}
+	u[0] = (p[0] - a->x) / d;
+	u[1] = (p[1] - a->y) / d;
+	u[2] = (p[2] - a->z) / d;
+}
+
+/* residual and jacobian row of measurement i */
+typedef float (*pos_resid_f)(const struct pos_anchor* anchors, const float* m,
+							 size_t i, const float p[3], float j[3]);
+
+static float pos_resid_twr(const struct pos_anchor* anchors, const float* m,
+						   size_t i, const float p[3], float j[3])
+{
+	float d = pos_dist(&anchors[i], p);
+	pos_unit(&anchors[i], p, d, j);
+	return d - m[i];
+}
+
+static float pos_resid_tdoa(const struct pos_anchor* anchors, const float* m,
+							size_t i, const float p[3], float j[3])
+{
+	float u0[3];
+	float d0 = pos_dist(&anchors[0], p);
+	float di = pos_dist(&anchors[i], p);
+	pos_unit(&anchors[0], p, d0, u0);
+	pos_unit(&anchors[i], p, di, j);
+	for (int k = 0; k < 3; k++) {
+		j[k] -= u0[k];
+	}
+	return di - d0 - m[i];
+}
+
+static bool pos_gauss_newton(const struct pos_anchor* anchors, const float* m,
+							 size_t first, size_t num, int dim,
+							 pos_resid_f resid, float p[3],
+							 struct pos_fix* fix)
+{
+	float jr[3];
+	float sq;
+	int it;
+
+	for (it = 0; it < POS_MAX_ITER; it++) {
+		float a[3][3] = {{0}};
+		float b[3] = {0};
+
+		/* normal equations (J^T J) delta = -J^T r */
+		sq = 0;
+		for (size_t i = first; i < num; i++) {
+			float r = resid(anchors, m, i, p, jr);
+			sq += r * r;
+			for (int k = 0; k < dim; k++) {
+				for (int l = 0; l < dim; l++) {
+					a[k][l] += jr[k] * jr[l];
+				}
+				b[k] -= jr[k] * r;
+			}
+		}
+
+		if (!pos_lin_solve(a, b, dim)) {
+			return false;
+		}
+
+		float step = 0;
+		for (int k = 0; k < dim; k++) {
+			p[k] += b[k];
+			step += b[k] * b[k];
+		}
+
+		if (step < POS_CONVERGED_M * POS_CONVERGED_M) {
+			it++;
+			break;
+		}
+	}
+
+	/* residuals at the final position */
+	sq = 0;
+	for (size_t i = first; i < num; i++) {
+		float r = resid(anchors, m, i, p, jr);
+		sq += r * r;
+	}
+
+	fix->x = p[0];
+	fix->y = p[1];
+	fix->z = p[2];
+	fix->rmse = sqrtf(sq / (num - first));
+	fix->num = num;
+	fix->iter = it;
+	return isfinite(p[0]) && isfinite(p[1]) && isfinite(p[2]);
+}
+
+bool pos_solve_twr(const struct pos_anchor* anchors, const float* dist_m,
+				   size_t num, bool is_3d, float z, struct pos_fix* fix)
+{
+	int dim = is_3d ? 3 : 2;
+	float p[3] = {0, 0, z};
+	float a[3][3] = {{0}};
+	float b[3] = {0};
+	const struct pos_anchor* a0 = &anchors[0];
+
+	if (num < (size_t)dim + 1 || num > POS_MAX_ANCHORS) {
+		return false;
+	}
+
+	/* Linear least squares for the start: subtracting the sphere equation of
+	 * the first anchor gives 2 (a_i - a_0) p = |a_i|^2 - |a_0|^2 - d_i^2 + d_0^2
+	 * and in 2D the known z moves to the right side */
+	float n0 = a0->x * a0->x + a0->y * a0->y + a0->z * a0->z;
+	for (size_t i = 1; i < num; i++) {
+		const struct pos_anchor* ai = &anchors[i];
+		float row[3] = {2 * (ai->x - a0->x), 2 * (ai->y - a0->y),
+						2 * (ai->z - a0->z)};
+		float rhs = ai->x * ai->x + ai->y * ai->y + ai->z * ai->z - n0
+					- dist_m[i] * dist_m[i] + dist_m[0] * dist_m[0];
+		if (!is_3d) {
+			rhs -= row[2] * z;
+		}
+		for (int k = 0; k < dim; k++) {
+			for (int l = 0; l < dim; l++) {
+				a[k][l] += row[k] * row[l];
+			}
+			b[k] += row[k] * rhs;
+		}
+	}
+
+	if (pos_lin_solve(a, b, dim)) {
+		for (int k = 0; k < dim; k++) {
+			p[k] = b[k];
+		}
+	} else {
+		/* e.g. all anchors at the same height in 3D: start at the centroid */
+		p[0] = p[1] = 0;
+		for (size_t i = 0; i < num; i++) {
+			p[0] += anchors[i].x / num;
+			p[1] += anchors[i].y / num;
+		}
+		if (is_3d) {
+			p[2] = 0;
+		}
+	}
+
+	fix->tdoa = false;
+	return pos_gauss_newton(anchors, dist_m, 0, num, dim, pos_resid_twr, p,
+							fix);
+}
+
+bool pos_solve_tdoa(const struct pos_anchor* anchors, const float* rd_m,
+					size_t num, bool is_3d, float z, struct pos_fix* fix)
+{
+	int dim = is_3d ? 3 : 2;
+	float p[3] = {0, 0, is_3d ? 0 : z};
+
+	if (num < (size_t)dim + 1 || num > POS_MAX_ANCHORS) {
+		return false;
+	}
+
+	for (size_t i = 0; i < num; i++) {
+		p[0] += anchors[i].x / num;
+		p[1] += anchors[i].y / num;
+		if (is_3d) {
+			p[2] += anchors[i].z / num;
+		}
+	}
+
+	fix->tdoa = true;
+	/* the first anchor is the reference and has no measurement */
+	if (!pos_gauss_newton(anchors, rd_m, 1, num, dim, pos_resid_tdoa, p,
+						  fix)) {
+		return false;
+	}
+	fix->num = num;
+	return true;
+}
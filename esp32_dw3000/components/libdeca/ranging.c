@@ -13,15 +13,19 @@
 #include <zephyr/random/random.h>
 #endif
 
+#include "aoa.h"
 #include "dwhw.h"
 #include "dwmac.h"
 #include "dwphy.h"
 #include "dwproto.h"
+#include "dwsec.h"
 #include "dwtime.h"
 #include "dwutil.h"
 #include "log.h"
 #include "mac802154.h"
 #include "ranging.h"
+#include "rbias.h"
+#include "sts.h"
 
 #define TWR_DEBUG_CALCULATION 0
 #define TWR_MAX_RETRY		  3
@@ -38,6 +42,17 @@
 #define TWR_MSG_SSRESP 0x24
 #define TWR_MSG_FINA   0x29
 #define TWR_MSG_REPO   0x2A
+#define TWR_MSG_REPQ   0x2B
+
+/* only with CONFIG_DECA_STS_SECURE */
+struct twr_msg_poll {
+	uint32_t sts_ctr; // STS counter of the initiator for the exchange
+} __attribute__((packed));
+
+/* only with CONFIG_DECA_STS_SECURE */
+struct twr_msg_resp {
+	uint32_t sts_ctr; // STS counter of the responder for the exchange
+} __attribute__((packed));
 
 struct twr_msg_final {
 	uint32_t round;
@@ -55,6 +70,16 @@ struct twr_msg_report {
 	uint16_t dist;
 } __attribute__((packed));
 
+/* report with the link quality of the final as received by the anchor */
+struct twr_msg_report_q {
+	uint16_t cnum; // sequence number / TWR ID
+	uint16_t dist;
+	uint8_t rx_pwr;		 // -dBm * 2
+	uint8_t fp_pwr;		 // -dBm * 2
+	int8_t clock_offset; // ppm * 4
+	uint8_t nlos;		 // percent
+} __attribute__((packed));
+
 #ifndef __ZEPHYR__
 static const char* LOG_TAG = "TWR";
 #endif
@@ -67,6 +92,7 @@ static bool twr_send_report;
 
 /* state */
 static twr_cb_t twr_observer_cb;
+static twr_quality_cb_t twr_quality_cb;
 static uint64_t twr_dst;
 static uint16_t twr_cnum = 0;
 static bool single_sided = false;
@@ -74,11 +100,13 @@ static uint8_t expected_msg = 0;
 static int retry = 0;
 static bool in_progress = false;
 static uint64_t last_poll_rx_ts;
+static uint32_t twr_sts_ctr; // of the exchange, sent in the poll or response
 
 static void twr_retry(void);
 static void twr_handle_timeout(uint32_t status);
 static void twr_handle_result(uint64_t src, uint64_t dst, uint16_t dist,
-							  uint16_t cnum, bool reported, bool initiator);
+							  uint16_t cnum, bool reported, bool initiator,
+							  const struct dwphy_rx_quality* q);
 
 static uint64_t twr_my_mac(uint64_t other_addr)
 {
@@ -89,6 +117,14 @@ static uint64_t twr_my_mac(uint64_t other_addr)
 	}
 }
 
+/* IV of the next message of the exchange, see sts.h */
+static void twr_sts_msg(uint8_t msg, bool reply)
+{
+	if (CONFIG_DECA_STS_SECURE) {
+		sts_load_msg(msg, reply);
+	}
+}
+
 /*
  * TWR messages
  */
@@ -100,18 +136,28 @@ static bool twr_send_poll(uint64_t ancor)
 	if (tx == NULL)
 		return false;
 
+#if CONFIG_DECA_STS_SECURE
+	struct twr_msg_poll* msg = dwprot_prepare(
+		tx, sizeof(struct twr_msg_poll),
+		single_sided ? TWR_MSG_SSPOLL : TWR_MSG_POLL, ancor);
+	twr_sts_ctr = sts_next_counter();
+	sts_set_exchange(twr_my_mac(ancor), twr_sts_ctr, 0);
+	msg->sts_ctr = twr_sts_ctr;
+#else
 	dwprot_prepare(tx, 0, single_sided ? TWR_MSG_SSPOLL : TWR_MSG_POLL, ancor);
+#endif
 	dwmac_tx_set_ranging(tx);
 	dwmac_tx_expect_response(tx, twr_rx_delay);
 	dwmac_tx_set_preamble_timeout(tx, twr_pto);
 	dwmac_tx_set_timeout_handler(tx, twr_handle_timeout);
+	twr_sts_msg(STS_MSG_POLL, true);
 
 	bool res = dwmac_transmit(tx);
 	if (res) {
-		DBG_UWB("Sent Poll to " LADDR_FMT, LADDR_PAR(ancor));
+		DBG_UWB("Sent Poll to " DWLOG_LADDR_FMT, DWLOG_LADDR_PAR(ancor));
 		expected_msg = single_sided ? TWR_MSG_SSRESP : TWR_MSG_RESP;
 	} else {
-		LOG_ERR("Failed to send Poll to " LADDR_FMT, LADDR_PAR(ancor));
+		DWLOG_ERR("Failed to send Poll to " DWLOG_LADDR_FMT, DWLOG_LADDR_PAR(ancor));
 		twr_retry();
 	}
 
@@ -129,19 +175,26 @@ static bool twr_send_response(uint64_t tag, uint64_t poll_rx_ts)
 	last_poll_rx_ts = poll_rx_ts;
 	uint64_t resp_tx_time = poll_rx_ts + twr_delay_dtu;
 
+#if CONFIG_DECA_STS_SECURE
+	struct twr_msg_resp* msg = dwprot_prepare(tx, sizeof(struct twr_msg_resp),
+											  TWR_MSG_RESP, tag);
+	msg->sts_ctr = twr_sts_ctr;
+#else
 	dwprot_prepare(tx, 0, TWR_MSG_RESP, tag);
+#endif
 	dwmac_tx_set_ranging(tx);
 	dwmac_tx_expect_response(tx, twr_rx_delay);
 	dwmac_tx_set_preamble_timeout(tx, twr_pto);
 	dwmac_tx_set_txtime(tx, resp_tx_time);
+	twr_sts_msg(STS_MSG_RESP, true);
 
 	bool res = dwmac_transmit(tx);
 	if (res) {
-		DBG_UWB("Sent Response to " LADDR_FMT " after %dus", LADDR_PAR(tag),
+		DBG_UWB("Sent Response to " DWLOG_LADDR_FMT " after %dus", DWLOG_LADDR_PAR(tag),
 				(int)DTU_TO_US(resp_tx_time - poll_rx_ts));
 		expected_msg = TWR_MSG_FINA;
 	} else {
-		LOG_ERR("Failed to send Response to " LADDR_FMT, LADDR_PAR(tag));
+		DWLOG_ERR("Failed to send Response to " DWLOG_LADDR_FMT, DWLOG_LADDR_PAR(tag));
 		LOG_INF_TS("rx_ts: ", poll_rx_ts);
 		LOG_INF_TS("tx_ts: ", resp_tx_time);
 		LOG_INF_TS("delay: ", twr_delay_dtu);
@@ -170,16 +223,17 @@ static bool twr_send_ss_response(uint64_t tag, uint64_t poll_rx_ts)
 	msg->resp_tx_ts = (uint32_t)(resp_tx_time + DWPHY_ANTENNA_DELAY);
 	dwmac_tx_set_ranging(tx);
 	dwmac_tx_set_txtime(tx, resp_tx_time);
+	twr_sts_msg(STS_MSG_RESP, false);
 
 	bool res = dwmac_transmit(tx);
 	if (res) {
-		DBG_UWB("Sent SS Response to " LADDR_FMT " after %dus", LADDR_PAR(tag),
+		DBG_UWB("Sent SS Response to " DWLOG_LADDR_FMT " after %dus", DWLOG_LADDR_PAR(tag),
 				(int)DTU_TO_US(resp_tx_time - poll_rx_ts));
 		// LOG_DBG_TS("\tPoll RX TS:\t", poll_rx_ts);
 		// LOG_DBG_TS("\tResp TX TS:\t", resp_tx_time);
 		expected_msg = 0;
 	} else {
-		LOG_ERR("Failed to send Response to " LADDR_FMT, LADDR_PAR(tag));
+		DWLOG_ERR("Failed to send Response to " DWLOG_LADDR_FMT, DWLOG_LADDR_PAR(tag));
 		expected_msg = 0;
 	}
 
@@ -219,17 +273,18 @@ static bool twr_send_final(uint64_t ancor, uint64_t resp_rx_ts)
 		dwmac_tx_set_preamble_timeout(tx, twr_pto);
 		dwmac_tx_set_timeout_handler(tx, twr_handle_timeout);
 	}
+	twr_sts_msg(STS_MSG_FINAL, twr_send_report);
 
 	bool res = dwmac_transmit(tx);
 	if (res) {
-		DBG_UWB("Sent Final to " LADDR_FMT " after %dus", LADDR_PAR(ancor),
+		DBG_UWB("Sent Final to " DWLOG_LADDR_FMT " after %dus", DWLOG_LADDR_PAR(ancor),
 				(int)DTU_TO_US(final_tx_time - resp_rx_ts));
 		// LOG_DBG_TS("\tPoll TX TS:\t", poll_tx_ts);
 		// LOG_DBG_TS("\tResp RX TS:\t", resp_rx_ts);
 		// LOG_DBG_TS("\tFina TX TS:\t", final_tx_time);
 		expected_msg = twr_send_report ? TWR_MSG_REPO : 0;
 	} else {
-		LOG_ERR("Failed to send Final");
+		DWLOG_ERR("Failed to send Final");
 		twr_retry();
 	}
 
@@ -238,16 +293,29 @@ static bool twr_send_final(uint64_t ancor, uint64_t resp_rx_ts)
 		 * if the final message was sent. We don't know the distance, so we
 		 * just record "OK" */
 		twr_handle_result(twr_my_mac(ancor), ancor, TWR_OK_VALUE, twr_cnum,
-						  false, true);
+						  false, true, NULL);
 		in_progress = false;
 	}
 
 	return res;
 }
 
+static uint8_t twr_pwr_to_msg(float dbm)
+{
+	long v = lroundf(-dbm * 2);
+	return v < 0 ? 0 : (v > UINT8_MAX ? UINT8_MAX : v);
+}
+
+static int8_t twr_offset_to_msg(float ppm)
+{
+	long v = lroundf(ppm * 4);
+	return v < INT8_MIN ? INT8_MIN : (v > INT8_MAX ? INT8_MAX : v);
+}
+
 /* ANCOR -> TAG */
 static bool twr_send_report_msg(uint64_t tag, uint16_t dist, uint16_t cnum,
-								uint64_t final_rx_ts)
+								uint64_t final_rx_ts,
+								const struct dwphy_rx_quality* q)
 {
 	struct txbuf* tx = dwmac_txbuf_get();
 	if (tx == NULL) {
@@ -256,20 +324,32 @@ static bool twr_send_report_msg(uint64_t tag, uint16_t dist, uint16_t cnum,
 
 	expected_msg = 0;
 
-	struct twr_msg_report* msg
-		= dwprot_prepare(tx, sizeof(struct twr_msg_report), TWR_MSG_REPO, tag);
-	msg->cnum = cnum;
-	msg->dist = dist;
+	if (q != NULL) {
+		struct twr_msg_report_q* msg = dwprot_prepare(
+			tx, sizeof(struct twr_msg_report_q), TWR_MSG_REPQ, tag);
+		msg->cnum = cnum;
+		msg->dist = dist;
+		msg->rx_pwr = twr_pwr_to_msg(q->rx_pwr);
+		msg->fp_pwr = twr_pwr_to_msg(q->fp_pwr);
+		msg->clock_offset = twr_offset_to_msg(q->clock_offset);
+		msg->nlos = q->nlos;
+	} else {
+		struct twr_msg_report* msg = dwprot_prepare(
+			tx, sizeof(struct twr_msg_report), TWR_MSG_REPO, tag);
+		msg->cnum = cnum;
+		msg->dist = dist;
+	}
 
 	uint64_t rep_tx_time = (final_rx_ts + twr_delay_dtu) & DTU_DELAYEDTRX_MASK;
 	dwmac_tx_set_txtime(tx, rep_tx_time);
+	twr_sts_msg(STS_MSG_REPORT, false);
 
 	bool res = dwmac_transmit(tx);
-	LOG_TX_RES(res, "Report to " LADDR_FMT ": distance %u cm", LADDR_PAR(tag),
-			   dist);
+	LOG_TX_RES(res, "Report to " DWLOG_LADDR_FMT ": distance %u cm",
+			   DWLOG_LADDR_PAR(tag), dist);
 
 	// we have been the destination of this TWR sequence
-	twr_handle_result(tag, twr_my_mac(tag), dist, cnum, false, false);
+	twr_handle_result(tag, twr_my_mac(tag), dist, cnum, false, false, q);
 
 	return res;
 }
@@ -316,7 +396,7 @@ double twr_distance_calculation_dtu(uint32_t poll_rx_ts, uint32_t resp_tx_ts,
 		LOG_DBG("reply2 (Db):\t%" PRIu32, (uint32_t)Db);
 		LOG_DBG("ToF DTU\t\t%d", (int)tof_dtu);
 	} else if (tof_dtu < 0) {
-		LOG_ERR("ToF DTU %d", (int)tof_dtu);
+		DWLOG_ERR("ToF DTU %d", (int)tof_dtu);
 	}
 
 	return tof_dtu;
@@ -342,11 +422,14 @@ int twr_distance_calculation(uint32_t poll_rx_ts, uint32_t resp_tx_ts,
  */
 
 static void twr_callback(uint64_t src, uint64_t dst, uint16_t dist,
-						 uint16_t cnum)
+						 uint16_t cnum, const struct dwphy_rx_quality* q)
 {
 	if (twr_observer_cb) {
 		twr_observer_cb(src, dst, dist, cnum);
 	}
+	if (q != NULL && twr_quality_cb) {
+		twr_quality_cb(src, dst, dist, cnum, q);
+	}
 }
 
 static void twr_retry(void)
@@ -358,58 +441,74 @@ static void twr_retry(void)
 		int d = rand() % TWR_RETRY_DELAY;
 #endif
 		deca_sleep(d);
-		LOG_INF("retry %d to " LADDR_FMT " after %d ms", retry,
-				LADDR_PAR(twr_dst), d);
+		DWLOG_INF("retry %d to " DWLOG_LADDR_FMT " after %d ms", retry,
+				DWLOG_LADDR_PAR(twr_dst), d);
 		twr_send_poll(twr_dst);
 	} else {
-		LOG_ERR("retry limit exceeded " LADDR_FMT, LADDR_PAR(twr_dst));
-		twr_callback(twr_my_mac(twr_dst), twr_dst, TWR_FAILED_VALUE, twr_cnum);
+		DWLOG_ERR("retry limit exceeded " DWLOG_LADDR_FMT, DWLOG_LADDR_PAR(twr_dst));
+		twr_callback(twr_my_mac(twr_dst), twr_dst, TWR_FAILED_VALUE, twr_cnum,
+					 NULL);
 		in_progress = false;
 	}
 }
 
 static void twr_handle_timeout(uint32_t status)
 {
-	LOG_ERR("RX timeout from " LADDR_FMT, LADDR_PAR(twr_dst));
+	DWLOG_ERR("RX timeout from " DWLOG_LADDR_FMT, DWLOG_LADDR_PAR(twr_dst));
 	if (expected_msg == TWR_MSG_RESP || expected_msg == TWR_MSG_REPO
 		|| expected_msg == TWR_MSG_SSRESP) {
 		/* The TAG (Initiator) side can retry the whole exchange */
 		twr_retry();
 	} else if (expected_msg == TWR_MSG_FINA) {
 		/* The ANCOR (Passive) side can only log the error */
-		LOG_ERR("RX timeout, did not receive final");
+		DWLOG_ERR("RX timeout, did not receive final");
 		// dev_update_state(current_anc_idx, TWR_FAIL);
 		expected_msg = 0;
 		in_progress = false;
 	}
 }
 
+/* two 64 bit addresses leave no room for another argument in deferred logs */
+static void twr_log_distance(uint64_t src, uint64_t dst, uint16_t dist,
+							 uint16_t cnum, bool reported)
+{
+	if (reported) {
+		DWLOG_INF("#%d " DWLOG_LADDR_FMT " -> " DWLOG_LADDR_FMT ": %u cm REP",
+				  cnum, DWLOG_LADDR_PAR(src), DWLOG_LADDR_PAR(dst), dist);
+	} else {
+		DWLOG_INF("#%d " DWLOG_LADDR_FMT " -> " DWLOG_LADDR_FMT ": %u cm",
+				  cnum, DWLOG_LADDR_PAR(src), DWLOG_LADDR_PAR(dst), dist);
+	}
+}
+
 static void twr_handle_result(uint64_t src, uint64_t dst, uint16_t dist,
-							  uint16_t cnum, bool reported, bool initiator)
+							  uint16_t cnum, bool reported, bool initiator,
+							  const struct dwphy_rx_quality* q)
 {
+	/* This is called in the time critical path (e.g. just after sending the
+	 * report), so it uses deferred logging if enabled */
 	if (dist == TWR_FAILED_VALUE) {
-		LOG_ERR("#%d " LADDR_FMT " -> " LADDR_FMT
-				": Distance calculation failed %s",
-				cnum, LADDR_PAR(src), LADDR_PAR(dst), reported ? "REP" : "");
+		DWLOG_ERR("#%d " DWLOG_LADDR_FMT " -> " DWLOG_LADDR_FMT
+				  ": Distance calculation failed %s",
+				  cnum, DWLOG_LADDR_PAR(src), DWLOG_LADDR_PAR(dst),
+				  DWLOG_STR(reported ? "REP" : ""));
 		if (initiator) {
 			twr_retry();
 		}
 	} else if (dist == 0) {
 		// distance reported as 0, may be too close, or may be failed: retry
-		LOG_INF("#%d " LADDR_FMT " -> " LADDR_FMT ": %u cm %s", cnum,
-				LADDR_PAR(src), LADDR_PAR(dst), dist, reported ? "REP" : "");
+		twr_log_distance(src, dst, dist, cnum, reported);
 		if (initiator) {
 			twr_retry();
 		}
 	} else if (dist == TWR_OK_VALUE) {
 		// this is on initiator side when no reports are expected, we don't know
 		// the distance
-		LOG_INF("#%d " LADDR_FMT " -> " LADDR_FMT ": OK", cnum, LADDR_PAR(src),
-				LADDR_PAR(dst));
+		DWLOG_INF("#%d " DWLOG_LADDR_FMT " -> " DWLOG_LADDR_FMT ": OK", cnum,
+				  DWLOG_LADDR_PAR(src), DWLOG_LADDR_PAR(dst));
 	} else {
-		LOG_INF("#%d " LADDR_FMT " -> " LADDR_FMT ": %u cm %s", cnum,
-				LADDR_PAR(src), LADDR_PAR(dst), dist, reported ? "REP" : "");
-		twr_callback(src, dst, dist, cnum);
+		twr_log_distance(src, dst, dist, cnum, reported);
+		twr_callback(src, dst, dist, cnum, q);
 		in_progress = false;
 	}
 }
@@ -432,13 +531,27 @@ static void twr_handle_final(const struct twr_msg_final* msg_final,
 								   msg_final->round, msg_final->delay);
 	dist = twr_fixup_distance(dist);
 
+	const struct dwphy_rx_quality* q = NULL;
+#if CONFIG_DECA_TWR_REPORT_QUALITY || CONFIG_DECA_TWR_BIAS_CORRECTION
+	/* the diagnostics of the final are valid until the next RX */
+	struct dwphy_rx_quality rxq;
+	if (dwphy_read_rx_quality(&rxq)) {
+#if CONFIG_DECA_TWR_BIAS_CORRECTION
+		dist = rbias_correct(dist, rxq.fp_pwr);
+#endif
+#if CONFIG_DECA_TWR_REPORT_QUALITY
+		q = &rxq;
+#endif
+	}
+#endif
+
 	if (twr_send_report) {
 		// result will be handled after sending the report (time critical)
-		twr_send_report_msg(src, dist, msg_final->cnum, final_rx_ts);
+		twr_send_report_msg(src, dist, msg_final->cnum, final_rx_ts, q);
 	} else {
 		// add result. we have been the destination of this TWR sequence
 		twr_handle_result(src, twr_my_mac(src), dist, msg_final->cnum, false,
-						  false);
+						  false, q);
 	}
 }
 
@@ -449,12 +562,33 @@ static void twr_handle_report(const struct twr_msg_report* msg, uint64_t src)
 	expected_msg = 0;
 
 	/* distance back to me (tag) */
-	twr_handle_result(twr_my_mac(src), src, msg->dist, msg->cnum, true, true);
+	twr_handle_result(twr_my_mac(src), src, msg->dist, msg->cnum, true, true,
+					  NULL);
 }
 
-static void twr_handle_ss_response(const struct rxbuf* rx, uint64_t src)
+static void twr_handle_report_q(const struct twr_msg_report_q* msg,
+								uint64_t src)
 {
-	const struct twr_msg_ss_resp* msg = dwprot_get_payload(rx->buf);
+	struct dwphy_rx_quality q = {
+		.rx_pwr = -msg->rx_pwr / 2.0f,
+		.fp_pwr = -msg->fp_pwr / 2.0f,
+		.clock_offset = msg->clock_offset / 4.0f,
+		.nlos = msg->nlos,
+	};
+
+	/* no more messages expected */
+	expected_msg = 0;
+
+	/* distance back to me (tag) */
+	twr_handle_result(twr_my_mac(src), src, msg->dist, msg->cnum, true, true,
+					  &q);
+}
+
+static void twr_handle_ss_response(const struct dwprot_frame* f)
+{
+	const struct twr_msg_ss_resp* msg = (const void*)f->payload;
+	const struct rxbuf* rx = f->rx;
+	uint64_t src = f->src;
 	uint32_t poll_tx_ts = dwt_readtxtimestamplo32();
 	uint32_t resp_rx_ts = (uint32_t)rx->ts;
 
@@ -473,47 +607,91 @@ static void twr_handle_ss_response(const struct rxbuf* rx, uint64_t src)
 	int dist = TIME_TO_DISTANCE(tof) * 100;
 
 	dist = twr_fixup_distance(dist);
-	twr_handle_result(twr_my_mac(src), src, dist, twr_cnum, false, true);
+
+	const struct dwphy_rx_quality* q = NULL;
+#if CONFIG_DECA_TWR_REPORT_QUALITY || CONFIG_DECA_TWR_BIAS_CORRECTION
+	struct dwphy_rx_quality rxq;
+	if (dwphy_read_rx_quality(&rxq)) {
+#if CONFIG_DECA_TWR_BIAS_CORRECTION
+		dist = rbias_correct(dist, rxq.fp_pwr);
+#endif
+#if CONFIG_DECA_TWR_REPORT_QUALITY
+		q = &rxq;
+#endif
+	}
+#endif
+
+	twr_handle_result(twr_my_mac(src), src, dist, twr_cnum, false, true, q);
 }
 
 static size_t twr_get_msg_len(uint8_t func)
 {
 	switch (func) {
 	case TWR_MSG_POLL:
-		return 0;
+		return CONFIG_DECA_STS_SECURE ? sizeof(struct twr_msg_poll) : 0;
 	case TWR_MSG_RESP:
-		return 0;
+		return CONFIG_DECA_STS_SECURE ? sizeof(struct twr_msg_resp) : 0;
 	case TWR_MSG_FINA:
 		return sizeof(struct twr_msg_final);
 	case TWR_MSG_REPO:
 		return sizeof(struct twr_msg_report);
+	case TWR_MSG_REPQ:
+		return sizeof(struct twr_msg_report_q);
 	case TWR_MSG_SSPOLL:
-		return 0;
+		return CONFIG_DECA_STS_SECURE ? sizeof(struct twr_msg_poll) : 0;
 	case TWR_MSG_SSRESP:
 		return sizeof(struct twr_msg_ss_resp);
 	}
 	return 0;
 }
 
-void twr_handle_message(const struct rxbuf* rx)
+void twr_handle_message(const struct dwprot_frame* f)
 {
-	uint64_t src = dwprot_get_src(rx->buf);
-	uint8_t func = dwprot_get_func(rx->buf);
+	uint64_t src = f->src;
+	uint8_t func = f->func;
+	const struct rxbuf* rx = f->rx;
 
 	/* drop unexpected messages, but always allow POLL in case the sender needs
 	 * to retry */
-	if (expected_msg != 0 && func != expected_msg && func != TWR_MSG_POLL) {
+	if (expected_msg != 0 && func != expected_msg && func != TWR_MSG_POLL
+		&& !(expected_msg == TWR_MSG_REPO && func == TWR_MSG_REPQ)) {
 		LOG_ERR("Drop unexpected MSG %X from " LADDR_FMT, func, LADDR_PAR(src));
 		return;
 	}
 
 	/* check length */
-	if (dwprot_get_payload_len(rx->buf, rx->len) != twr_get_msg_len(func)) {
+	if (f->payload_len != twr_get_msg_len(func)) {
 		LOG_ERR("Drop invalid length MSG %X from " LADDR_FMT, func,
 				LADDR_PAR(src));
 		return;
 	}
 
+#if CONFIG_DECA_STS_SECURE
+	if (!rx->sts_ok) {
+		LOG_ERR("Drop MSG %X with bad STS from " LADDR_FMT, func,
+				LADDR_PAR(src));
+		return;
+	}
+
+	/* the counters are used for the IV of the following messages only, so
+	 * they need not be trusted */
+	if (func == TWR_MSG_POLL || func == TWR_MSG_SSPOLL) {
+		const struct twr_msg_poll* msg = (const void*)f->payload;
+		twr_sts_ctr = sts_next_counter();
+		sts_set_exchange(src, msg->sts_ctr, twr_sts_ctr);
+	} else if (func == TWR_MSG_RESP) {
+		const struct twr_msg_resp* msg = (const void*)f->payload;
+		sts_set_exchange(twr_my_mac(src), twr_sts_ctr, msg->sts_ctr);
+	}
+#endif
+
+#if CONFIG_DECA_PDOA
+	/* the frames a distance is calculated from */
+	if (func == TWR_MSG_FINA || func == TWR_MSG_SSRESP) {
+		aoa_handle_rx(src, rx);
+	}
+#endif
+
 	switch (func) {
 	case TWR_MSG_POLL:
 		twr_send_response(src, rx->ts);
@@ -522,16 +700,19 @@ void twr_handle_message(const struct rxbuf* rx)
 		twr_send_final(src, rx->ts);
 		break;
 	case TWR_MSG_FINA:
-		twr_handle_final(dwprot_get_payload(rx->buf), rx->ts, src);
+		twr_handle_final((const void*)f->payload, rx->ts, src);
 		break;
 	case TWR_MSG_REPO:
-		twr_handle_report(dwprot_get_payload(rx->buf), src);
+		twr_handle_report((const void*)f->payload, src);
+		break;
+	case TWR_MSG_REPQ:
+		twr_handle_report_q((const void*)f->payload, src);
 		break;
 	case TWR_MSG_SSPOLL:
 		twr_send_ss_response(src, rx->ts);
 		break;
 	case TWR_MSG_SSRESP:
-		twr_handle_ss_response(rx, src);
+		twr_handle_ss_response(f);
 		break;
 	default:
 		LOG_ERR("Unknown MSG %X from " LADDR_FMT, func, LADDR_PAR(src));
@@ -569,13 +750,24 @@ void twr_init(uint32_t processing_delay_us, bool send_report)
 				* (DWMAC_PROTO_SHORT_LEN + sizeof(struct twr_msg_final));
 
 	/* TODO: CHECK: Processing time is higher when debugging is on */
-#if CONFIG_DECA_DEBUG_IRQ_TIME || CONFIG_DECA_DEBUG_RX_DUMP                    \
-	|| CONFIG_DECA_DEBUG_TX_DUMP || CONFIG_DECA_DEBUG_TX_TIME                  \
-	|| CONFIG_DECA_DEBUG_RX_STATUS || CONFIG_DECA_READ_RXDIAG                  \
-	|| TWR_DEBUG_CALCULATION
+#if CONFIG_DECA_DEBUG_RX_DUMP || CONFIG_DECA_DEBUG_TX_DUMP                     \
+	|| CONFIG_DECA_DEBUG_TX_TIME || CONFIG_DECA_DEBUG_RX_STATUS                \
+	|| CONFIG_DECA_READ_RXDIAG || TWR_DEBUG_CALCULATION
 	proc_time_us += 400;
 #endif
 
+#if CONFIG_DECA_TWR_REPORT_QUALITY
+	/* diagnostics read and larger report */
+	proc_time_us += TWR_QUALITY_PROC_US
+					+ TWR_SPI_US_PER_BYTE * sizeof(struct twr_msg_report_q);
+#elif CONFIG_DECA_TWR_BIAS_CORRECTION
+	/* diagnostics read */
+	proc_time_us += TWR_QUALITY_PROC_US;
+#endif
+#if CONFIG_DECA_TWR_REPORT_QUALITY || CONFIG_DECA_TWR_BIAS_CORRECTION
+	dwphy_enable_full_diag();
+#endif
+
 	/* Calculate delay from packet times
 	 *
 	 * From the RMARKER time (RX timestamp) we need
@@ -590,6 +782,20 @@ void twr_init(uint32_t processing_delay_us, bool send_report)
 		= dwphy_calc_phyhdr_time(rate_dw)
 		  + dwphy_calc_data_time(rate_dw, DWMAC_PROTO_SHORT_LEN)
 		  + dwphy_calc_preamble_time(plen_dw, prf_dw, rate_dw);
+
+	/* with STS mode 1 the STS follows the RMARKER of the received frame */
+	twr_delay_us += dwphy_calc_sts_time();
+#if CONFIG_DECA_STS_SECURE
+	/* STS quality and timestamp read and the counter in the response */
+	proc_time_us += TWR_STS_PROC_US;
+	twr_delay_us += dwphy_calc_data_time(rate_dw, sizeof(struct twr_msg_resp));
+#endif
+#if CONFIG_DECA_FRAME_SECURITY
+	/* decrypting the response and encrypting the final, and the auxiliary
+	 * header and MIC of the highest security level */
+	proc_time_us += 2 * TWR_SEC_PROC_US;
+	twr_delay_us += dwphy_calc_data_time(rate_dw, DWSEC_MAX_OVERHEAD);
+#endif
 	twr_delay_us = PKTTIME_TO_USEC(twr_delay_us);
 	twr_delay_us += proc_time_us;
 	twr_delay_dtu = US_TO_DTU(twr_delay_us);
@@ -600,9 +806,9 @@ void twr_init(uint32_t processing_delay_us, bool send_report)
 	twr_rx_delay = US_TO_UUS(proc_time_us);
 	twr_pto = dwphy_get_recommended_preambletimeout();
 
-#if CONFIG_DECA_DEBUG_IRQ_TIME || CONFIG_DECA_DEBUG_RX_DUMP                    \
-	|| CONFIG_DECA_DEBUG_TX_DUMP || CONFIG_DECA_DEBUG_TX_TIME                  \
-	|| CONFIG_DECA_DEBUG_RX_STATUS || CONFIG_DECA_READ_RXDIAG
+#if CONFIG_DECA_DEBUG_RX_DUMP || CONFIG_DECA_DEBUG_TX_DUMP                     \
+	|| CONFIG_DECA_DEBUG_TX_TIME || CONFIG_DECA_DEBUG_RX_STATUS                \
+	|| CONFIG_DECA_READ_RXDIAG
 	twr_pto += 3;
 #endif
 
@@ -630,6 +836,11 @@ bool twr_start(uint64_t dst)
 		return false;
 	}
 
+	if (CONFIG_DECA_STS_SECURE && !sts_is_active()) {
+		LOG_ERR("No STS session");
+		return false;
+	}
+
 	twr_dst = dst;
 	single_sided = false;
 	twr_cnum++;
@@ -645,6 +856,11 @@ bool twr_start_ss(uint64_t dst)
 		return false;
 	}
 
+	if (CONFIG_DECA_STS_SECURE && !sts_is_active()) {
+		LOG_ERR("No STS session");
+		return false;
+	}
+
 	twr_dst = dst;
 	single_sided = true;
 	twr_cnum++;
@@ -665,6 +881,16 @@ void twr_set_observer(twr_cb_t cb)
 	twr_observer_cb = cb;
 }
 
+void twr_set_quality_observer(twr_quality_cb_t cb)
+{
+	twr_quality_cb = cb;
+}
+
+twr_cb_t twr_get_observer(void)
+{
+	return twr_observer_cb;
+}
+
 bool twr_in_progress(void)
 {
 	return in_progress;
@@ -15,6 +15,7 @@
 #include <stdint.h>
 
 #include "dwmac.h"
+#include "dwproto.h"
 
 /** TWR_PROCESSING_DELAY: the processing delay may need to be increased for
  * different processor and IRQ handling speeds */
@@ -22,9 +23,30 @@
 #define TWR_FAILED_VALUE	 UINT16_MAX
 #define TWR_OK_VALUE		 (UINT16_MAX - 1)
 #define TWR_MSG_GROUP		 0x20
+/* additional processing time for the link quality in the report */
+#define TWR_QUALITY_PROC_US 150
+/* additional processing time for the STS checks and counter */
+#define TWR_STS_PROC_US 80
+/* additional processing time for AES in the DW3000, per frame */
+#define TWR_SEC_PROC_US 100
+
+#ifndef CONFIG_DECA_TWR_REPORT_QUALITY
+#define CONFIG_DECA_TWR_REPORT_QUALITY 0
+#endif
+
+#ifndef CONFIG_DECA_TWR_BIAS_CORRECTION
+#define CONFIG_DECA_TWR_BIAS_CORRECTION 0
+#endif
+
+struct dwphy_rx_quality;
 
 typedef void (*twr_cb_t)(uint64_t src, uint64_t dst, uint16_t dist,
 						 uint16_t num);
+/** Called in addition to twr_cb_t when the link quality is known: the quality
+ * of the final as received by the anchor, or of the SS-TWR response */
+typedef void (*twr_quality_cb_t)(uint64_t src, uint64_t dst, uint16_t dist,
+								 uint16_t num,
+								 const struct dwphy_rx_quality* q);
 
 /** Initialize TWR with processing delay */
 void twr_init(uint32_t processing_delay_us, bool send_report);
@@ -35,10 +57,12 @@ bool twr_start_ss(uint64_t dst);
 bool twr_in_progress(void);
 void twr_cancel(void);
 void twr_set_observer(twr_cb_t cb);
+twr_cb_t twr_get_observer(void);
+void twr_set_quality_observer(twr_quality_cb_t cb);
 uint16_t twr_get_cnum(void);
 uint64_t twr_get_source_mac(void);
 
-void twr_handle_message(const struct rxbuf* rx);
+void twr_handle_message(const struct dwprot_frame* f);
 double twr_distance_calculation_dtu(uint32_t poll_rx_ts, uint32_t resp_tx_ts,
 									uint32_t final_rx_ts, uint32_t Ra,
 									uint32_t Da);
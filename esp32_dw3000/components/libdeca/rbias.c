@@ -0,0 +1,170 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "dwphy.h"
+#include "log.h"
+#include "platform/dwstore.h"
+#include "ranging.h"
+#include "rbias.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+#define RBIAS_KEY "rbias"
+
+/* the stored format, header and all tables */
+struct rbias_blob {
+	struct rbias_blob_hdr hdr;
+	struct rbias_table tables[RBIAS_MAX_TABLES];
+} __attribute__((packed));
+
+static struct rbias_blob rbias;
+
+static bool rbias_check_table(const struct rbias_table* t)
+{
+	if (t->num == 0 || t->num > RBIAS_MAX_POINTS) {
+		return false;
+	}
+	for (int i = 1; i < t->num; i++) {
+		if (t->pts[i].fp_pwr <= t->pts[i - 1].fp_pwr) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static struct rbias_table* rbias_find(uint8_t chan, uint8_t prf)
+{
+	for (int i = 0; i < rbias.hdr.num; i++) {
+		if (rbias.tables[i].chan == chan && rbias.tables[i].prf == prf) {
+			return &rbias.tables[i];
+		}
+	}
+	return NULL;
+}
+
+bool rbias_set_table(uint8_t chan, uint8_t prf, const struct rbias_point* pts,
+					 uint8_t num)
+{
+	struct rbias_table* t = rbias_find(chan, prf);
+	if (t == NULL) {
+		if (rbias.hdr.num >= RBIAS_MAX_TABLES) {
+			LOG_ERR("Range bias: too many tables");
+			return false;
+		}
+		t = &rbias.tables[rbias.hdr.num];
+	}
+
+	struct rbias_table n = {.chan = chan, .prf = prf, .num = num};
+	if (num <= RBIAS_MAX_POINTS) {
+		memcpy(n.pts, pts, num * sizeof(*pts));
+	}
+	if (!rbias_check_table(&n)) {
+		LOG_ERR("Range bias: invalid table for channel %d", chan);
+		return false;
+	}
+
+	*t = n;
+	if (t == &rbias.tables[rbias.hdr.num]) {
+		rbias.hdr.num++;
+	}
+	return true;
+}
+
+bool rbias_load_blob(const void* blob, size_t len)
+{
+	const struct rbias_blob_hdr* hdr = blob;
+	const struct rbias_table* tables = (const void*)(hdr + 1);
+
+	if (len < sizeof(*hdr)
+		|| memcmp(hdr->magic, RBIAS_MAGIC, sizeof(hdr->magic)) != 0
+		|| hdr->num > RBIAS_MAX_TABLES
+		|| len < sizeof(*hdr) + hdr->num * sizeof(struct rbias_table)) {
+		LOG_ERR("Range bias: invalid blob");
+		return false;
+	}
+
+	for (int i = 0; i < hdr->num; i++) {
+		if (!rbias_check_table(&tables[i])) {
+			LOG_ERR("Range bias: invalid table %d", i);
+			return false;
+		}
+	}
+
+	memset(&rbias, 0, sizeof(rbias));
+	memcpy(&rbias, blob, sizeof(*hdr) + hdr->num * sizeof(struct rbias_table));
+	LOG_INF("Range bias: %d tables", rbias.hdr.num);
+	return true;
+}
+
+void rbias_clear(void)
+{
+	memset(&rbias, 0, sizeof(rbias));
+}
+
+bool rbias_load(void)
+{
+	struct rbias_blob b;
+
+	if (!dwstore_read(RBIAS_KEY, &b, sizeof(b))) {
+		return false;
+	}
+	return rbias_load_blob(&b, sizeof(b));
+}
+
+bool rbias_store(void)
+{
+	memcpy(rbias.hdr.magic, RBIAS_MAGIC, sizeof(rbias.hdr.magic));
+	return dwstore_write(RBIAS_KEY, &rbias, sizeof(rbias));
+}
+
+float rbias_get(float fp_pwr)
+{
+	const struct rbias_table* t
+		= rbias_find(dwphy_get_channel(), dwphy_get_prf());
+	if (t == NULL) {
+		return 0;
+	}
+
+	const struct rbias_point* p = t->pts;
+	float x = fp_pwr * 256.0f;
+	int i;
+
+	/* constant beyond the ends of the table */
+	if (x <= p[0].fp_pwr) {
+		return p[0].bias / 10.0f;
+	} else if (x >= p[t->num - 1].fp_pwr) {
+		return p[t->num - 1].bias / 10.0f;
+	}
+	for (i = 1; x > p[i].fp_pwr; i++) {
+	}
+
+	float f = (x - p[i - 1].fp_pwr) / (p[i].fp_pwr - p[i - 1].fp_pwr);
+	return (p[i - 1].bias + f * (p[i].bias - p[i - 1].bias)) / 10.0f;
+}
+
+uint16_t rbias_correct(uint16_t dist, float fp_pwr)
+{
+	/* 0 is not a measurement, keep it */
+	if (dist == 0 || dist == TWR_FAILED_VALUE || dist == TWR_OK_VALUE) {
+		return dist;
+	}
+
+	int d = lroundf(dist - rbias_get(fp_pwr));
+	if (d < 0) {
+		return 0;
+	} else if (d >= TWR_OK_VALUE) {
+		return TWR_OK_VALUE - 1;
+	}
+	return d;
+}
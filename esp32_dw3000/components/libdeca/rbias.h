@@ -0,0 +1,67 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_RBIAS_H
+#define DECA_RBIAS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Range bias correction by received signal level
+ *
+ * The leading edge detection makes ranges longer or shorter depending on the
+ * received power. A table for each channel and PRF maps the first path power
+ * (as calculated by dwt_calculate_first_path_power()) to the bias, which is
+ * linearly interpolated between the points and subtracted from the distance.
+ * There is no correction without a table for the current channel and PRF.
+ *
+ * Tables are loaded from a calibration blob (little endian, packed):
+ * struct rbias_blob_hdr followed by num struct rbias_table. The same format
+ * is used in persistent storage.
+ */
+
+#define RBIAS_MAX_TABLES 4
+#define RBIAS_MAX_POINTS 16
+#define RBIAS_MAGIC		 "RBS1"
+
+struct rbias_point {
+	int16_t fp_pwr; // dBm, Q8.8, ascending in the table
+	int16_t bias;	// mm, measured minus true distance
+} __attribute__((packed));
+
+struct rbias_table {
+	uint8_t chan;
+	uint8_t prf; // DWT_PRF_16M or DWT_PRF_64M
+	uint8_t num; // valid points
+	uint8_t reserved;
+	struct rbias_point pts[RBIAS_MAX_POINTS];
+} __attribute__((packed));
+
+struct rbias_blob_hdr {
+	char magic[4]; // RBIAS_MAGIC
+	uint8_t num;   // tables
+	uint8_t reserved[3];
+} __attribute__((packed));
+
+bool rbias_set_table(uint8_t chan, uint8_t prf, const struct rbias_point* pts,
+					 uint8_t num);
+bool rbias_load_blob(const void* blob, size_t len);
+void rbias_clear(void);
+/** Load the tables from persistent storage */
+bool rbias_load(void);
+bool rbias_store(void);
+
+/** Bias in cm for the current channel and PRF, 0 without a table */
+float rbias_get(float fp_pwr);
+/** Corrected distance in cm, 0 and special values are passed through */
+uint16_t rbias_correct(uint16_t dist, float fp_pwr);
+
+#endif
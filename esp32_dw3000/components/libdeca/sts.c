@@ -0,0 +1,201 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <string.h>
+
+#include <deca_device_api.h>
+
+#include "dwphy.h"
+#include "log.h"
+#include "sts.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+/* "STS" label of the key derivation nonce */
+#define STS_LABEL 0x535453
+
+static dwt_aes_key_t master_key;
+static dwt_sts_cp_iv_t sts_iv; // of the session
+static volatile bool active;
+static uint32_t counter;
+
+/* the current exchange */
+static uint32_t x_init_ctr;
+static uint32_t x_resp_ctr;
+static uint32_t x_addr;
+static volatile uint8_t reply_msg; // 0: none, the poll is never a reply
+
+void sts_init(const uint8_t key[STS_KEY_LEN])
+{
+	memset(&master_key, 0, sizeof(master_key));
+	memcpy(&master_key, key, STS_KEY_LEN);
+}
+
+static void sts_load_iv(uint8_t msg)
+{
+	dwt_sts_cp_iv_t iv = sts_iv;
+
+	/* the response is received before the counter of the responder is known */
+	if (msg != STS_MSG_POLL) {
+		iv.iv0 ^= x_init_ctr;
+		iv.iv3 ^= x_addr << 8;
+	}
+	if (msg >= STS_MSG_FINAL) {
+		iv.iv1 ^= x_resp_ctr;
+	}
+	iv.iv3 ^= msg;
+
+	dwt_configurestsiv(&iv);
+	dwt_configurestsloadiv();
+}
+
+static bool sts_enable(bool sp3)
+{
+	dwphy_set_sts(sp3 ? DWT_STS_MODE_ND : DWT_STS_MODE_1, DWT_STS_LEN_64);
+	if (!dwphy_config()) {
+		return false;
+	}
+	/* load the IV again after the reconfiguration */
+	reply_msg = 0;
+	sts_load_iv(STS_MSG_POLL);
+	active = true;
+	return true;
+}
+
+/* The session key is the first block of AES-GCM key stream of the secret key,
+ * with the label and session ID as nonce. The AES engine writes it into the
+ * STS key register directly */
+static bool sts_derive_key(uint32_t session_id)
+{
+	dwt_aes_config_t cfg = {
+		.aes_otp_sel_key_block = AES_key_otp_sel_1st_128,
+		.aes_key_otp_type = AES_key_RAM,
+		.aes_core_type = AES_core_type_GCM,
+		.mic = MIC_0,
+		.key_src = AES_KEY_Src_Register,
+		.key_load = AES_KEY_Load,
+		.key_addr = 0,
+		.key_size = AES_KEY_128bit,
+		.mode = AES_Encrypt,
+	};
+	uint8_t nonce[12] = {0};
+	uint8_t zero[STS_KEY_LEN] = {0};
+	dwt_aes_job_t job = {
+		.nonce = nonce,
+		.header = NULL,
+		.header_len = 0,
+		.payload = zero,
+		.payload_len = sizeof(zero),
+		.src_port = AES_Src_Scratch,
+		.dst_port = AES_Dst_STS_key,
+		.mode = AES_Encrypt,
+		.mic_size = 0,
+	};
+	uint32_t label = STS_LABEL;
+
+	memcpy(nonce, &label, sizeof(label));
+	memcpy(nonce + 4, &session_id, sizeof(session_id));
+
+	dwt_set_keyreg_128(&master_key);
+	dwt_configure_aes(&cfg);
+	int8_t ret = dwt_do_aes(&job, AES_core_type_GCM);
+	if (ret < 0 || (ret & DWT_AES_ERRORS)) {
+		LOG_ERR("STS key derivation failed %d", ret);
+		return false;
+	}
+	return true;
+}
+
+bool sts_start_session(uint32_t session_id, bool sp3)
+{
+	active = false;
+	if (!sts_derive_key(session_id)) {
+		return false;
+	}
+
+	sts_iv.iv0 = 0; // counters of the exchange
+	sts_iv.iv1 = session_id;
+	sts_iv.iv2 = STS_LABEL;
+	sts_iv.iv3 = 0; // address and message
+	counter = 0;
+
+	LOG_INF("STS session %08" PRIx32, session_id);
+	return sts_enable(sp3);
+}
+
+bool sts_start_session_key(const uint8_t key[STS_KEY_LEN],
+						   const uint8_t iv[STS_KEY_LEN], bool sp3)
+{
+	dwt_sts_cp_key_t k;
+
+	active = false;
+	memcpy(&k, key, sizeof(k));
+	memcpy(&sts_iv, iv, sizeof(sts_iv));
+	counter = 0;
+	dwt_configurestskey(&k);
+	return sts_enable(sp3);
+}
+
+void sts_stop(void)
+{
+	active = false;
+	dwphy_set_sts(DWT_STS_MODE_OFF, DWT_STS_LEN_64);
+	dwphy_config();
+}
+
+bool sts_is_active(void)
+{
+	return active;
+}
+
+uint32_t sts_next_counter(void)
+{
+	return ++counter;
+}
+
+void sts_set_exchange(uint64_t initiator, uint32_t init_ctr, uint32_t resp_ctr)
+{
+	x_addr = initiator & 0xFFFFFF;
+	x_init_ctr = init_ctr;
+	x_resp_ctr = resp_ctr;
+}
+
+void sts_load_msg(uint8_t msg, bool reply)
+{
+	if (!active) {
+		return;
+	}
+	decaIrqStatus_t stat = decamutexon();
+	sts_load_iv(msg);
+	reply_msg = reply ? msg + 1 : 0;
+	decamutexoff(stat);
+}
+
+void sts_handle_tx(void)
+{
+	if (!active) {
+		return;
+	}
+	/* always loaded, the DW3000 advances the counter after each frame */
+	if (reply_msg != 0) {
+		sts_load_iv(reply_msg);
+		reply_msg = 0;
+	} else {
+		sts_load_iv(STS_MSG_POLL);
+	}
+}
+
+void sts_handle_rx(void)
+{
+	if (active) {
+		sts_load_iv(STS_MSG_POLL);
+	}
+}
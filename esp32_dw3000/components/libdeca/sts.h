@@ -0,0 +1,83 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_STS_H
+#define DECA_STS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Secure ranging with the scrambled timestamp sequence (STS)
+ *
+ * The STS is generated by AES-128 in counter mode from a key and a 128 bit IV,
+ * so only devices with the same key can generate and verify it, and the RX
+ * timestamp is taken from it. With CONFIG_DECA_STS_SECURE:
+ *
+ * - sts_init() sets the secret key, which all devices of the network share.
+ * - sts_start_session() derives the STS key of a session in the AES engine of
+ *   the DW3000, straight into the STS key register, so it never appears on
+ *   the SPI bus. The IV of the session holds the session ID.
+ * - Each TWR exchange has its own IV: the counter of the initiator, which is
+ *   new for each poll, the lower 24 bits of its address and the message
+ *   index are XORed into the IV of the session. The final and report also
+ *   include a new counter of the responder. Both counters are sent in clear
+ *   in the poll and the response. An exchange is trusted only when the
+ *   response (initiator) or the final (responder) verifies, which needs the
+ *   key, and old frames can not be replayed into a new exchange because the
+ *   counter of the other side is new. No counter has to be in step between
+ *   devices, so nothing is lost when frames are, and a forged counter does
+ *   not change any state.
+ * - The poll and all frames outside of an exchange use the IV of the
+ *   session, so their STS verifies but can be replayed.
+ * - The IV is loaded explicitly after every frame, so nothing depends on
+ *   the counter increments of the hardware: after a frame with a reply was
+ *   sent the IV of the reply is loaded in the TX IRQ, after any other frame
+ *   and whenever RX ends (good or bad), the IV of the session.
+ * - Frames with bad STS quality are rejected by the TWR protocol.
+ * - The counters start at 0 in each session, use a new session ID after a
+ *   reboot.
+ *
+ * SP3 (STS_MODE_ND, no PHR and data) is only usable for frames without
+ * payload, sent with dwmac_transmit() of a zero length txbuf, TWR needs data.
+ */
+
+#define STS_KEY_LEN 16
+
+/* messages of a TWR exchange, in the IV */
+#define STS_MSG_POLL   0
+#define STS_MSG_RESP   1
+#define STS_MSG_FINAL  2
+#define STS_MSG_REPORT 3
+
+/** Set the secret key for deriving session keys */
+void sts_init(const uint8_t key[STS_KEY_LEN]);
+/** Derive and load the STS key and IV and enable STS mode 1 (or SP3) */
+bool sts_start_session(uint32_t session_id, bool sp3);
+/** Load an STS key and IV of a session which was set up elsewhere */
+bool sts_start_session_key(const uint8_t key[STS_KEY_LEN],
+						   const uint8_t iv[STS_KEY_LEN], bool sp3);
+void sts_stop(void);
+bool sts_is_active(void);
+
+/** A new counter for an exchange (initiator) or response (responder) */
+uint32_t sts_next_counter(void);
+/** Exchange of the next messages: initiator address and counter, and the
+ * counter of the responder (0 until the response is received) */
+void sts_set_exchange(uint64_t initiator, uint32_t init_ctr, uint32_t resp_ctr);
+/** Load the IV of message msg (STS_MSG_*) before it is sent. With reply, the IV
+ * of the next message is loaded after it was sent, for receiving it */
+void sts_load_msg(uint8_t msg, bool reply);
+
+/* INTERNAL: after a frame with STS was sent (IRQ) */
+void sts_handle_tx(void);
+/* INTERNAL: after a frame was received, good or bad, or RX ended (IRQ) */
+void sts_handle_rx(void);
+
+#endif
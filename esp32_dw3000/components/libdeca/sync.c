@@ -75,16 +75,16 @@ bool sync_send_long(uint64_t src)
 	return res;
 }
 
-void sync_handle_msg(const struct rxbuf* rx)
+void sync_handle_msg(const struct dwprot_frame* f)
 {
-	if (dwprot_get_payload_len(rx->buf, rx->len)
-		!= sizeof(struct toda_sync_msg)) {
+	if (f->payload_len != sizeof(struct toda_sync_msg)) {
 		LOG_ERR("Invalid sized message");
 		return;
 	}
 
-	uint64_t src = dwprot_get_src(rx->buf);
-	const struct toda_sync_msg* msg = dwprot_get_payload(rx->buf);
+	const struct rxbuf* rx = f->rx;
+	uint64_t src = f->src;
+	const struct toda_sync_msg* msg = (const void*)f->payload;
 
 	// LOG_DBGL_TS(DDL_TDOA, "\tTX TS*: ", msg->tx_ts);
 	// LOG_DBGL_TS(DDL_TDOA, "\tRX TS: ", rx->ts);
@@ -14,6 +14,7 @@
 #include <stdint.h>
 
 #include "dwmac.h"
+#include "dwproto.h"
 
 #define SYNC_MSG 0x10
 
@@ -22,7 +23,7 @@ typedef void (*sync_cb_t)(uint64_t src, uint32_t seq, uint64_t tx_ts,
 
 bool sync_send_short(void);
 bool sync_send_long(uint64_t src);
-void sync_handle_msg(const struct rxbuf* rx);
+void sync_handle_msg(const struct dwprot_frame* f);
 void sync_set_observer(sync_cb_t cb);
 
 #endif
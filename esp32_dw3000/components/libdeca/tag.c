@@ -0,0 +1,101 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include "tag.h"
+#include "blink.h"
+#include "dwhw.h"
+#include "log.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+static bool running;
+static uint64_t tag_src;
+static uint32_t interval_ms;
+static uint32_t interval_us;
+static uint32_t blink_cnt;
+static tag_cb_t tag_cb;
+
+static void tag_blink(void)
+{
+	/* the DW3000 goes to sleep after TX and the sleep counter starts */
+	if (!blink_send_long(tag_src, true)) {
+		LOG_ERR("Tag blink failed");
+	}
+	blink_cnt++;
+}
+
+static void tag_wakeup(void)
+{
+	if (!running) {
+		dwhw_disable_sleep_timer();
+		return;
+	}
+
+	if (tag_cb) {
+		tag_cb(blink_cnt);
+	}
+
+	if (blink_cnt % TAG_RECAL_BLINKS == 0) {
+		uint32_t us = dwhw_configure_sleep_timer(interval_ms);
+		if (us != 0) {
+			interval_us = us;
+		}
+	}
+
+	tag_blink();
+}
+
+bool tag_start(uint64_t src, uint32_t ms)
+{
+	if (!dwhw_is_ready()) {
+		LOG_ERR("Tag: DW3000 not ready");
+		return false;
+	}
+
+	interval_us = dwhw_configure_sleep_timer(ms);
+	if (interval_us == 0) {
+		return false;
+	}
+
+	tag_src = src;
+	interval_ms = ms;
+	blink_cnt = 0;
+	running = true;
+	dwhw_set_wakeup_observer(tag_wakeup);
+
+	tag_blink();
+	return true;
+}
+
+/* if the DW3000 is sleeping, the sleep timer is disabled on the next wake-up
+ * and the DW3000 then stays in IDLE */
+void tag_stop(void)
+{
+	running = false;
+	if (dwhw_is_ready()) {
+		dwhw_disable_sleep_timer();
+	}
+}
+
+bool tag_is_running(void)
+{
+	return running;
+}
+
+uint32_t tag_get_interval_us(void)
+{
+	return interval_us;
+}
+
+void tag_set_observer(tag_cb_t cb)
+{
+	tag_cb = cb;
+}
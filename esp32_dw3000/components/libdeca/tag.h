@@ -0,0 +1,40 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_TAG_H
+#define DECA_TAG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Tag engine for periodic blinks with minimum energy
+ *
+ * The DW3000 enters SLEEP automatically after each blink and wakes itself up
+ * with its sleep counter. The SPIRDY interrupt then triggers the next blink,
+ * so the host does not need to keep time and can sleep as well. The interval
+ * is the sleep time plus the (constant) TX and wake-up time.
+ *
+ * The low-power oscillator drifts with temperature and voltage, so it is
+ * recalibrated every TAG_RECAL_BLINKS blinks.
+ */
+
+#define TAG_RECAL_BLINKS 100
+
+/** Called after each wake-up, before the blink is sent */
+typedef void (*tag_cb_t)(uint32_t blink_cnt);
+
+bool tag_start(uint64_t src, uint32_t interval_ms);
+void tag_stop(void);
+bool tag_is_running(void);
+/** Real sleep interval in us (multiple of the sleep counter resolution) */
+uint32_t tag_get_interval_us(void);
+void tag_set_observer(tag_cb_t cb);
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "dwutil.h"
+#include "log.h"
+#include "platform/dwmac_task.h"
+#include "ranging.h"
+#include "twrfilt.h"
+
+#ifndef __ZEPHYR__
+static const char* LOG_TAG = "DECA";
+#endif
+
+/* initial velocity uncertainty */
+#define TWRFILT_VEL_INIT_CM_S 100.0f
+
+struct twrfilt_link {
+	uint64_t src;
+	uint64_t dst;
+	float d; // cm
+	float v; // cm/s
+	float p[2][2];
+	uint32_t last_us;
+	uint16_t raw[TWRFILT_MEDIAN]; // last raw ranges, ring
+	uint8_t raw_idx;
+	uint8_t num; // ranges since (re)start, saturates
+	uint8_t bad; // consecutive outliers
+};
+
+static const struct twrfilt_config twrfilt_default = {
+	.noise_cm = 10.0f,
+	.accel_cm_s2 = 100.0f,
+	.gate_sigma = 4.0f,
+	.max_outliers = 3,
+	.timeout_ms = 5000,
+};
+
+static struct twrfilt_config cfg;
+static struct twrfilt_link links[CONFIG_DECA_TWRFILT_PEERS];
+static twrfilt_cb_t twrfilt_cb;
+
+void twrfilt_init(const struct twrfilt_config* c)
+{
+	cfg = c != NULL ? *c : twrfilt_default;
+	memset(links, 0, sizeof(links));
+}
+
+void twrfilt_set_observer(twrfilt_cb_t cb)
+{
+	twrfilt_cb = cb;
+}
+
+static struct twrfilt_link* twrfilt_find(uint64_t src, uint64_t dst)
+{
+	for (int i = 0; i < CONFIG_DECA_TWRFILT_PEERS; i++) {
+		if (links[i].src == src && links[i].dst == dst) {
+			return &links[i];
+		}
+	}
+	return NULL;
+}
+
+static struct twrfilt_link* twrfilt_get(uint64_t src, uint64_t dst,
+										uint32_t now)
+{
+	struct twrfilt_link* l = twrfilt_find(src, dst);
+	if (l != NULL) {
+		return l;
+	}
+
+	/* replace the least recently used (or an empty one) */
+	l = &links[0];
+	for (int i = 1; i < CONFIG_DECA_TWRFILT_PEERS && l->src != 0; i++) {
+		if (links[i].src == 0 || now - links[i].last_us > now - l->last_us) {
+			l = &links[i];
+		}
+	}
+
+	memset(l, 0, sizeof(*l));
+	l->src = src;
+	l->dst = dst;
+	return l;
+}
+
+void twrfilt_reset(uint64_t src, uint64_t dst)
+{
+	struct twrfilt_link* l = twrfilt_find(src, dst);
+	if (l != NULL) {
+		l->num = 0;
+	}
+}
+
+static uint16_t twrfilt_median(const struct twrfilt_link* l)
+{
+	uint16_t a = l->raw[0];
+	uint16_t b = l->raw[1];
+	uint16_t c = l->raw[2];
+
+	if (l->num == 1) {
+		return l->raw[(l->raw_idx + TWRFILT_MEDIAN - 1) % TWRFILT_MEDIAN];
+	} else if (l->num == 2) {
+		/* the two in the ring before raw_idx */
+		a = l->raw[(l->raw_idx + TWRFILT_MEDIAN - 1) % TWRFILT_MEDIAN];
+		b = l->raw[(l->raw_idx + TWRFILT_MEDIAN - 2) % TWRFILT_MEDIAN];
+		return (a + b) / 2;
+	}
+
+	if ((a <= b && b <= c) || (c <= b && b <= a)) {
+		return b;
+	} else if ((b <= a && a <= c) || (c <= a && a <= b)) {
+		return a;
+	}
+	return c;
+}
+
+static void twrfilt_start(struct twrfilt_link* l)
+{
+	l->d = twrfilt_median(l);
+	l->v = 0;
+	l->p[0][0] = cfg.noise_cm * cfg.noise_cm;
+	l->p[0][1] = l->p[1][0] = 0;
+	l->p[1][1] = TWRFILT_VEL_INIT_CM_S * TWRFILT_VEL_INIT_CM_S;
+	l->bad = 0;
+}
+
+static uint16_t twrfilt_cm(float d)
+{
+	if (d <= 0) {
+		return 0;
+	}
+	if (d >= TWR_OK_VALUE - 1) {
+		return TWR_OK_VALUE - 1;
+	}
+	return lroundf(d);
+}
+
+bool twrfilt_update(uint64_t src, uint64_t dst, uint16_t dist,
+					struct twrfilt_result* res)
+{
+	if (dist == TWR_FAILED_VALUE || dist == TWR_OK_VALUE) {
+		return false;
+	}
+
+	uint32_t now = dwtask_get_time_us();
+	struct twrfilt_link* l = twrfilt_get(src, dst, now);
+	float dt = (now - l->last_us) / 1000000.0f;
+
+	res->raw_cm = dist;
+	res->flags = 0;
+
+	if (l->num > 0 && now - l->last_us > cfg.timeout_ms * 1000U) {
+		l->num = 0;
+		res->flags |= TWRFILT_RESET;
+	}
+	l->last_us = now;
+
+	l->raw[l->raw_idx] = dist;
+	l->raw_idx = (l->raw_idx + 1) % TWRFILT_MEDIAN;
+
+	if (l->num < TWRFILT_MEDIAN) {
+		l->num++;
+		if (l->num < TWRFILT_MEDIAN) {
+			res->flags |= TWRFILT_INIT;
+			res->dist_cm = twrfilt_median(l);
+			res->vel_cm_s = 0;
+			res->std_cm = cfg.noise_cm;
+			return true;
+		}
+		twrfilt_start(l);
+		goto out;
+	}
+
+	/* predict */
+	float(*p)[2] = l->p;
+	float q = cfg.accel_cm_s2 * cfg.accel_cm_s2;
+	float dt2 = dt * dt;
+	l->d += l->v * dt;
+	p[0][0] += dt * (p[0][1] + p[1][0]) + dt2 * p[1][1] + q * dt2 * dt2 / 4;
+	p[0][1] += dt * p[1][1] + q * dt2 * dt / 2;
+	p[1][0] = p[0][1];
+	p[1][1] += q * dt2;
+
+	/* gate */
+	float y = dist - l->d;
+	float s = p[0][0] + cfg.noise_cm * cfg.noise_cm;
+	if (y * y > cfg.gate_sigma * cfg.gate_sigma * s) {
+		if (++l->bad >= cfg.max_outliers) {
+			LOG_DBG("Range filter " LADDR_FMT " -> " LADDR_FMT ": restart",
+					LADDR_PAR(src), LADDR_PAR(dst));
+			twrfilt_start(l);
+			res->flags |= TWRFILT_RESET;
+		} else {
+			res->flags |= TWRFILT_OUTLIER;
+		}
+		goto out;
+	}
+
+	/* update */
+	float k0 = p[0][0] / s;
+	float k1 = p[1][0] / s;
+	l->d += k0 * y;
+	l->v += k1 * y;
+	p[1][1] -= k1 * p[0][1];
+	p[0][1] *= 1 - k0;
+	p[1][0] = p[0][1];
+	p[0][0] *= 1 - k0;
+	l->bad = 0;
+
+out:
+	res->flags |= TWRFILT_VALID;
+	res->dist_cm = twrfilt_cm(l->d);
+	res->vel_cm_s = l->v;
+	res->std_cm = sqrtf(l->p[0][0]);
+	return true;
+}
+
+void twrfilt_handle_twr(uint64_t src, uint64_t dst, uint16_t dist,
+						uint16_t num)
+{
+	struct twrfilt_result res;
+
+	if (twrfilt_update(src, dst, dist, &res) && twrfilt_cb) {
+		twrfilt_cb(src, dst, &res);
+	}
+}
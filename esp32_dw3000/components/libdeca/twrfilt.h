@@ -0,0 +1,73 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#ifndef DECA_TWRFILT_H
+#define DECA_TWRFILT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Per link range filter
+ *
+ * Each link (initiator, responder) has a Kalman filter with the state
+ * (distance, velocity) in a fixed size table. A new link replaces the least
+ * recently used one. The filter starts with the median of the first three
+ * ranges. Ranges too far away from the prediction (innovation gate in
+ * standard deviations) are rejected as outliers, e.g. NLOS spikes, and after
+ * some consecutive outliers the filter restarts from the median of the last
+ * three ranges, because the peer may really have moved.
+ *
+ * twrfilt_handle_twr() can be used as TWR observer and calls the observer
+ * with the filtered distance and quality flags.
+ */
+
+#ifndef CONFIG_DECA_TWRFILT_PEERS
+#define CONFIG_DECA_TWRFILT_PEERS 8
+#endif
+
+#define TWRFILT_MEDIAN 3
+
+/* quality flags */
+#define TWRFILT_VALID	0x01 // filter is initialized, dist_cm can be used
+#define TWRFILT_INIT	0x02 // still collecting the first ranges
+#define TWRFILT_OUTLIER 0x04 // raw range rejected, dist_cm is the prediction
+#define TWRFILT_RESET	0x08 // filter restarted (outliers or timeout)
+
+struct twrfilt_config {
+	float noise_cm;		  // standard deviation of a range
+	float accel_cm_s2;	  // standard deviation of the acceleration
+	float gate_sigma;	  // outlier gate in standard deviations
+	uint8_t max_outliers; // consecutive outliers before restart
+	uint32_t timeout_ms;  // restart when no range for this long
+};
+
+struct twrfilt_result {
+	uint16_t raw_cm;
+	uint16_t dist_cm;
+	float vel_cm_s;
+	float std_cm; // standard deviation of dist_cm
+	uint8_t flags;
+};
+
+typedef void (*twrfilt_cb_t)(uint64_t src, uint64_t dst,
+							 const struct twrfilt_result* res);
+
+/** Clear all links. cfg is copied, NULL uses the defaults */
+void twrfilt_init(const struct twrfilt_config* cfg);
+/** Filter a range of a link. False for failed ranges */
+bool twrfilt_update(uint64_t src, uint64_t dst, uint16_t dist,
+					struct twrfilt_result* res);
+/** Can be used as TWR observer (twr_set_observer()) or be called from it */
+void twrfilt_handle_twr(uint64_t src, uint64_t dst, uint16_t dist,
+						uint16_t num);
+void twrfilt_set_observer(twrfilt_cb_t cb);
+void twrfilt_reset(uint64_t src, uint64_t dst);
+
+#endif
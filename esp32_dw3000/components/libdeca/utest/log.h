@@ -0,0 +1,23 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+/* logging for the host unit tests */
+
+#include <stdio.h>
+
+#define LOG_ERR(fmt, ...)  fprintf(stderr, "E: " fmt "\n", ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...) fprintf(stderr, "W: " fmt "\n", ##__VA_ARGS__)
+#define LOG_INF(fmt, ...)  fprintf(stderr, "I: " fmt "\n", ##__VA_ARGS__)
+#define LOG_DBG(...)
+
+#define LOG_HEXDUMP(...)
+#define DBG_UWB(...)
+#define LOG_INF_IRQ(...) LOG_INF(__VA_ARGS__)
+#define LOG_ERR_IRQ(...) LOG_ERR(__VA_ARGS__)
+#define DBG_UWB_IRQ(...)
@@ -0,0 +1,158 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+extern "C"
+{
+#include "antcal.h"
+#include "blink.h"
+#include "bulk.h"
+#include "dwproto.h"
+#include "dwsec.h"
+#include "ranging.h"
+#include "sync.h"
+
+/* the handlers and MAC functions dwproto.c refers to */
+void twr_handle_message(const struct dwprot_frame*) {}
+void sync_handle_msg(const struct dwprot_frame*) {}
+void antcal_handle_message(const struct dwprot_frame*) {}
+void bulk_handle_message(const struct dwprot_frame*) {}
+void blink_handle_msg_short(const struct rxbuf*) {}
+void blink_handle_msg_long(const struct rxbuf*) {}
+uint16_t dwmac_get_mac16(void) { return 0x1234; }
+uint16_t dwmac_get_panid(void) { return 0xdeca; }
+uint64_t dwmac_get_mac64(void) { return 0x1122334455667788; }
+void dwmac_tx_prepare_null(struct txbuf* tx) { tx->len = 0; }
+uint8_t dwsec_get_level(void) { return MAC154_SEC_LVL_NONE; }
+}
+
+#define TEST_FUNC 0xE5
+#define TEST_SRC  0xabcd
+#define TEST_DST  0x1234
+
+static int handled;
+static struct dwprot_frame last;
+
+static void test_handler(const struct dwprot_frame* f)
+{
+    handled++;
+    last = *f;
+}
+
+class TestDwproto : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        handled = 0;
+        memset(&last, 0, sizeof(last));
+        memset(&rx, 0, sizeof(rx));
+        dwprot_register(TEST_FUNC, test_handler);
+    }
+
+    void TearDown() override { dwprot_register(TEST_FUNC, NULL); }
+
+    /* short frame with 3 bytes payload, as received */
+    void short_frame(uint16_t fc)
+    {
+        struct prot_short* ps = (struct prot_short*)rx.buf;
+        ps->hdr.fc = fc;
+        ps->hdr.seqNo = 1;
+        ps->hdr.panId = 0xdeca;
+        ps->hdr.dst = TEST_DST;
+        ps->hdr.src = TEST_SRC;
+        ps->func = TEST_FUNC;
+        ps->pbuf[0] = 1;
+        ps->pbuf[1] = 2;
+        ps->pbuf[2] = 3;
+        rx.len = DWMAC_PROTO_SHORT_LEN + 3;
+    }
+
+    /* long frame with 3 bytes payload, as received */
+    void long_frame(uint16_t fc)
+    {
+        struct prot_long* pl = (struct prot_long*)rx.buf;
+        pl->hdr.fc = fc;
+        pl->hdr.dst = 0x0102030405060708;
+        pl->hdr.src = 0x1122334455667788;
+        pl->func = TEST_FUNC;
+        rx.len = DWMAC_PROTO_LONG_LEN + 3;
+    }
+
+    struct rxbuf rx;
+};
+
+TEST_F(TestDwproto, shortFrame)
+{
+    short_frame(MAC154_FC_SHORT);
+    dwprot_rx_handler(&rx);
+
+    ASSERT_EQ(handled, 1);
+    EXPECT_EQ(last.src, TEST_SRC);
+    EXPECT_EQ(last.dst, TEST_DST);
+    EXPECT_EQ(last.func, TEST_FUNC);
+    EXPECT_EQ(last.payload_len, 3u);
+    EXPECT_EQ(last.payload[2], 3);
+}
+
+TEST_F(TestDwproto, shortFrameAckRequest)
+{
+    short_frame(MAC154_FC_SHORT | MAC154_FC_ACK_REQ);
+    dwprot_rx_handler(&rx);
+
+    ASSERT_EQ(handled, 1);
+    EXPECT_EQ(last.src, TEST_SRC);
+    EXPECT_EQ(last.payload_len, 3u);
+    EXPECT_EQ(dwprot_get_src(rx.buf), TEST_SRC);
+    EXPECT_EQ(dwprot_get_func(rx.buf), TEST_FUNC);
+    EXPECT_EQ(dwprot_get_payload(rx.buf), rx.buf + sizeof(struct prot_short));
+    EXPECT_EQ(dwprot_get_payload_len(rx.buf, rx.len), 3u);
+    EXPECT_TRUE(dwprot_check_min_len(rx.buf, rx.len));
+}
+
+TEST_F(TestDwproto, shortFrameFramePending)
+{
+    short_frame(MAC154_FC_SHORT | MAC154_FC_FRAME_PEND);
+    dwprot_rx_handler(&rx);
+
+    EXPECT_EQ(handled, 1);
+}
+
+TEST_F(TestDwproto, longFrameAckRequest)
+{
+    long_frame(MAC154_FC_LONG | MAC154_FC_ACK_REQ);
+    dwprot_rx_handler(&rx);
+
+    ASSERT_EQ(handled, 1);
+    EXPECT_EQ(last.src, 0x1122334455667788u);
+    EXPECT_EQ(last.dst, 0x0102030405060708u);
+    EXPECT_EQ(last.payload_len, 3u);
+}
+
+/* still secured: the auxiliary header would be taken as payload */
+TEST_F(TestDwproto, securedFrameNotParsed)
+{
+    short_frame(MAC154_FC_SHORT | MAC154_FC_SECURITY);
+    dwprot_rx_handler(&rx);
+
+    EXPECT_EQ(handled, 0);
+    EXPECT_FALSE(dwprot_check_min_len(rx.buf, rx.len));
+}
+
+TEST_F(TestDwproto, tooShort)
+{
+    short_frame(MAC154_FC_SHORT | MAC154_FC_ACK_REQ);
+    rx.len = DWMAC_PROTO_SHORT_LEN - 1;
+    dwprot_rx_handler(&rx);
+
+    EXPECT_EQ(handled, 0);
+}
@@ -0,0 +1,251 @@
+/*
+ * libdeca - UWB Library for Qorvo/Decawave DW3000
+ *
+ * Copyright (C) 2016 - 2024 Bruno Randolf (br@einfach.org)
+ *
+ * This source code is licensed under the GNU Lesser General Public License,
+ * Version 3. See the file LICENSE.txt for more details.
+ */
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+extern "C"
+{
+#include "pos.h"
+}
+
+#define POS_TOL_M 0.01f
+
+/* 10 x 8 m room, anchors on the walls at different heights */
+static const struct pos_anchor room[] = {
+    {1, 0, 0, 2.5f},
+    {2, 10, 0, 2.0f},
+    {3, 10, 8, 2.6f},
+    {4, 0, 8, 1.0f},
+    {5, 5, 4, 3.0f},
+};
+
+static float dist(const struct pos_anchor* a, float x, float y, float z)
+{
+    return sqrtf((a->x - x) * (a->x - x) + (a->y - y) * (a->y - y)
+                 + (a->z - z) * (a->z - z));
+}
+
+static std::vector<float> twr_dists(const struct pos_anchor* anchors, size_t num,
+                                    float x, float y, float z)
+{
+    std::vector<float> d(num);
+    for (size_t i = 0; i < num; i++) {
+        d[i] = dist(&anchors[i], x, y, z);
+    }
+    return d;
+}
+
+static std::vector<float> tdoa_rds(const struct pos_anchor* anchors, size_t num,
+                                   float x, float y, float z)
+{
+    std::vector<float> rd(num);
+    float d0 = dist(&anchors[0], x, y, z);
+    for (size_t i = 0; i < num; i++) {
+        rd[i] = dist(&anchors[i], x, y, z) - d0;
+    }
+    return rd;
+}
+
+struct pos_point {
+    float x, y, z;
+};
+
+class TestPosSolve : public ::testing::TestWithParam<pos_point>
+{
+};
+
+INSTANTIATE_TEST_SUITE_P(RoomPoints, TestPosSolve,
+                         testing::Values(pos_point{3, 4, 1.2f},
+                                         pos_point{0.5f, 0.5f, 0.3f},
+                                         pos_point{9, 7, 1.8f},
+                                         pos_point{5, 4, 0},
+                                         /* outside of the anchors */
+                                         pos_point{12, -2, 1}));
+
+TEST_P(TestPosSolve, twr2d)
+{
+    pos_point t = GetParam();
+    struct pos_fix fix;
+    auto d = twr_dists(room, 4, t.x, t.y, t.z);
+
+    ASSERT_TRUE(pos_solve_twr(room, d.data(), 4, false, t.z, &fix));
+    EXPECT_NEAR(fix.x, t.x, POS_TOL_M);
+    EXPECT_NEAR(fix.y, t.y, POS_TOL_M);
+    EXPECT_FLOAT_EQ(fix.z, t.z);
+    EXPECT_LT(fix.rmse, POS_TOL_M);
+    EXPECT_EQ(fix.num, 4);
+    EXPECT_FALSE(fix.tdoa);
+}
+
+TEST_P(TestPosSolve, twr3d)
+{
+    pos_point t = GetParam();
+    struct pos_fix fix;
+    auto d = twr_dists(room, 5, t.x, t.y, t.z);
+
+    ASSERT_TRUE(pos_solve_twr(room, d.data(), 5, true, 0, &fix));
+    EXPECT_NEAR(fix.x, t.x, POS_TOL_M);
+    EXPECT_NEAR(fix.y, t.y, POS_TOL_M);
+    EXPECT_NEAR(fix.z, t.z, POS_TOL_M);
+    EXPECT_LT(fix.rmse, POS_TOL_M);
+}
+
+TEST_P(TestPosSolve, tdoa2d)
+{
+    pos_point t = GetParam();
+    struct pos_fix fix;
+    auto rd = tdoa_rds(room, 5, t.x, t.y, t.z);
+
+    ASSERT_TRUE(pos_solve_tdoa(room, rd.data(), 5, false, t.z, &fix));
+    EXPECT_NEAR(fix.x, t.x, POS_TOL_M);
+    EXPECT_NEAR(fix.y, t.y, POS_TOL_M);
+    EXPECT_TRUE(fix.tdoa);
+    EXPECT_EQ(fix.num, 5);
+}
+
+TEST_P(TestPosSolve, tdoa3d)
+{
+    pos_point t = GetParam();
+    struct pos_fix fix;
+    auto rd = tdoa_rds(room, 5, t.x, t.y, t.z);
+
+    ASSERT_TRUE(pos_solve_tdoa(room, rd.data(), 5, true, 0, &fix));
+    EXPECT_NEAR(fix.x, t.x, POS_TOL_M);
+    EXPECT_NEAR(fix.y, t.y, POS_TOL_M);
+    EXPECT_NEAR(fix.z, t.z, POS_TOL_M);
+}
+
+/* +-5 cm error on the distances stays in the same order */
+TEST(TestPosSolveNoise, twr2d)
+{
+    const float err[] = {0.05f, -0.05f, 0.03f, -0.02f};
+    struct pos_fix fix;
+    auto d = twr_dists(room, 4, 3, 4, 1.2f);
+    for (size_t i = 0; i < 4; i++) {
+        d[i] += err[i];
+    }
+
+    ASSERT_TRUE(pos_solve_twr(room, d.data(), 4, false, 1.2f, &fix));
+    EXPECT_NEAR(fix.x, 3, 0.1f);
+    EXPECT_NEAR(fix.y, 4, 0.1f);
+    EXPECT_GT(fix.rmse, 0);
+    EXPECT_LT(fix.rmse, 0.1f);
+}
+
+TEST(TestPosSolveDegenerate, tooFewAnchors)
+{
+    struct pos_fix fix;
+    auto d = twr_dists(room, 5, 3, 4, 1);
+
+    EXPECT_FALSE(pos_solve_twr(room, d.data(), 2, false, 1, &fix));
+    EXPECT_FALSE(pos_solve_twr(room, d.data(), 3, true, 0, &fix));
+    EXPECT_FALSE(pos_solve_tdoa(room, d.data(), 2, false, 1, &fix));
+    EXPECT_FALSE(pos_solve_tdoa(room, d.data(), 3, true, 0, &fix));
+}
+
+TEST(TestPosSolveDegenerate, tooManyAnchors)
+{
+    struct pos_anchor many[POS_MAX_ANCHORS + 1];
+    float d[POS_MAX_ANCHORS + 1];
+    struct pos_fix fix;
+    for (int i = 0; i <= POS_MAX_ANCHORS; i++) {
+        many[i] = room[i % 5];
+        d[i] = 1;
+    }
+
+    EXPECT_FALSE(
+        pos_solve_twr(many, d, POS_MAX_ANCHORS + 1, false, 1, &fix));
+}
+
+/* anchors on a line can't give the side of the line */
+TEST(TestPosSolveDegenerate, collinear2d)
+{
+    const struct pos_anchor line[] = {
+        {1, 0, 0, 2}, {2, 4, 0, 2}, {3, 8, 0, 2}, {4, 12, 0, 2}};
+    struct pos_fix fix;
+    auto d = twr_dists(line, 4, 3, 4, 1);
+
+    EXPECT_FALSE(pos_solve_twr(line, d.data(), 4, false, 1, &fix));
+}
+
+TEST(TestPosSolveDegenerate, sameAnchor)
+{
+    const struct pos_anchor same[] = {
+        {1, 2, 2, 2}, {2, 2, 2, 2}, {3, 2, 2, 2}, {4, 2, 2, 2}};
+    struct pos_fix fix;
+    auto d = twr_dists(same, 4, 3, 4, 1);
+
+    EXPECT_FALSE(pos_solve_twr(same, d.data(), 4, false, 1, &fix));
+}
+
+/* all anchors at the same height in 3D: the linear start fails, the solution
+ * below the anchors is found from the centroid */
+TEST(TestPosSolveDegenerate, coplanar3d)
+{
+    const struct pos_anchor ceiling[] = {
+        {1, 0, 0, 3}, {2, 10, 0, 3}, {3, 10, 8, 3}, {4, 0, 8, 3}};
+    struct pos_fix fix;
+    auto d = twr_dists(ceiling, 4, 3, 4, 1);
+
+    ASSERT_TRUE(pos_solve_twr(ceiling, d.data(), 4, true, 0, &fix));
+    EXPECT_NEAR(fix.x, 3, POS_TOL_M);
+    EXPECT_NEAR(fix.y, 4, POS_TOL_M);
+    EXPECT_NEAR(fix.z, 1, POS_TOL_M);
+}
+
+/* inconsistent distances don't give a position with a small error */
+TEST(TestPosSolveDegenerate, inconsistent)
+{
+    const float d[] = {1, 1, 1, 1};
+    struct pos_fix fix;
+
+    if (pos_solve_twr(room, d, 4, false, 1, &fix)) {
+        EXPECT_GT(fix.rmse, 1);
+    }
+}
+
+/* average time of one solution, for comparing with the target */
+TEST(TestPosSolveTiming, solve)
+{
+    const int n = 10000;
+    struct pos_fix fix;
+    auto d2 = twr_dists(room, 4, 3, 4, 1.2f);
+    auto d3 = twr_dists(room, 5, 3, 4, 1.2f);
+    auto rd = tdoa_rds(room, 5, 3, 4, 1.2f);
+    const struct {
+        const char* name;
+        bool (*f)(const struct pos_anchor*, const float*, size_t, bool, float,
+                  struct pos_fix*);
+        const float* m;
+        size_t num;
+        bool is_3d;
+    } cases[] = {
+        {"twr2d", pos_solve_twr, d2.data(), 4, false},
+        {"twr3d", pos_solve_twr, d3.data(), 5, true},
+        {"tdoa2d", pos_solve_tdoa, rd.data(), 5, false},
+        {"tdoa3d", pos_solve_tdoa, rd.data(), 5, true},
+    };
+
+    for (const auto& c : cases) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            ASSERT_TRUE(c.f(room, c.m, c.num, c.is_3d, 1.2f, &fix));
+        }
+        auto end = std::chrono::steady_clock::now();
+        double us
+            = std::chrono::duration<double, std::micro>(end - start).count() / n;
+        printf("%-8s %.2f us, %d iterations\n", c.name, us, fix.iter);
+        RecordProperty(c.name, std::to_string(us));
+        EXPECT_LE(fix.iter, POS_MAX_ITER);
+    }
+}